@@ -0,0 +1,151 @@
+// Only part of the allocation accounting build, see alloc.h.
+#ifdef ALLOC_STATS
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "quarto.h"
+
+// glibc's allocator, which the definitions below wrap
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *memory, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *memory);
+
+struct AllocCounters {
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t frees;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t ns;
+};
+
+static const char *alloc_phase_names[ALLOC_PHASE_COUNT] = {
+    "other", "handshake", "game", "parse_field", "regex", "regex_match", "shm_players", "safe_move", "thinker_move"
+};
+
+static const bool alloc_hot[ALLOC_PHASE_COUNT] = {
+    [ALLOC_SHM_PLAYERS] = true,
+    [ALLOC_SAFE_MOVE] = true,
+    [ALLOC_THINKER_MOVE] = true,
+};
+
+_Thread_local int alloc_current_phase = ALLOC_OTHER;
+
+static struct AllocCounters alloc_counters[ALLOC_PHASE_COUNT];
+static bool alloc_strict = false;
+
+static void alloc_count_allocation(size_t size, uint64_t start_ns) {
+    int phase = alloc_current_phase;
+    struct AllocCounters *counters = &alloc_counters[phase];
+    atomic_fetch_add_explicit(&counters->allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->ns, quarto_now_ns() - start_ns, memory_order_relaxed);
+    if (alloc_strict && alloc_hot[phase]) {
+        abort();
+    }
+}
+
+static void alloc_count_free(uint64_t start_ns) {
+    struct AllocCounters *counters = &alloc_counters[alloc_current_phase];
+    atomic_fetch_add_explicit(&counters->frees, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->ns, quarto_now_ns() - start_ns, memory_order_relaxed);
+}
+
+void *malloc(size_t size) {
+    uint64_t start_ns = quarto_now_ns();
+    void *memory = __libc_malloc(size);
+    alloc_count_allocation(size, start_ns);
+    return memory;
+}
+
+void *calloc(size_t count, size_t size) {
+    uint64_t start_ns = quarto_now_ns();
+    void *memory = __libc_calloc(count, size);
+    alloc_count_allocation(count * size, start_ns);
+    return memory;
+}
+
+void *realloc(void *memory, size_t size) {
+    uint64_t start_ns = quarto_now_ns();
+    void *new_memory = __libc_realloc(memory, size);
+    alloc_count_allocation(size, start_ns);
+    return new_memory;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    uint64_t start_ns = quarto_now_ns();
+    void *memory = __libc_memalign(alignment, size);
+    alloc_count_allocation(size, start_ns);
+    return memory;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memory, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *aligned = memalign(alignment, size);
+    if (aligned == NULL) {
+        return ENOMEM;
+    }
+    *memory = aligned;
+    return 0;
+}
+
+void free(void *memory) {
+    if (memory == NULL) {
+        return;
+    }
+    uint64_t start_ns = quarto_now_ns();
+    __libc_free(memory);
+    alloc_count_free(start_ns);
+}
+
+// The thinker process starts its own accounting, the allocations before the fork belong to the connector.
+static void alloc_reset_child() {
+    memset(alloc_counters, 0, sizeof(alloc_counters));
+}
+
+static void alloc_print_summary() {
+    uint64_t hot_allocations = 0;
+    fprintf(stderr, "Allocations of process %d:\n", getpid());
+    fprintf(stderr, "%-14s %10s %10s %12s %10s\n", "phase", "allocs", "frees", "bytes", "time us");
+    for (int phase = 0; phase < ALLOC_PHASE_COUNT; phase++) {
+        struct AllocCounters *counters = &alloc_counters[phase];
+        uint64_t allocations = atomic_load(&counters->allocations);
+        uint64_t frees = atomic_load(&counters->frees);
+        if (allocations == 0 && frees == 0) {
+            continue;
+        }
+        fprintf(stderr, "%-14s %10llu %10llu %12llu %10.1f\n", alloc_phase_names[phase], (unsigned long long)allocations,
+                (unsigned long long)frees, (unsigned long long)atomic_load(&counters->bytes), atomic_load(&counters->ns) / 1000.0);
+        if (alloc_hot[phase]) {
+            hot_allocations += allocations;
+        }
+    }
+    if (hot_allocations > 0) {
+        fprintf(stderr, "ERROR: %llu allocations in hot phases, which must be allocation-free\n", (unsigned long long)hot_allocations);
+    } else {
+        fprintf(stderr, "Hot phases are allocation-free\n");
+    }
+}
+
+__attribute__((constructor)) static void alloc_init() {
+    char *strict = getenv("ALLOC_STRICT");
+    alloc_strict = strict != NULL && strcmp(strict, "1") == 0;
+    pthread_atfork(NULL, NULL, alloc_reset_child);
+    atexit(alloc_print_summary);
+}
+
+#endif
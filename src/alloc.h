@@ -0,0 +1,60 @@
+#ifndef alloc_h
+#define alloc_h
+
+#include <stdint.h>
+
+// Allocation accounting, opt-in: in a build with -DALLOC_STATS (make sysprak-client-alloc), malloc, calloc,
+// realloc, free and the aligned variants are defined by the executable and forward to glibc's __libc_*
+// functions. The executable's definitions take precedence for every caller in the process, so allocations
+// inside libc (regcomp(), asprintf(), strdup(), stdio, ...) are counted as well, as with LD_PRELOAD.
+//
+// Every call is attributed to the phase the calling thread is in (the innermost alloc_phase_enter()), with its
+// count, bytes and the time spent in the allocator. A summary per phase is printed to stderr at exit (by both
+// processes in fork mode). Hot phases must stay allocation-free: the summary reports their allocations, and with
+// ALLOC_STRICT=1 in the environment the first one aborts, so a debugger shows where it came from.
+//
+// Without ALLOC_STATS, entering and leaving phases compiles to nothing.
+enum AllocPhase {
+    ALLOC_OTHER,        // outside of any phase: startup, configuration, teardown
+    ALLOC_HANDSHAKE,    // client_play() until + ENDPLAYERS
+    ALLOC_GAME,         // game loop of the connector, unless in one of the phases below
+    ALLOC_PARSE_FIELD,  // client_expect_field()
+    ALLOC_REGEX,        // regcomp() and regexec() of client_check_message_regex()
+    ALLOC_REGEX_MATCH,  // malloc_regex_match()
+    ALLOC_SHM_PLAYERS,  // shm_set_players() and shm_get_players(), hot
+    ALLOC_SAFE_MOVE,    // get_safe_move() of the connector's watchdog, hot
+    ALLOC_THINKER_MOVE, // thinker_think(), from reading the field to publishing the final move, hot
+    ALLOC_PHASE_COUNT
+};
+
+#ifdef ALLOC_STATS
+
+extern _Thread_local int alloc_current_phase;
+
+// Attribute the allocations of this thread to phase until alloc_phase_leave().
+//
+// Returns the phase to pass to alloc_phase_leave().
+static inline int alloc_phase_enter(int phase) {
+    int previous = alloc_current_phase;
+    alloc_current_phase = phase;
+    return previous;
+}
+
+static inline void alloc_phase_leave(int previous) {
+    alloc_current_phase = previous;
+}
+
+#else
+
+static inline int alloc_phase_enter(int phase) {
+    (void)phase;
+    return ALLOC_OTHER;
+}
+
+static inline void alloc_phase_leave(int previous) {
+    (void)previous;
+}
+
+#endif
+
+#endif
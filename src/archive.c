@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+// Write all of data at the end of fd (opened with O_APPEND).
+//
+// Returns 0 on success, -1 otherwise.
+static int archive_write_all(int fd, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Open (or create) path for appending and write header into it if it is new, or check that it starts with it.
+//
+// Returns the file descriptor, -1 on error.
+static int archive_open_file(const char *path, const void *header, size_t header_length) {
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Error opening archive file");
+        return -1;
+    }
+
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            perror("Error locking archive file");
+            close(fd);
+            return -1;
+        }
+    }
+
+    int ret = 0;
+    struct stat st;
+    unsigned char existing[sizeof(struct ArchiveIndexHeader)];
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading archive file size");
+        ret = -1;
+    } else if (st.st_size == 0) {
+        if (archive_write_all(fd, header, header_length) != 0) {
+            perror("Error writing archive file");
+            ret = -1;
+        }
+    } else if (pread(fd, existing, header_length, 0) != (ssize_t)header_length || memcmp(existing, header, 8) != 0) {
+        printf("%s is no archive file\n", path);
+        ret = -1;
+    }
+
+    flock(fd, LOCK_UN);
+    if (ret != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Append the records of batch and their index entries, then sync all files.
+static void archive_write_batch(struct Archive *archive, struct ArchivePending *batch) {
+    while (flock(archive->fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            perror("Error locking archive file");
+            return;
+        }
+    }
+
+    off_t end = lseek(archive->fd, 0, SEEK_END);
+    for (struct ArchivePending *pending = batch; pending != NULL && end >= 0; pending = pending->next) {
+        if (archive_write_all(archive->fd, pending->data, pending->length) != 0) {
+            perror("Error writing archive record");
+            // cut off the partial record, so scans reach the records appended later
+            if (ftruncate(archive->fd, end) != 0) {
+                perror("Error truncating archive file");
+            }
+            break;
+        }
+
+        struct ArchiveGameIndexEntry game_entry = {0};
+        memcpy(game_entry.game_id, pending->game_id, ARCHIVE_GAME_ID_LENGTH);
+        game_entry.offset = end;
+
+        struct ArchivePositionIndexEntry position_entries[BOARD_MAX_SQUARES];
+        for (int i = 0; i < pending->key_count; i++) {
+            position_entries[i].key = pending->keys[i];
+            position_entries[i].offset = end;
+            position_entries[i].move = i;
+            position_entries[i].reserved = 0;
+        }
+
+        if (archive_write_all(archive->game_index_fd, &game_entry, sizeof(game_entry)) != 0
+            || archive_write_all(archive->position_index_fd, position_entries,
+                                 pending->key_count * sizeof(struct ArchivePositionIndexEntry)) != 0) {
+            perror("Error writing archive index");
+        }
+        end += pending->length;
+    }
+
+    flock(archive->fd, LOCK_UN);
+
+    if (fdatasync(archive->fd) != 0 || fdatasync(archive->game_index_fd) != 0 || fdatasync(archive->position_index_fd) != 0) {
+        perror("Error syncing archive");
+    }
+}
+
+static void *archive_writer_main(void *arg) {
+    struct Archive *archive = arg;
+
+    pthread_mutex_lock(&archive->mutex);
+    while (true) {
+        while (archive->pending == NULL && !archive->closing) {
+            pthread_cond_wait(&archive->cond, &archive->mutex);
+        }
+        if (archive->pending == NULL) {
+            break;
+        }
+
+        // let more records join the batch, so they share one lock and one sync
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += ARCHIVE_FLUSH_MS / 1000;
+        until.tv_nsec += (ARCHIVE_FLUSH_MS % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        while (!archive->closing && archive->pending_count < ARCHIVE_BATCH_GAMES) {
+            if (pthread_cond_timedwait(&archive->cond, &archive->mutex, &until) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        struct ArchivePending *batch = archive->pending;
+        archive->pending = NULL;
+        archive->pending_tail = &archive->pending;
+        archive->pending_count = 0;
+        pthread_mutex_unlock(&archive->mutex);
+
+        archive_write_batch(archive, batch);
+        while (batch != NULL) {
+            struct ArchivePending *next = batch->next;
+            free(batch);
+            batch = next;
+        }
+
+        pthread_mutex_lock(&archive->mutex);
+    }
+    pthread_mutex_unlock(&archive->mutex);
+
+    return NULL;
+}
+
+struct Archive *archive_open(const char *path) {
+    struct Archive *archive = malloc(sizeof(struct Archive));
+    if (archive == NULL) {
+        perror("archive malloc failed");
+        return NULL;
+    }
+    archive->fd = -1;
+    archive->game_index_fd = -1;
+    archive->position_index_fd = -1;
+    archive->pending = NULL;
+    archive->pending_tail = &archive->pending;
+    archive->pending_count = 0;
+    archive->closing = false;
+    archive->game_started = false;
+
+    char *game_index_path = NULL;
+    char *position_index_path = NULL;
+    if (asprintf(&game_index_path, "%s%s", path, ARCHIVE_GAME_INDEX_SUFFIX) == -1) {
+        game_index_path = NULL;
+        goto error;
+    }
+    if (asprintf(&position_index_path, "%s%s", path, ARCHIVE_POSITION_INDEX_SUFFIX) == -1) {
+        position_index_path = NULL;
+        goto error;
+    }
+
+    struct ArchiveIndexHeader index_header = {ARCHIVE_INDEX_MAGIC, 0};
+    archive->fd = archive_open_file(path, ARCHIVE_MAGIC, 8);
+    if (archive->fd < 0) {
+        goto error;
+    }
+    archive->game_index_fd = archive_open_file(game_index_path, &index_header, sizeof(index_header));
+    if (archive->game_index_fd < 0) {
+        goto error;
+    }
+    archive->position_index_fd = archive_open_file(position_index_path, &index_header, sizeof(index_header));
+    if (archive->position_index_fd < 0) {
+        goto error;
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&archive->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutex_init(&archive->mutex, NULL);
+
+    int err = pthread_create(&archive->writer, NULL, archive_writer_main, archive);
+    if (err != 0) {
+        printf("Could not start archive writer: %s\n", strerror(err));
+        pthread_cond_destroy(&archive->cond);
+        pthread_mutex_destroy(&archive->mutex);
+        goto error;
+    }
+
+    free(game_index_path);
+    free(position_index_path);
+    return archive;
+
+    error:
+    free(game_index_path);
+    free(position_index_path);
+    if (archive->fd >= 0) {
+        close(archive->fd);
+    }
+    if (archive->game_index_fd >= 0) {
+        close(archive->game_index_fd);
+    }
+    if (archive->position_index_fd >= 0) {
+        close(archive->position_index_fd);
+    }
+    free(archive);
+    return NULL;
+}
+
+void archive_close(struct Archive *archive) {
+    pthread_mutex_lock(&archive->mutex);
+    archive->closing = true;
+    pthread_cond_signal(&archive->cond);
+    pthread_mutex_unlock(&archive->mutex);
+    pthread_join(archive->writer, NULL);
+
+    pthread_cond_destroy(&archive->cond);
+    pthread_mutex_destroy(&archive->mutex);
+    close(archive->fd);
+    close(archive->game_index_fd);
+    close(archive->position_index_fd);
+    free(archive);
+}
+
+void archive_game_start(struct Archive *archive, const char *game_id, int player_nr) {
+    struct ArchiveRecordHeader *header = &archive->game.header;
+    if (archive->game_started && strncmp(header->game_id, game_id, ARCHIVE_GAME_ID_LENGTH) == 0) {
+        return;
+    }
+
+    memset(header, 0, sizeof(struct ArchiveRecordHeader));
+    strncpy(header->game_id, game_id, ARCHIVE_GAME_ID_LENGTH - 1);
+    header->start_time = time(NULL);
+    header->player_nr = player_nr;
+    archive->game_started = true;
+}
+
+void archive_game_add_player(struct Archive *archive, int player_nr, const char *name) {
+    struct ArchiveGame *game = &archive->game;
+    for (int i = 0; i < game->header.names_length; i += strlen(game->names + i) + 1) {
+        if (atoi(game->names + i) == player_nr) {
+            return;
+        }
+    }
+
+    int space = ARCHIVE_NAMES_LENGTH - game->header.names_length;
+    int length = snprintf(game->names + game->header.names_length, space, "%d %s", player_nr, name);
+    if (length >= 0 && length < space) {
+        game->header.names_length += length + 1;
+    }
+}
+
+// Pack field into occupied and pieces (lowest square first).
+static void archive_pack_position(const int *field, int width, int height, uint64_t *occupied, uint8_t *pieces) {
+    *occupied = 0;
+    int count = 0;
+    for (int square = 0; square < width * height; square++) {
+        if (field[square] >= 0) {
+            *occupied |= 1ULL << square;
+            pieces[count++] = field[square];
+        }
+    }
+}
+
+void archive_game_add_move(struct Archive *archive, const int *field, int width, int height, int hand_piece,
+                           int square, int next_piece, uint64_t think_us, int timeout_ms, int score, int depth,
+                           long nodes) {
+    struct ArchiveGame *game = &archive->game;
+    if (!archive->game_started || width * height > BOARD_MAX_SQUARES) {
+        return;
+    }
+    game->header.field_width = width;
+    game->header.field_height = height;
+
+    uint64_t occupied;
+    uint8_t pieces[BOARD_MAX_SQUARES];
+    archive_pack_position(field, width, height, &occupied, pieces);
+
+    int index = game->header.move_count;
+    if (index > 0 && game->moves[index - 1].occupied == occupied && game->moves[index - 1].hand_piece == hand_piece
+        && memcmp(game->pieces[index - 1], pieces, __builtin_popcountll(occupied)) == 0) {
+        index--;
+    } else if (index == BOARD_MAX_SQUARES) {
+        return;
+    }
+
+    struct ArchiveMove *move = &game->moves[index];
+    struct Board board;
+    int symmetry;
+    move->key = board_from_field(&board, field, width, height, hand_piece) == 0 ? board_canonical_key(&board, hand_piece, &symmetry) : 0;
+    move->occupied = occupied;
+    move->nodes = nodes;
+    move->think_us = think_us > UINT32_MAX ? UINT32_MAX : think_us;
+    move->timeout_ms = timeout_ms;
+    move->score = score;
+    move->depth = depth;
+    move->hand_piece = hand_piece;
+    move->next_piece = next_piece;
+    move->square = square;
+    move->reserved = 0;
+    memcpy(game->pieces[index], pieces, sizeof(pieces));
+    game->header.move_count = index + 1;
+}
+
+int archive_game_finish(struct Archive *archive, const int *field, int width, int height, int result) {
+    struct ArchiveGame *game = &archive->game;
+    if (!archive->game_started || width * height > BOARD_MAX_SQUARES) {
+        return -1;
+    }
+    archive->game_started = false;
+    game->header.field_width = width;
+    game->header.field_height = height;
+    game->header.result = result;
+    archive_pack_position(field, width, height, &game->header.final_occupied, game->final_pieces);
+
+    struct ArchivePending *pending = malloc(sizeof(struct ArchivePending) + ARCHIVE_MAX_RECORD_SIZE);
+    if (pending == NULL) {
+        perror("archive record malloc failed");
+        return -1;
+    }
+    pending->next = NULL;
+    memcpy(pending->game_id, game->header.game_id, ARCHIVE_GAME_ID_LENGTH);
+    pending->key_count = game->header.move_count;
+    for (int i = 0; i < pending->key_count; i++) {
+        pending->keys[i] = game->moves[i].key;
+    }
+    pending->length = archive_encode(game, pending->data);
+
+    pthread_mutex_lock(&archive->mutex);
+    *archive->pending_tail = pending;
+    archive->pending_tail = &pending->next;
+    archive->pending_count++;
+    pthread_cond_signal(&archive->cond);
+    pthread_mutex_unlock(&archive->mutex);
+
+    return 0;
+}
+
+size_t archive_encode(const struct ArchiveGame *game, unsigned char *data) {
+    struct ArchiveRecordHeader header = game->header;
+    size_t length = sizeof(header);
+
+    memcpy(data + length, game->names, header.names_length);
+    length += header.names_length;
+
+    for (int i = 0; i < header.move_count; i++) {
+        memcpy(data + length, &game->moves[i], sizeof(struct ArchiveMove));
+        length += sizeof(struct ArchiveMove);
+        int count = __builtin_popcountll(game->moves[i].occupied);
+        memcpy(data + length, game->pieces[i], count);
+        length += count;
+    }
+
+    int final_count = __builtin_popcountll(header.final_occupied);
+    memcpy(data + length, game->final_pieces, final_count);
+    length += final_count;
+
+    header.magic = ARCHIVE_RECORD_MAGIC;
+    header.length = length;
+    memcpy(data, &header, sizeof(header));
+    return length;
+}
+
+size_t archive_decode(const unsigned char *data, size_t length, struct ArchiveGame *game) {
+    struct ArchiveRecordHeader *header = &game->header;
+    if (length < sizeof(struct ArchiveRecordHeader)) {
+        return 0;
+    }
+    memcpy(header, data, sizeof(struct ArchiveRecordHeader));
+    if (header->magic != ARCHIVE_RECORD_MAGIC || header->length > length || header->names_length > ARCHIVE_NAMES_LENGTH
+        || header->move_count > BOARD_MAX_SQUARES || header->field_width * header->field_height > BOARD_MAX_SQUARES) {
+        return 0;
+    }
+
+    size_t position = sizeof(struct ArchiveRecordHeader) + header->names_length;
+    if (position > header->length) {
+        return 0;
+    }
+    memcpy(game->names, data + sizeof(struct ArchiveRecordHeader), header->names_length);
+
+    for (int i = 0; i < header->move_count; i++) {
+        if (position + sizeof(struct ArchiveMove) > header->length) {
+            return 0;
+        }
+        memcpy(&game->moves[i], data + position, sizeof(struct ArchiveMove));
+        position += sizeof(struct ArchiveMove);
+        size_t count = __builtin_popcountll(game->moves[i].occupied);
+        if (position + count > header->length) {
+            return 0;
+        }
+        memcpy(game->pieces[i], data + position, count);
+        position += count;
+    }
+
+    size_t final_count = __builtin_popcountll(header->final_occupied);
+    if (position + final_count != header->length) {
+        return 0;
+    }
+    memcpy(game->final_pieces, data + position, final_count);
+
+    return header->length;
+}
+
+void archive_unpack_position(uint64_t occupied, const uint8_t *pieces, int width, int height, int *field) {
+    int count = 0;
+    for (int square = 0; square < width * height; square++) {
+        field[square] = (occupied >> square) & 1 ? pieces[count++] : -1;
+    }
+}
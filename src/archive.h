@@ -0,0 +1,169 @@
+#ifndef archive_h
+#define archive_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "board.h"
+
+// Game archive: every finished game is appended to the archive file as one record, and two sidecar indexes
+// (the archive path plus ARCHIVE_GAME_INDEX_SUFFIX and ARCHIVE_POSITION_INDEX_SUFFIX) map game IDs and
+// canonical position keys (see board_canonical_key(), as in the opening book) to the offset of the record.
+//
+// Archive file: ARCHIVE_MAGIC, then one record per game:
+//   struct ArchiveRecordHeader
+//   names_length bytes of player names: "<nr> <name>\0" per player, ours first
+//   move_count times struct ArchiveMove followed by one byte per occupied square of its position
+//   one byte per occupied square of the final position (final_occupied)
+// Positions are packed as occupancy mask plus the pieces of the occupied squares, lowest square first.
+// Only our moves are stored; the opponent's moves follow from the difference of consecutive positions.
+// Structs are in host byte order and unaligned within the file, so readers copy them out with memcpy.
+//
+// Index files: struct ArchiveIndexHeader, then entries. Writers only append; entries up to sorted_count are
+// sorted by key (quarto-archive -i sorts them all), so lookups binary search those and scan the rest.
+//
+// Records are appended by a writer thread that collects them for up to ARCHIVE_FLUSH_MS (or
+// ARCHIVE_BATCH_GAMES records), writes the batch under an exclusive flock() (several clients may share
+// an archive) and syncs all three files, so the connector never waits for the disk.
+#define ARCHIVE_MAGIC "QARCH1\n"
+#define ARCHIVE_INDEX_MAGIC "QAIDX1\n"
+#define ARCHIVE_RECORD_MAGIC 0x31524751 // "QGR1"
+#define ARCHIVE_GAME_INDEX_SUFFIX ".games"
+#define ARCHIVE_POSITION_INDEX_SUFFIX ".positions"
+#define ARCHIVE_GAME_ID_LENGTH 16 // the server's 13 characters, zero padded
+#define ARCHIVE_NAMES_LENGTH 512
+#define ARCHIVE_MAX_RECORD_SIZE (sizeof(struct ArchiveRecordHeader) + ARCHIVE_NAMES_LENGTH \
+                                 + BOARD_MAX_SQUARES * (sizeof(struct ArchiveMove) + BOARD_MAX_SQUARES) + BOARD_MAX_SQUARES)
+#define ARCHIVE_FLUSH_MS 1000
+#define ARCHIVE_BATCH_GAMES 64
+
+#define ARCHIVE_RESULT_LOST 0
+#define ARCHIVE_RESULT_WON 1
+#define ARCHIVE_RESULT_DRAW 2
+
+struct ArchiveRecordHeader {
+    uint32_t magic; // ARCHIVE_RECORD_MAGIC
+    uint32_t length; // of the whole record, header included
+    char game_id[ARCHIVE_GAME_ID_LENGTH];
+    int64_t start_time; // Unix time of the first handshake
+    uint64_t final_occupied;
+    uint8_t field_width;
+    uint8_t field_height;
+    uint8_t player_nr;
+    uint8_t result; // ARCHIVE_RESULT_*
+    uint16_t move_count;
+    uint16_t names_length;
+};
+
+// One of our moves, with the position it was made in
+struct ArchiveMove {
+    uint64_t key; // canonical key of the position with hand_piece
+    uint64_t occupied;
+    int64_t nodes;
+    uint32_t think_us; // from "+ MOVE" to sending PLAY
+    uint32_t timeout_ms;
+    int32_t score;
+    int16_t depth;
+    int16_t hand_piece; // BOARD_NO_PIECE if none
+    int16_t next_piece; // handed over, BOARD_NO_PIECE if none
+    uint8_t square; // y * width + x
+    uint8_t reserved;
+};
+
+struct ArchiveIndexHeader {
+    char magic[8];
+    uint64_t sorted_count;
+};
+
+struct ArchiveGameIndexEntry {
+    char game_id[ARCHIVE_GAME_ID_LENGTH];
+    uint64_t offset;
+};
+
+struct ArchivePositionIndexEntry {
+    uint64_t key;
+    uint64_t offset; // of the game record
+    uint32_t move; // index into its moves
+    uint32_t reserved;
+};
+
+// A game as recorded by the connector or decoded by archive_decode()
+struct ArchiveGame {
+    struct ArchiveRecordHeader header;
+    char names[ARCHIVE_NAMES_LENGTH];
+    struct ArchiveMove moves[BOARD_MAX_SQUARES];
+    uint8_t pieces[BOARD_MAX_SQUARES][BOARD_MAX_SQUARES]; // of the position of each move
+    uint8_t final_pieces[BOARD_MAX_SQUARES];
+};
+
+// Encoded record waiting for the writer thread
+struct ArchivePending {
+    struct ArchivePending *next;
+    char game_id[ARCHIVE_GAME_ID_LENGTH];
+    uint64_t keys[BOARD_MAX_SQUARES];
+    int key_count;
+    size_t length;
+    unsigned char data[];
+};
+
+struct Archive {
+    int fd;
+    int game_index_fd;
+    int position_index_fd;
+
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct ArchivePending *pending; // oldest first
+    struct ArchivePending **pending_tail;
+    int pending_count;
+    bool closing;
+
+    struct ArchiveGame game; // being recorded, see archive_game_start()
+    bool game_started;
+};
+
+// Open (or create) the archive at path and its indexes, and start the writer thread.
+// Must be closed with archive_close().
+//
+// Returns NULL on error.
+struct Archive *archive_open(const char *path);
+
+// Write all pending records, stop the writer thread and free archive.
+void archive_close(struct Archive *archive);
+
+// Start recording the game game_id as player player_nr. Does nothing if that game is already being recorded,
+// so a game resumed after a reconnect goes on in the same record.
+void archive_game_start(struct Archive *archive, const char *game_id, int player_nr);
+
+// Add a player to the current game (once per player number; ours should come first).
+void archive_game_add_player(struct Archive *archive, int player_nr, const char *name);
+
+// Add our move in the position field (-1 for empty squares) with hand_piece. A move in the same position
+// as the last one replaces it (the server asks again if the connection was lost before MOVEOK).
+void archive_game_add_move(struct Archive *archive, const int *field, int width, int height, int hand_piece,
+                           int square, int next_piece, uint64_t think_us, int timeout_ms, int score, int depth,
+                           long nodes);
+
+// Finish the current game with the final field and result (ARCHIVE_RESULT_*) and queue its record
+// for the writer thread.
+//
+// Returns 0 on success, -1 otherwise.
+int archive_game_finish(struct Archive *archive, const int *field, int width, int height, int result);
+
+// Encode game as record into data (at least ARCHIVE_MAX_RECORD_SIZE bytes).
+//
+// Returns the length of the record.
+size_t archive_encode(const struct ArchiveGame *game, unsigned char *data);
+
+// Decode the record at the start of data (length bytes available) into game.
+//
+// Returns the length of the record, 0 if it is malformed or truncated.
+size_t archive_decode(const unsigned char *data, size_t length, struct ArchiveGame *game);
+
+// Unpack a position into field (width * height entries, -1 for empty squares).
+void archive_unpack_position(uint64_t occupied, const uint8_t *pieces, int width, int height, int *field);
+
+#endif
@@ -0,0 +1,239 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "board.h"
+
+static uint64_t board_zobrist[BOARD_MAX_SQUARES][BOARD_MAX_PIECES];
+static uint64_t board_zobrist_hand[BOARD_MAX_PIECES];
+static pthread_once_t board_tables_once = PTHREAD_ONCE_INIT;
+
+// splitmix64, so the keys (and thereby book files) are the same on every run
+static uint64_t board_next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void board_init_tables() {
+    uint64_t state = 0x51a4c0de;
+    for (int s = 0; s < BOARD_MAX_SQUARES; s++) {
+        for (int p = 0; p < BOARD_MAX_PIECES; p++) {
+            board_zobrist[s][p] = board_next_random(&state);
+        }
+    }
+    for (int p = 0; p < BOARD_MAX_PIECES; p++) {
+        board_zobrist_hand[p] = board_next_random(&state);
+    }
+}
+
+int board_init(struct Board *board, int width, int height) {
+    if (width < 1 || width > BOARD_MAX_SIZE || height < 1 || height > BOARD_MAX_SIZE) {
+        return -1;
+    }
+    pthread_once(&board_tables_once, board_init_tables);
+
+    memset(board, 0, sizeof(struct Board));
+    board->width = width;
+    board->height = height;
+    board->squares = width * height;
+    board->attributes = board_attributes(width, height);
+    board->piece_count = 1 << board->attributes;
+    for (int s = 0; s < board->squares; s++) {
+        board->pieces[s] = BOARD_NO_PIECE;
+    }
+    for (int p = 0; p < board->piece_count; p++) {
+        board_return_piece(board, p);
+    }
+
+    for (int y = 0; y < height; y++) {
+        uint64_t row = 0;
+        for (int x = 0; x < width; x++) {
+            row |= 1ULL << (y * width + x);
+        }
+        board->lines[board->line_count++] = row;
+    }
+    for (int x = 0; x < width; x++) {
+        uint64_t column = 0;
+        for (int y = 0; y < height; y++) {
+            column |= 1ULL << (y * width + x);
+        }
+        board->lines[board->line_count++] = column;
+    }
+    if (width == height) {
+        uint64_t diagonal = 0;
+        uint64_t anti_diagonal = 0;
+        for (int i = 0; i < width; i++) {
+            diagonal |= 1ULL << (i * (width + 1));
+            anti_diagonal |= 1ULL << ((width - 1 - i) * width + i);
+        }
+        board->lines[board->line_count++] = diagonal;
+        board->lines[board->line_count++] = anti_diagonal;
+    }
+
+    for (int l = 0; l < board->line_count; l++) {
+        for (int s = 0; s < board->squares; s++) {
+            if ((board->lines[l] >> s) & 1) {
+                board->square_lines[s] |= 1u << l;
+            }
+        }
+    }
+    return 0;
+}
+
+int board_from_field(struct Board *board, const int *field, int width, int height, int hand_piece) {
+    if (board_init(board, width, height) != 0) {
+        return -1;
+    }
+
+    if (hand_piece != BOARD_NO_PIECE) {
+        if (hand_piece < 0 || hand_piece >= board->piece_count) {
+            return -1;
+        }
+        board_take_piece(board, hand_piece);
+    }
+
+    for (int s = 0; s < board->squares; s++) {
+        int piece = field[s];
+        if (piece == -1) {
+            continue;
+        }
+        if (piece < 0 || piece >= board->piece_count || !board_piece_left(board, piece)) {
+            return -1;
+        }
+        board_take_piece(board, piece);
+        board_place(board, s, piece);
+    }
+    return 0;
+}
+
+int board_parse_size(const char *text, int *width, int *height) {
+    char separator;
+    int count = sscanf(text, "%dx%d%c", width, height, &separator);
+    if (count == 1) {
+        *height = *width;
+    } else if (count != 2) {
+        return -1;
+    }
+    return *width >= 1 && *width <= BOARD_MAX_SIZE && *height >= 1 && *height <= BOARD_MAX_SIZE ? 0 : -1;
+}
+
+void board_place(struct Board *board, int square, int piece) {
+    uint64_t bit = 1ULL << square;
+    board->occupied |= bit;
+    for (int a = 0; a < board->attributes; a++) {
+        if ((piece >> a) & 1) {
+            board->planes[a] |= bit;
+        }
+    }
+    board->pieces[square] = piece;
+    board->key ^= board_zobrist[square][piece];
+}
+
+void board_remove(struct Board *board, int square) {
+    uint64_t bit = 1ULL << square;
+    board->key ^= board_zobrist[square][board->pieces[square]];
+    board->occupied &= ~bit;
+    for (int a = 0; a < board->attributes; a++) {
+        board->planes[a] &= ~bit;
+    }
+    board->pieces[square] = BOARD_NO_PIECE;
+}
+
+bool board_wins_with(const struct Board *board, int square, int piece) {
+    uint64_t bit = 1ULL << square;
+    uint64_t occupied = board->occupied | bit;
+
+    for (uint32_t lines = board->square_lines[square]; lines != 0; lines &= lines - 1) {
+        uint64_t line = board->lines[__builtin_ctz(lines)];
+        if ((occupied & line) != line) {
+            continue;
+        }
+        for (int a = 0; a < board->attributes; a++) {
+            uint64_t plane = board->planes[a] & line;
+            if ((piece >> a) & 1) {
+                plane |= bit;
+            }
+            if (plane == line || plane == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void board_threats(const struct Board *board, int *ones, int *zeros) {
+    *ones = 0;
+    *zeros = 0;
+    for (int l = 0; l < board->line_count; l++) {
+        uint64_t line = board->lines[l];
+        uint64_t occupied = board->occupied & line;
+        if (__builtin_popcountll(occupied) != __builtin_popcountll(line) - 1) {
+            continue;
+        }
+        for (int a = 0; a < board->attributes; a++) {
+            uint64_t plane = board->planes[a] & line;
+            if (plane == occupied) {
+                *ones |= 1 << a;
+            } else if (plane == 0) {
+                *zeros |= 1 << a;
+            }
+        }
+    }
+}
+
+uint64_t board_square_key(int square, int piece) {
+    return board_zobrist[square][piece];
+}
+
+uint64_t board_hand_key(int piece) {
+    return piece == BOARD_NO_PIECE ? 0 : board_zobrist_hand[piece];
+}
+
+int board_map_square(const struct Board *board, int symmetry, int square) {
+    int x = square % board->width;
+    int y = square / board->width;
+
+    // symmetries 4..7 mirror first, then all rotate by (symmetry % 4) quarter turns:
+    // a half turn for 2 and 3, then another quarter turn for odd ones (only defined on square boards)
+    if (symmetry >= 4) {
+        x = board->width - 1 - x;
+    }
+    if (symmetry % 4 >= 2) {
+        x = board->width - 1 - x;
+        y = board->height - 1 - y;
+    }
+    if (symmetry % 2 == 1) {
+        int rotated_x = board->height - 1 - y;
+        y = x;
+        x = rotated_x;
+    }
+    return y * board->width + x;
+}
+
+int board_unmap_square(const struct Board *board, int symmetry, int square) {
+    for (int s = 0; s < board->squares; s++) {
+        if (board_map_square(board, symmetry, s) == square) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+uint64_t board_canonical_key(const struct Board *board, int hand_piece, int *symmetry) {
+    uint64_t best = 0;
+    int step = board->width == board->height ? 1 : 2;
+    for (int t = 0; t < BOARD_SYMMETRIES; t += step) {
+        uint64_t key = board_hand_key(hand_piece);
+        for (uint64_t occupied = board->occupied; occupied != 0; occupied &= occupied - 1) {
+            int s = __builtin_ctzll(occupied);
+            key ^= board_zobrist[board_map_square(board, t, s)][board->pieces[s]];
+        }
+        if (t == 0 || key < best) {
+            best = key;
+            *symmetry = t;
+        }
+    }
+    return best;
+}
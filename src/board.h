@@ -0,0 +1,103 @@
+#ifndef board_h
+#define board_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bitboard representation of a Quarto position, used by the search and the opening book.
+// Square s = y * width + x is bit s of each 64-bit plane, so boards up to 8x8 (in any rectangular shape) fit.
+// Pieces have one attribute per square of the longer side, i.e. 16 pieces on 4x4, 32 on 5x5 and 64 on 6x6.
+#define BOARD_MAX_SIZE 8
+#define BOARD_MAX_SQUARES (BOARD_MAX_SIZE * BOARD_MAX_SIZE)
+#define BOARD_MAX_ATTRIBUTES 8
+#define BOARD_MAX_PIECES (1 << BOARD_MAX_ATTRIBUTES)
+#define BOARD_MAX_LINES (2 * BOARD_MAX_SIZE + 2)
+#define BOARD_SYMMETRIES 8
+#define BOARD_NO_PIECE -1
+
+struct Board {
+    int width;
+    int height;
+    int squares;
+    int attributes; // see board_attributes()
+    int piece_count; // 1 << attributes
+
+    uint64_t occupied;
+    uint64_t planes[BOARD_MAX_ATTRIBUTES]; // bit s set if the piece on square s has attribute bit a set
+    uint64_t pieces_left[BOARD_MAX_PIECES / 64]; // neither on the board nor in hand
+    int16_t pieces[BOARD_MAX_SQUARES]; // piece per square, BOARD_NO_PIECE if empty
+    uint64_t key; // Zobrist hash of the placed pieces
+
+    int line_count;
+    uint64_t lines[BOARD_MAX_LINES]; // rows, columns and (on square boards) both diagonals
+    uint32_t square_lines[BOARD_MAX_SQUARES]; // bit i set if lines[i] contains the square
+};
+
+static inline int board_attributes(int width, int height) {
+    return width > height ? width : height;
+}
+
+// Initialize an empty board with all pieces left.
+//
+// Returns 0 on success, -1 if width or height is not in 1..BOARD_MAX_SIZE.
+int board_init(struct Board *board, int width, int height);
+
+// Initialize board from a field array as stored in the shm board slot (-1 for empty squares).
+// hand_piece (the piece to place next, or BOARD_NO_PIECE) is not counted as left.
+//
+// Returns 0 on success, -1 if the size or a piece number is invalid or a piece occurs twice.
+int board_from_field(struct Board *board, const int *field, int width, int height, int hand_piece);
+
+// Parse a board size given as "N" (square) or "WxH", e.g. from a command line.
+//
+// Returns 0 on success, -1 if text is no size in 1..BOARD_MAX_SIZE.
+int board_parse_size(const char *text, int *width, int *height);
+
+void board_place(struct Board *board, int square, int piece);
+void board_remove(struct Board *board, int square);
+
+static inline bool board_piece_left(const struct Board *board, int piece) {
+    return (board->pieces_left[piece >> 6] >> (piece & 63)) & 1;
+}
+
+static inline void board_take_piece(struct Board *board, int piece) {
+    board->pieces_left[piece >> 6] &= ~(1ULL << (piece & 63));
+}
+
+static inline void board_return_piece(struct Board *board, int piece) {
+    board->pieces_left[piece >> 6] |= 1ULL << (piece & 63);
+}
+
+static inline uint64_t board_free_squares(const struct Board *board) {
+    uint64_t all = board->squares == 64 ? ~0ULL : (1ULL << board->squares) - 1;
+    return all & ~board->occupied;
+}
+
+// Whether placing piece on the (free) square completes a line whose pieces share an attribute.
+bool board_wins_with(const struct Board *board, int square, int piece);
+
+// Collect which attribute values would complete a line with a single free square.
+// Handing such a piece to the opponent lets them win right away, see board_piece_safe().
+void board_threats(const struct Board *board, int *ones, int *zeros);
+
+static inline bool board_piece_safe(const struct Board *board, int piece, int ones, int zeros) {
+    return (piece & ones) == 0 && (~piece & zeros & (board->piece_count - 1)) == 0;
+}
+
+// Zobrist key of having piece in hand, to be combined with board->key.
+uint64_t board_hand_key(int piece);
+
+// Zobrist key of piece on square, i.e. what board_place() adds to board->key.
+uint64_t board_square_key(int square, int piece);
+
+// Key of the position (board plus hand_piece) that is equal for all rotations and reflections of it
+// (on rectangular boards only those that keep the shape: reflections and the half turn).
+//
+// symmetry: Set to the symmetry that maps this board onto the canonical one
+uint64_t board_canonical_key(const struct Board *board, int hand_piece, int *symmetry);
+
+// Maps a square through symmetry (0..BOARD_SYMMETRIES-1, even ones only on rectangular boards) and back.
+int board_map_square(const struct Board *board, int symmetry, int square);
+int board_unmap_square(const struct Board *board, int symmetry, int square);
+
+#endif
@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "book.h"
+
+// below this range size, interpolation steps are no better than scanning
+#define BOOK_SCAN_RANGE 8
+
+struct Book *book_open(char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error opening book file");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading book file size");
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(struct BookHeader)) {
+        printf("Book file %s is too short\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping book file");
+        return NULL;
+    }
+
+    const struct BookHeader *header = map;
+    if (memcmp(header->magic, BOOK_MAGIC, sizeof(header->magic)) != 0
+        || header->entry_size != sizeof(struct BookEntry)
+        || header->entry_count > (st.st_size - sizeof(struct BookHeader)) / sizeof(struct BookEntry)) {
+        printf("Book file %s is no valid book\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    struct Book *book = malloc(sizeof(struct Book));
+    if (book == NULL) {
+        perror("book malloc failed");
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    book->map = map;
+    book->map_size = st.st_size;
+    book->field_width = header->field_width;
+    book->field_height = header->field_height;
+    book->entries = (const struct BookEntry *)(header + 1);
+    book->entry_count = header->entry_count;
+    return book;
+}
+
+void book_close(struct Book *book) {
+    munmap(book->map, book->map_size);
+    free(book);
+}
+
+const struct BookEntry *book_find(const struct Book *book, uint64_t key) {
+    if (book->entry_count == 0) {
+        return NULL;
+    }
+
+    const struct BookEntry *entries = book->entries;
+    uint64_t low = 0;
+    uint64_t high = book->entry_count - 1;
+
+    while (high - low > BOOK_SCAN_RANGE) {
+        uint64_t low_key = entries[low].key;
+        uint64_t high_key = entries[high].key;
+        if (key < low_key || key > high_key) {
+            return NULL;
+        }
+
+        // the span is counted in 128 bits, as high_key - low_key + 1 wraps to 0 for the full key range
+        unsigned __int128 span = (unsigned __int128)(high_key - low_key) + 1;
+        uint64_t guess = low + (uint64_t)((unsigned __int128)(key - low_key) * (high - low) / span);
+        if (entries[guess].key < key) {
+            low = guess + 1;
+        } else if (entries[guess].key > key) {
+            high = guess;
+        } else {
+            return &entries[guess];
+        }
+    }
+
+    for (uint64_t i = low; i <= high; i++) {
+        if (entries[i].key == key) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+int book_lookup(const struct Book *book, const struct Board *board, int hand_piece, struct SearchResult *result) {
+    if (book->field_width != board->width || book->field_height != board->height) {
+        return -1;
+    }
+
+    int symmetry;
+    uint64_t key = board_canonical_key(board, hand_piece, &symmetry);
+    const struct BookEntry *entry = book_find(book, key);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    // a key collision would give a move for another position, so check that it is legal here
+    int square = board_unmap_square(board, symmetry, entry->square);
+    if (square < 0 || ((board->occupied >> square) & 1)) {
+        return -1;
+    }
+    if (entry->piece != BOARD_NO_PIECE && (entry->piece >= board->piece_count || !board_piece_left(board, entry->piece))) {
+        return -1;
+    }
+
+    result->square = square;
+    result->piece = entry->piece;
+    result->score = entry->score;
+    result->depth = entry->depth;
+    result->nodes = 0;
+    return 0;
+}
+
+static int book_compare_entries(const void *a, const void *b) {
+    uint64_t key_a = ((const struct BookEntry *)a)->key;
+    uint64_t key_b = ((const struct BookEntry *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+int book_write(char *path, int field_width, int field_height, struct BookEntry *entries, uint64_t entry_count) {
+    qsort(entries, entry_count, sizeof(struct BookEntry), book_compare_entries);
+
+    uint64_t unique_count = 0;
+    for (uint64_t i = 0; i < entry_count; i++) {
+        if (unique_count == 0 || entries[unique_count - 1].key != entries[i].key) {
+            entries[unique_count++] = entries[i];
+        }
+    }
+
+    struct BookHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+    header.field_width = field_width;
+    header.field_height = field_height;
+    header.entry_size = sizeof(struct BookEntry);
+    header.entry_count = unique_count;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Error creating book file");
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(entries, sizeof(struct BookEntry), unique_count, file) != unique_count) {
+        perror("Error writing book file");
+        fclose(file);
+        return -1;
+    }
+    if (fclose(file) != 0) {
+        perror("Error writing book file");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef book_h
+#define book_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "search.h"
+
+// Opening book file: a header followed by entries sorted by key, so it can be memory-mapped
+// and searched in place. Keys are canonical position keys (see board_canonical_key()),
+// squares are stored in the orientation of the canonical board.
+#define BOOK_MAGIC "QBOOK2\n"
+
+struct BookHeader {
+    char magic[8];
+    uint16_t field_width;
+    uint16_t field_height;
+    uint32_t entry_size;
+    uint64_t entry_count;
+};
+
+struct BookEntry {
+    uint64_t key;
+    int16_t score;
+    uint8_t square;
+    uint8_t depth;
+    int16_t piece; // piece to hand over, BOARD_NO_PIECE if none
+    uint16_t reserved;
+};
+
+struct Book {
+    void *map;
+    size_t map_size;
+    int field_width;
+    int field_height;
+    const struct BookEntry *entries;
+    uint64_t entry_count;
+};
+
+// Map the book file at path. Must be closed with book_close().
+//
+// Returns NULL if the file can't be mapped or is no valid book.
+struct Book *book_open(char *path);
+
+void book_close(struct Book *book);
+
+// Find the entry with key (interpolation search, the keys are uniformly distributed hashes).
+//
+// Returns the entry or NULL if there is none.
+const struct BookEntry *book_find(const struct Book *book, uint64_t key);
+
+// Look up the position (board plus hand_piece) and fill result with the book move in the orientation of board.
+//
+// Returns 0 on a hit, -1 if the position is not in the book.
+int book_lookup(const struct Book *book, const struct Board *board, int hand_piece, struct SearchResult *result);
+
+// Sort entries by key, drop duplicate keys and write them as book file to path.
+//
+// Returns 0 on success, -1 otherwise.
+int book_write(char *path, int field_width, int field_height, struct BookEntry *entries, uint64_t entry_count);
+
+#endif
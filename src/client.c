@@ -1,6 +1,5 @@
 #define _GNU_SOURCE
 
-#include <poll.h>
 #include <regex.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,8 +7,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "alloc.h"
 #include "client.h"
+#include "log.h"
 #include "net.h"
+#include "placement.h"
+#include "quarto.h"
 #include "thinker.h"
 #include "shm.h"
 
@@ -54,8 +57,29 @@ static char *malloc_regex_match(char *text, regmatch_t match);
 // Returns 0 if reading field succeeded, -1 otherwise.
 static int client_expect_field(struct Client *client);
 
+// Reads the field for client_expect_field().
+//
+// Returns 0 on success, -1 otherwise.
+static int client_read_field(struct Client *client);
+
+// Runs the protocol on the current connection, see client_play().
+//
+// Returns 0 on success, -1 on failure.
+static int client_play_connection(struct Client *client, char *game_id, int desired_player_nr);
+
+// Called when the thinker hasn't delivered its final move by the deadline: keeps the best move it published
+// for the request (have_result) or computes a safe move from the board slot, and tells the thinker to stop.
+static void client_watchdog_move(struct Client *client, bool have_result, struct MoveResult *result);
 
-struct Client *client_create(struct Net *net, struct SharedMemory *shared_memory, int thinker_pipe_fd) {
+// Stops the thinker's search for the latest request.
+static void client_stop_thinker(struct Client *client);
+
+// Applies the engine settings if the reload thread has published new ones (see reload.h): move margin,
+// log level and placement of the connector.
+static void client_apply_settings(struct Client *client);
+
+
+struct Client *client_create(struct Net *net, struct SharedMemory *shared_memory) {
     struct Client *client = malloc(sizeof(struct Client));
     if (client == NULL) {
         perror("client malloc failed");
@@ -64,21 +88,53 @@ struct Client *client_create(struct Net *net, struct SharedMemory *shared_memory
 
     client->net = net;
     client->shared_memory = shared_memory;
-    client->thinker_pipe_fd = thinker_pipe_fd;
+    client->move_margin = CLIENT_MOVE_MARGIN_MS;
+    client->joined = false;
+    client->archive = NULL;
+    client->settings_generation = 0;
+    client->latency = latency_create("connector");
+    if (client->latency == NULL) {
+        free(client);
+        return NULL;
+    }
     return client;
 }
 
-int client_play(struct Client *client, char *game_id, int desired_player_nr) {
+void client_free(struct Client *client) {
+    free(client->latency);
+    free(client);
+}
+
+int client_play(struct Client *client, char *game_id, int player_nr) {
+    client->joined = false;
+    int previous_phase = alloc_phase_enter(ALLOC_HANDSHAKE);
+    int ret = client_play_connection(client, game_id, player_nr);
+    alloc_phase_leave(previous_phase);
+    if (ret == 0) {
+        return 0;
+    }
+    if (!client->net->disconnected) {
+        return -1;
+    }
+
+    // a search for a move we can't send anymore would only delay the answer to the next MOVE
+    client_stop_thinker(client);
+    return CLIENT_DISCONNECTED;
+}
+
+static int client_play_connection(struct Client *client, char *game_id, int desired_player_nr) {
     regmatch_t pmatch2[2];
     regmatch_t pmatch3[3];
     regmatch_t pmatch4[4];
 
+    latency_begin(client->latency);
+
     if (client_expect_message_regex(client, "^\\+ MNM Gameserver v([0-9.]+) accepting connections$", 2, pmatch2) != 0) {
         return -1;
     }
     regmatch_t version_match = pmatch2[1];
     if (client->net->message[version_match.rm_so] != '2' || client->net->message[version_match.rm_so+1] != '.') {
-        printf("Unsupported server version: %.*s\n", version_match.rm_eo - version_match.rm_so, client->net->message + version_match.rm_so);
+        log_error("Unsupported server version: %.*s", version_match.rm_eo - version_match.rm_so, client->net->message + version_match.rm_so);
         return -1;
     }
 
@@ -104,7 +160,7 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
         return -1;
     }
     char *game_name = malloc_regex_match(client->net->message, pmatch2[1]);
-    printf("Current Game-Name is: '%s'\n", game_name); // TODO: do something better with the game name than just printing it
+    log_info("Current Game-Name is: '%s'", game_name); // TODO: do something better with the game name than just printing it
     free(game_name);
     game_name = NULL;
 
@@ -134,7 +190,7 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
     free(player_nr_str);
     player_nr_str = NULL;
     char *player_name = malloc_regex_match(client->net->message, pmatch3[2]);
-    printf("Were playing with player #%d: '%s'\n", player_nr, player_name);
+    log_info("Were playing with player #%d: '%s'", player_nr, player_name);
     shm_set_player_name(client->shared_memory, player_name);
 
 
@@ -175,6 +231,13 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
         players[i].ready = other_player_ready;
     }
 
+    if (client->archive != NULL) {
+        archive_game_start(client->archive, game_id, player_nr);
+        for (int i = 0; i < player_count; i++) {
+            archive_game_add_player(client->archive, players[i].player_nr, players[i].player_name);
+        }
+    }
+
     int ret_shm_set_players = shm_set_players(client->shared_memory, players, player_count);
     for (int i = 0; i < player_count; i++) {
         free(players[i].player_name);
@@ -189,12 +252,20 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
     if (client_expect_message(client, "+ ENDPLAYERS") != 0) {
         return -1;
     }
+    latency_mark(client->latency, LATENCY_HANDSHAKE);
+    client->joined = true;
+    alloc_phase_enter(ALLOC_GAME); // client_play() restores the phase
 
 
     while(true) {
+        latency_dump_if_requested(client->latency);
+        client_apply_settings(client); // before waiting, so it doesn't delay the reply to the next message
+
         if (net_recvline(client->net) <= 0) {
             return -1;
         }
+        // boundary for "+ MOVE received": when recv() woke up with it, not after the wait for the server
+        latency_begin_at(client->latency, client->net->message_ns);
 
         if (strcmp(client->net->message, "+ WAIT") == 0) {
 
@@ -204,6 +275,8 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
             }
 
         } else if (client_check_message_regex(client, "^\\+ MOVE ([0-9]{1,6})$", 2, pmatch2) == 0) {
+            uint64_t move_start_ns = client->latency->last_ns;
+
             char *timeout_str = malloc_regex_match(client->net->message, pmatch2[1]);
             client->shared_memory->move_timeout = atoi(timeout_str);
             free(timeout_str);
@@ -220,73 +293,82 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
             if (client_expect_field(client) != 0) {
                 return -1;
             }
+            latency_mark(client->latency, LATENCY_PARSE_FIELD);
 
             char *thinking_message = "THINKING";
             if (net_sendline(client->net, thinking_message, strlen(thinking_message)) != 0) {
                 return -1;
             }
+            latency_mark(client->latency, LATENCY_SEND_THINKING);
 
             if (client_expect_message(client, "+ OKTHINK") != 0) {
                 return -1;
             }
+            latency_mark(client->latency, LATENCY_OKTHINK);
 
-            printf("Thinker PID: %d\n", client->shared_memory->thinker_pid);
-            printf("Connector PID: %d\n", client->shared_memory->connector_pid);
-
-            client->shared_memory->thinker_request = true;
-
-            if (kill(client->shared_memory->thinker_pid, SIGUSR1) != 0) {
-                perror("Failed sending signal to thinker");
-                return -1;
+            if (!atomic_load(&client->shared_memory->thinker_ready)) {
+                log_warn("Thinker is still warming up, the move may take longer");
             }
-
-            struct Move move;
-            int move_data_received = 0;
+            log_debug("Thinker PID: %d", client->shared_memory->thinker_pid);
+            log_debug("Connector PID: %d", client->shared_memory->connector_pid);
+
+            unsigned int response_seen = doorbell_peek(&client->shared_memory->thinker_response);
+            // the watchdog answers at the deadline even if the thinker is slow, crashed or missed the request;
+            // the server's clock started when it sent "+ MOVE", so ours does as well
+            int wait_ms = client->shared_memory->move_timeout - client->move_margin;
+            uint64_t deadline_ns = move_start_ns + (uint64_t)(wait_ms > 0 ? wait_ms : 0) * 1000000;
+            client->shared_memory->move_deadline_ns = deadline_ns;
+            client->shared_memory->request_time_ns = quarto_now_ns();
+            unsigned int request = doorbell_ring(&client->shared_memory->thinker_request);
+            latency_mark(client->latency, LATENCY_SIGNAL_THINKER);
+            struct MoveResult result;
+            bool have_result = false;
 
             while (true) {
-                struct pollfd pipe_has_data;
-                pipe_has_data.fd = client->thinker_pipe_fd;
-                pipe_has_data.events = POLLIN;
-
-                if (poll(&pipe_has_data, 1, 0) == 1) { // we use timeout of 0 to check if pipe has data right now
-                    char buf[sizeof(move)];
-                    int n = read(client->thinker_pipe_fd, buf, sizeof(move));
-                    if (n == -1) {
-                        perror("Failure during reading message from pipe");
-                        return -1;
-                    }
-                    if (n == 0) {
-                        printf("Failure during reading message from pipe: EOF\n");
-                        return -1;
-                    }
-
-                    if (move_data_received + n > (int)sizeof(move)) {
-                        printf("Failure during reading message from pipe: Too much data (move_data_received = %d, n = %d)\n", move_data_received, n);
-                        return -1;
+                // wake up at least every millisecond to check whether the server sent something meanwhile
+                int wait_ret = doorbell_wait(&client->shared_memory->thinker_response, response_seen, 1);
+                if (wait_ret == -1) {
+                    metrics_add(client->shared_memory->metrics.ipc_errors, 1);
+                    return -1;
+                }
+                latency_dump_if_requested(client->latency);
+                if (wait_ret == DOORBELL_RUNG) {
+                    response_seen = doorbell_peek(&client->shared_memory->thinker_response);
+                    struct MoveResult published;
+                    shm_get_result(client->shared_memory, &published);
+
+                    // results of earlier requests are stale, non-final results are only the best move so far
+                    if (published.request == request) {
+                        result = published;
+                        have_result = true;
+                        if (result.final) {
+                            break;
+                        }
                     }
+                    continue;
+                }
 
-                    memcpy((char *)&move + move_data_received, buf, n);
-                    move_data_received += n;
+                if (quarto_now_ns() >= deadline_ns) {
+                    client_watchdog_move(client, have_result, &result);
+                    break;
+                }
 
-                    if (move_data_received == sizeof(move)) {
-                        break;
-                    } else {
-                        printf("Received partial data from Thinker (%d/%ld bytes)\n", move_data_received, sizeof(move));
-                    }
-                } else if (net_has_data(client->net)) {
-                    printf("While waiting for Thinker, received data from server.\n");
+                if (net_has_data(client->net)) {
+                    log_error("While waiting for Thinker, received data from server.");
 
                     if (net_recvline(client->net) <= 0) {
                         return -1;
                     }
 
-                    printf("Unexpected server message: '%s'\n", client->net->message);
+                    log_error("Unexpected server message: '%s'", client->net->message);
                     return -1;
-                } else {
-                    usleep(100); // 100µs
                 }
             }
 
+            latency_mark(client->latency, LATENCY_THINK);
+            struct Move move = result.move;
+            log_info("Thinker result: depth %d, score %d, %ld nodes", result.depth, result.score, result.nodes);
+
             char *play_message = NULL;
             int asprintf_ret;
             if (move.next_block_nr < 0) {
@@ -304,10 +386,25 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
             }
             free(play_message);
             play_message = NULL;
+            latency_mark(client->latency, LATENCY_SEND_PLAY);
+            latency_record(client->latency, LATENCY_MOVE_TOTAL, client->latency->last_ns - move_start_ns);
+            metrics_record_move(&client->shared_memory->metrics, (client->latency->last_ns - move_start_ns) / 1000, client->shared_memory->move_timeout);
+
+            // the move is on its way, so recording it costs the server nothing
+            if (client->archive != NULL) {
+                int field[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+                int width;
+                int height;
+                shm_get_field(client->shared_memory, field, &width, &height);
+                archive_game_add_move(client->archive, field, width, height, client->shared_memory->move_block_nr,
+                                      move.y * width + move.x, move.next_block_nr, (client->latency->last_ns - move_start_ns) / 1000,
+                                      client->shared_memory->move_timeout, result.score, result.depth, result.nodes);
+            }
 
             if (client_expect_message(client, "+ MOVEOK") != 0) {
                 return -1;
             }
+            latency_mark(client->latency, LATENCY_MOVEOK);
         } else if (strcmp(client->net->message, "+ GAMEOVER") == 0) {
 
             if (client_expect_field(client) != 0) {
@@ -325,12 +422,28 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
             }
             char *player1_status = malloc_regex_match(client->net->message, pmatch2[1]);
 
+            metrics_add(client->shared_memory->metrics.games_played, 1);
+            int game_result;
             if (strcmp(player0_status, player1_status) == 0) {
-                printf("Game result: Tie!\n");
+                log_info("Game result: Tie!");
+                game_result = ARCHIVE_RESULT_DRAW;
             } else if ((player_nr == 0 && strcmp(player0_status, "Yes") == 0) || (player_nr == 1 && strcmp(player1_status, "Yes") == 0)) {
-                printf("Game result: Our AI has won!\n");
+                log_info("Game result: Our AI has won!");
+                metrics_add(client->shared_memory->metrics.games_won, 1);
+                game_result = ARCHIVE_RESULT_WON;
             } else {
-                printf("Game result: Our AI lost!\n");
+                log_info("Game result: Our AI lost!");
+                game_result = ARCHIVE_RESULT_LOST;
+            }
+
+            if (client->archive != NULL) {
+                int field[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+                int width;
+                int height;
+                shm_get_field(client->shared_memory, field, &width, &height);
+                if (archive_game_finish(client->archive, field, width, height, game_result) != 0) {
+                    log_warn("Could not archive the game");
+                }
             }
 
             free(player0_status);
@@ -342,19 +455,28 @@ int client_play(struct Client *client, char *game_id, int desired_player_nr) {
                 return -1;
             }
 
+            latency_dump(client->latency);
+
             return 0;
         } else {
-            printf("Unexpected server response during game loop: '%s'\n", client->net->message);
+            log_error("Unexpected server response during game loop: '%s'", client->net->message);
             return -1;
         }
     }
 }
 
 static int client_expect_field(struct Client *client) {
+    int previous_phase = alloc_phase_enter(ALLOC_PARSE_FIELD);
+    int ret = client_read_field(client);
+    alloc_phase_leave(previous_phase);
+    return ret;
+}
+
+static int client_read_field(struct Client *client) {
     regmatch_t pmatch2[2];
     regmatch_t pmatch3[3];
 
-    if (client_expect_message_regex(client, "^\\+ FIELD ([0-9]{1,2}),([0-9]{1,2})$", 3, pmatch3) != 0) {
+    if (client_expect_message_regex(client, "^\\+ FIELD ([0-9]{1,3}),([0-9]{1,3})$", 3, pmatch3) != 0) {
         return -1;
     }
 
@@ -367,18 +489,16 @@ static int client_expect_field(struct Client *client) {
     free(height_string);
     height_string = NULL;
 
-    if (width != height) {
-        printf("Only square fields are allowed, but width = %d, height = %d\n", width, height);
+    if (width < 1 || height < 1 || width > MAX_FIELD_SIZE || height > MAX_FIELD_SIZE) {
+        log_error("Field size %dx%d is not within 1x1 to %dx%d", width, height, MAX_FIELD_SIZE, MAX_FIELD_SIZE);
         return -1;
     }
 
-    int size = width;
+    int field[MAX_FIELD_SIZE*MAX_FIELD_SIZE];
 
-    int field[size*size];
-
-    for (int y = size -1; y >= 0; y--) {
+    for (int y = height -1; y >= 0; y--) {
         char *regex = NULL;
-        if (asprintf(&regex, "^\\+ %d ((([0-9]{1,3}|\\*) ?){%d})$", y+1, size) == -1) {
+        if (asprintf(&regex, "^\\+ %d ((([0-9]{1,3}|\\*) ?){%d})$", y+1, width) == -1) {
             perror("Failure during building field parsing regex");
             return -1;
         } else if (client_expect_message_regex(client, regex, 2, pmatch2) != 0) {
@@ -391,16 +511,16 @@ static int client_expect_field(struct Client *client) {
 
         char *delimiter = " ";
         char *block_str = strtok(&client->net->message[pmatch2[1].rm_so], delimiter);
-        for (int x = 0; x < size; x++) {
+        for (int x = 0; x < width; x++) {
             if (block_str == NULL) {
-                printf("Invalid format!\n");
+                log_error("Invalid format!");
                 return -1;
             }
 
             if (strcmp(block_str, "*") == 0) {
-                field[y*size+x] = -1;
+                field[y*width+x] = -1;
             } else {
-                field[y*size+x] = atoi(block_str);
+                field[y*width+x] = atoi(block_str);
             }
 
             block_str = strtok(NULL, delimiter);
@@ -411,18 +531,65 @@ static int client_expect_field(struct Client *client) {
         return -1;
     }
 
-    shm_set_field(client->shared_memory, field, size);
+    if (shm_set_field(client->shared_memory, field, width, height) != 0) {
+        metrics_add(client->shared_memory->metrics.ipc_errors, 1);
+        return -1;
+    }
 
     return 0;
 }
 
+static void client_watchdog_move(struct Client *client, bool have_result, struct MoveResult *result) {
+    struct SharedMemory *shared_memory = client->shared_memory;
+    client_stop_thinker(client);
+    metrics_add(shared_memory->metrics.watchdog_moves, 1);
+
+    if (have_result) {
+        log_warn("Thinker missed the deadline, sending its best move so far (depth %d)", result->depth);
+        return;
+    }
+
+    int field[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+    int width;
+    int height;
+    shm_get_field(shared_memory, field, &width, &height);
+    int previous_phase = alloc_phase_enter(ALLOC_SAFE_MOVE);
+    result->move = get_safe_move(field, width, height, shared_memory->move_block_nr);
+    alloc_phase_leave(previous_phase);
+    result->score = 0;
+    result->depth = 0;
+    result->nodes = 0;
+    log_warn("Thinker missed the deadline without any move, sending a safe move");
+}
+
+static void client_stop_thinker(struct Client *client) {
+    // the request first: a thinker that only now picks it up must see the stop as meant for it (see thinker_loop())
+    atomic_store(&client->shared_memory->thinker_stop_request, doorbell_peek(&client->shared_memory->thinker_request));
+    atomic_store(&client->shared_memory->thinker_stop, true);
+}
+
+static void client_apply_settings(struct Client *client) {
+    if (shm_settings_generation(client->shared_memory) == client->settings_generation) {
+        return;
+    }
+
+    struct EngineSettings settings;
+    shm_get_settings(client->shared_memory, &settings);
+    client->settings_generation = settings.generation;
+
+    client->move_margin = settings.move_margin;
+    log_set_level(settings.log_level);
+    placement_apply(&settings.connector_placement, "connector");
+    log_info("Connector applied settings %u (move_margin %d ms)", settings.generation, settings.move_margin);
+}
+
 static int client_expect_message(struct Client *client, char *message) {
     if (net_recvline(client->net) <= 0) {
         return -1;
     }
 
     if (strcmp(client->net->message, message) != 0) {
-        printf("Unexpected server response: '%s', expected: '%s'\n", client->net->message, message);
+        log_error("Unexpected server response: '%s', expected: '%s'", client->net->message, message);
         return -1;
     }
 
@@ -435,7 +602,7 @@ static int client_expect_message_regex(struct Client *client, char *regex, size_
     }
 
     if (client_check_message_regex(client, regex, nmatch, pmatch) == -2) {
-        printf("Unexpected server response: '%s', expected regex: '%s'\n", client->net->message, regex);
+        log_error("Unexpected server response: '%s', expected regex: '%s'", client->net->message, regex);
         return -1;
     }
 
@@ -444,16 +611,19 @@ static int client_expect_message_regex(struct Client *client, char *regex, size_
 
 static int client_check_message_regex(struct Client *client, char *regex, size_t nmatch, regmatch_t *pmatch) {
     regex_t preg;
+    int previous_phase = alloc_phase_enter(ALLOC_REGEX);
     int res = regcomp(&preg, regex, REG_EXTENDED);
     if (res != 0) {
         char errbuf[256];
         regerror(res, &preg, errbuf, 256);
-        printf("Error compiling regex '%s': %s\n", regex, errbuf);
+        alloc_phase_leave(previous_phase);
+        log_error("Error compiling regex '%s': %s", regex, errbuf);
         return -1;
     }
 
     int ret = regexec(&preg, client->net->message, nmatch, pmatch, 0);
     regfree(&preg);
+    alloc_phase_leave(previous_phase);
     if (ret == REG_NOMATCH) {
         return -2;
     }
@@ -462,9 +632,11 @@ static int client_check_message_regex(struct Client *client, char *regex, size_t
 }
 
 static char *malloc_regex_match(char *text, regmatch_t match) {
+    int previous_phase = alloc_phase_enter(ALLOC_REGEX_MATCH);
     int match_len = match.rm_eo - match.rm_so;
     char *match_text = malloc((match_len + 1) * sizeof(char));
     memcpy(match_text, text + match.rm_so, match_len);
     match_text[match_len] = '\0';
+    alloc_phase_leave(previous_phase);
     return match_text;
 }
@@ -1,30 +1,50 @@
 #ifndef client_h
 #define client_h
 
+#include "archive.h"
+#include "latency.h"
 #include "shm.h"
 #include "net.h"
 
+// Default safety margin before the move timeout: by then, the move is sent no matter whether the thinker is done.
+#define CLIENT_MOVE_MARGIN_MS 200
+// Returned by client_play() when the connection was lost (as opposed to protocol errors)
+#define CLIENT_DISCONNECTED -2
+// Default number of reconnects in a row after a lost connection; the delay starts at
+// CLIENT_RECONNECT_DELAY_MS and doubles with every failed attempt up to CLIENT_RECONNECT_MAX_DELAY_MS
+#define CLIENT_RECONNECT_ATTEMPTS 5
+#define CLIENT_RECONNECT_DELAY_MS 100
+#define CLIENT_RECONNECT_MAX_DELAY_MS 5000
+
 struct Client {
     struct Net *net;
     struct SharedMemory *shared_memory;
-    int thinker_pipe_fd;
+    struct Latency *latency;
+    int move_margin; // ms, see CLIENT_MOVE_MARGIN_MS
+    bool joined; // the handshake on the current connection is done
+    struct Archive *archive; // finished games are appended to it if non-null
+    unsigned int settings_generation; // of the engine settings in use, see shm_get_settings()
 };
 
 // Create a new client
 // 
 // net: Fully created and already connected Net struct (be sure to have net_connect() called!)
 // shared_memory: Shared memory
-// thinker_pipe_fd: File descriptor of reading pipe to get thinker results
 // 
-// Returns pointer to Client which must be freed after use
-struct Client *client_create(struct Net *net, struct SharedMemory *shared_memory, int thinker_pipe_fd);
+// Returns pointer to Client which must be freed with client_free() after use
+struct Client *client_create(struct Net *net, struct SharedMemory *shared_memory);
+
+// Free client (but not its net and shared memory).
+void client_free(struct Client *client);
 
 // Start playing, i.e. start with the procotol
 // 
 // game_id: 13-character, null-terminated string
 // player_nr: Desired player number; set it to -1 to choose automatically
 // 
-// Returns 0 on success, -1 on failure
+// Returns 0 on success, CLIENT_DISCONNECTED if the connection was lost (the thinker is told to stop its search,
+// so after net_reconnect() the game can be resumed by calling client_play() again with the player number
+// from the shared memory) and -1 on other failures
 int client_play(struct Client *client, char *game_id, int player_nr);
 
 #endif
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cluster.h"
+#include "log.h"
+#include "quarto.h"
+
+// Returns 0 once all size bytes are written, -1 on errors.
+static int cluster_write_full(int fd, const void *data, size_t size) {
+    const char *bytes = data;
+    while (size > 0) {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Returns 0 once all size bytes are read, -1 on errors or if the connection was closed.
+static int cluster_read_full(int fd, void *data, size_t size) {
+    char *bytes = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, bytes, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Create a socket for address, a Unix socket path (if it contains a '/') or "[host:]port", connected to it
+// or (if listening) bound to it and listening. Without host, a TCP worker listens on all interfaces.
+//
+// Returns the socket, or -1 on error.
+static int cluster_open(const char *address, bool listening) {
+    if (strchr(address, '/') != NULL) {
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(unix_address.sun_path)) {
+            log_error("Worker socket path too long: %s", address);
+            return -1;
+        }
+        strcpy(unix_address.sun_path, address);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            perror("worker socket creation failed");
+            return -1;
+        }
+        // a stale socket of an earlier run is replaced, anything else at the path is left alone (and bind() fails)
+        struct stat path_stat;
+        if (listening && lstat(address, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+            unlink(address);
+        }
+        int ret = listening ? bind(fd, (struct sockaddr *)&unix_address, sizeof(unix_address))
+                            : connect(fd, (struct sockaddr *)&unix_address, sizeof(unix_address));
+        if (ret != 0 || (listening && listen(fd, 4) != 0)) {
+            log_error("Worker socket %s: %s", address, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256] = "";
+    const char *port = strrchr(address, ':');
+    if (port == NULL) {
+        port = address;
+    } else {
+        if ((size_t)(port - address) >= sizeof(host)) {
+            log_error("Worker host name too long: %s", address);
+            return -1;
+        }
+        memcpy(host, address, port - address);
+        host[port - address] = '\0';
+        port++;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    struct addrinfo *infos;
+    int gai_ret = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &infos);
+    if (gai_ret != 0) {
+        log_error("Worker address %s: %s", address, gai_strerror(gai_ret));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *info = infos; info != NULL && fd < 0; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        int ret = listening ? bind(fd, info->ai_addr, info->ai_addrlen) : connect(fd, info->ai_addr, info->ai_addrlen);
+        if (ret != 0 || (listening && listen(fd, 4) != 0)) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // jobs and results are single small messages
+    }
+    if (fd < 0) {
+        log_error("Worker address %s: %s", address, strerror(errno));
+    }
+    freeaddrinfo(infos);
+    return fd;
+}
+
+struct Cluster *cluster_connect(const char *addresses) {
+    struct Cluster *cluster = calloc(1, sizeof(struct Cluster));
+    if (cluster == NULL) {
+        perror("cluster calloc failed");
+        return NULL;
+    }
+
+    char *list = strdup(addresses);
+    if (list == NULL) {
+        perror("strdup for worker addresses failed");
+        free(cluster);
+        return NULL;
+    }
+    char *state = NULL;
+    for (char *address = strtok_r(list, ", ", &state); address != NULL; address = strtok_r(NULL, ", ", &state)) {
+        if (cluster->count == CLUSTER_MAX_WORKERS) {
+            log_warn("More than %d workers, ignoring %s", CLUSTER_MAX_WORKERS, address);
+            continue;
+        }
+        int fd = cluster_open(address, false);
+        if (fd < 0) {
+            log_warn("Worker %s is not reachable, searching without it", address);
+            continue;
+        }
+        cluster->addresses[cluster->count] = strdup(address);
+        if (cluster->addresses[cluster->count] == NULL) {
+            perror("strdup for worker address failed");
+            close(fd);
+            continue;
+        }
+        cluster->sockets[cluster->count] = fd;
+        cluster->count++;
+        log_info("Connected to worker %s", address);
+    }
+    free(list);
+
+    if (cluster->count == 0) {
+        free(cluster);
+        return NULL;
+    }
+    return cluster;
+}
+
+void cluster_free(struct Cluster *cluster) {
+    for (int w = 0; w < cluster->count; w++) {
+        close(cluster->sockets[w]);
+        free(cluster->addresses[w]);
+    }
+    free(cluster);
+}
+
+// Close the connection to worker w; the last worker takes its place.
+static void cluster_drop(struct Cluster *cluster, int w, const char *reason) {
+    log_warn("Dropping worker %s: %s", cluster->addresses[w], reason);
+    close(cluster->sockets[w]);
+    free(cluster->addresses[w]);
+    cluster->count--;
+    cluster->sockets[w] = cluster->sockets[cluster->count];
+    cluster->addresses[w] = cluster->addresses[cluster->count];
+    cluster->squares[w] = cluster->squares[cluster->count];
+}
+
+int cluster_start(struct Cluster *cluster, const struct Board *board, int hand_piece, uint64_t deadline_ns,
+                  uint64_t *local_squares) {
+    cluster->job++;
+    struct ClusterJob job;
+    memset(&job, 0, sizeof(job));
+    job.magic = CLUSTER_MAGIC;
+    job.job = cluster->job;
+    uint64_t now_ns = quarto_now_ns();
+    uint64_t margin_ns = (uint64_t)CLUSTER_REPLY_MARGIN_MS * 1000000;
+    job.time_ms = deadline_ns > now_ns + margin_ns ? (deadline_ns - now_ns - margin_ns) / 1000000 : 0;
+    job.field_width = board->width;
+    job.field_height = board->height;
+    job.hand_piece = hand_piece;
+    for (int s = 0; s < BOARD_MAX_SQUARES; s++) {
+        job.field[s] = s < board->squares ? board->pieces[s] : BOARD_NO_PIECE;
+    }
+
+    // round robin, starting with the coordinator
+    *local_squares = 0;
+    for (int w = 0; w < cluster->count; w++) {
+        cluster->squares[w] = 0;
+    }
+    int party = 0;
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        uint64_t square = f & -f;
+        if (party == 0) {
+            *local_squares |= square;
+        } else {
+            cluster->squares[party - 1] |= square;
+        }
+        party = (party + 1) % (cluster->count + 1);
+    }
+
+    int sent = 0;
+    for (int w = cluster->count - 1; w >= 0; w--) {
+        if (cluster->squares[w] == 0) {
+            continue;
+        }
+        job.root_squares = cluster->squares[w];
+        if (cluster_write_full(cluster->sockets[w], &job, sizeof(job)) != 0) {
+            // its squares aren't searched this time
+            cluster_drop(cluster, w, strerror(errno));
+            continue;
+        }
+        sent++;
+    }
+    return sent;
+}
+
+int cluster_collect(struct Cluster *cluster, uint64_t deadline_ns, struct SearchResult *best) {
+    bool answered[CLUSTER_MAX_WORKERS] = {false};
+    bool failed[CLUSTER_MAX_WORKERS] = {false};
+    int received = 0;
+
+    while (true) {
+        struct pollfd fds[CLUSTER_MAX_WORKERS];
+        int workers[CLUSTER_MAX_WORKERS];
+        int pending = 0;
+        for (int w = 0; w < cluster->count; w++) {
+            if (cluster->squares[w] != 0 && !answered[w] && !failed[w]) {
+                fds[pending].fd = cluster->sockets[w];
+                fds[pending].events = POLLIN;
+                workers[pending] = w;
+                pending++;
+            }
+        }
+        if (pending == 0) {
+            break;
+        }
+
+        // answers that are already there count even if we come late ourselves
+        uint64_t now_ns = quarto_now_ns();
+        bool late = now_ns >= deadline_ns;
+        int poll_ret = poll(fds, pending, late ? 0 : (int)((deadline_ns - now_ns + 999999) / 1000000));
+        if (poll_ret < 0 && errno != EINTR) {
+            perror("Error waiting for workers");
+            break;
+        }
+        for (int i = 0; i < pending && poll_ret > 0; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            int w = workers[i];
+            struct ClusterResult result;
+            if (cluster_read_full(cluster->sockets[w], &result, sizeof(result)) != 0
+                || result.magic != CLUSTER_MAGIC || result.job != cluster->job) {
+                failed[w] = true;
+                continue;
+            }
+            answered[w] = true;
+            received++;
+            best->nodes += result.nodes;
+            if (result.square >= 0 && (best->square < 0 || result.score > best->score
+                                       || (result.score == best->score && result.depth > best->depth))) {
+                best->square = result.square;
+                best->piece = result.piece;
+                best->score = result.score;
+                best->depth = result.depth;
+            }
+        }
+        if (late) {
+            break;
+        }
+    }
+
+    for (int w = cluster->count - 1; w >= 0; w--) {
+        if (cluster->squares[w] != 0 && !answered[w]) {
+            bool was_failed = failed[w];
+            answered[w] = answered[cluster->count - 1];
+            failed[w] = failed[cluster->count - 1];
+            cluster_drop(cluster, w, was_failed ? "invalid answer or connection closed" : "no answer by the deadline");
+        }
+    }
+    for (int w = 0; w < cluster->count; w++) {
+        cluster->squares[w] = 0;
+    }
+    return received;
+}
+
+// Answer the jobs of one coordinator until it disconnects.
+static void cluster_worker_serve(struct Search *search, const struct Nnue *nnue, int fd) {
+    struct ClusterJob job;
+    while (cluster_read_full(fd, &job, sizeof(job)) == 0) {
+        uint64_t start_ns = quarto_now_ns();
+        if (job.magic != CLUSTER_MAGIC) {
+            log_error("Invalid job from coordinator");
+            return;
+        }
+
+        struct ClusterResult result;
+        memset(&result, 0, sizeof(result));
+        result.magic = CLUSTER_MAGIC;
+        result.job = job.job;
+        result.square = -1;
+        result.piece = BOARD_NO_PIECE;
+
+        int field[BOARD_MAX_SQUARES];
+        for (int s = 0; s < BOARD_MAX_SQUARES; s++) {
+            field[s] = job.field[s];
+        }
+        struct Board board;
+        if (board_from_field(&board, field, job.field_width, job.field_height, job.hand_piece) == 0) {
+            search->nnue = nnue != NULL && nnue->field_width == board.width && nnue->field_height == board.height
+                           ? nnue : NULL;
+            search->root_squares = job.root_squares;
+            search->deadline_ns = start_ns + (uint64_t)job.time_ms * 1000000;
+            atomic_store(&search->stop, false);
+
+            struct SearchResult search_result;
+            if (search_iterate(search, &board, job.hand_piece, 0, NULL, NULL, &search_result) > 0) {
+                result.square = search_result.square;
+                result.piece = search_result.piece;
+                result.score = search_result.score;
+                result.depth = search_result.depth;
+            }
+            result.nodes = search_result.nodes;
+            search->root_squares = 0;
+            log_debug("Job %u: depth %d, score %d, %ld nodes", job.job, result.depth, result.score, (long)result.nodes);
+        } else {
+            log_warn("Job %u has an invalid board", job.job);
+        }
+
+        if (cluster_write_full(fd, &result, sizeof(result)) != 0) {
+            return;
+        }
+    }
+}
+
+int cluster_worker_run(const char *address, const struct Nnue *nnue) {
+    struct Search *search = search_create(SEARCH_TT_BITS);
+    if (search == NULL) {
+        return -1;
+    }
+    int listen_fd = cluster_open(address, true);
+    if (listen_fd < 0) {
+        search_free(search);
+        return -1;
+    }
+    log_info("Worker listening on %s", address);
+
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Error accepting coordinator");
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        log_info("Coordinator connected");
+        cluster_worker_serve(search, nnue, fd);
+        close(fd);
+        search_clear(search); // the next coordinator plays another game
+        log_info("Coordinator disconnected");
+    }
+
+    close(listen_fd);
+    search_free(search);
+    return -1;
+}
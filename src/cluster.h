@@ -0,0 +1,81 @@
+#ifndef cluster_h
+#define cluster_h
+
+#include <stdint.h>
+
+#include "board.h"
+#include "nnue.h"
+#include "search.h"
+
+// Distributed search: the thinker (coordinator) splits the free squares of the root among itself and its workers,
+// which search only placements on their squares (see Search.root_squares) until shortly before the deadline
+// and send back their best move. Workers are the client binary started with --worker and listen on a Unix socket
+// (an address with a '/') or TCP ("[host:]port"). A worker that doesn't answer by the deadline is dropped.
+//
+// Messages are fixed-size structs in host byte order, so coordinator and workers must run the same build.
+#define CLUSTER_MAGIC 0x31574b51 // "QKW1"
+#define CLUSTER_MAX_WORKERS 16
+#define CLUSTER_REPLY_MARGIN_MS 20 // workers stop this long before the coordinator's deadline, for the way back
+
+// coordinator -> worker
+struct ClusterJob {
+    uint32_t magic;
+    uint32_t job; // echoed in the result
+    uint32_t time_ms; // search time, counted from receiving the job
+    uint8_t field_width;
+    uint8_t field_height;
+    int16_t hand_piece;
+    uint64_t root_squares; // the worker's share of the root
+    int16_t field[BOARD_MAX_SQUARES]; // -1 for empty squares
+};
+
+// worker -> coordinator
+struct ClusterResult {
+    uint32_t magic;
+    uint32_t job;
+    int16_t square; // -1 if not even the first iteration completed
+    int16_t piece;
+    int32_t score;
+    int32_t depth;
+    int32_t reserved;
+    int64_t nodes;
+};
+
+struct Cluster {
+    int sockets[CLUSTER_MAX_WORKERS];
+    char *addresses[CLUSTER_MAX_WORKERS];
+    uint64_t squares[CLUSTER_MAX_WORKERS]; // share of the current job, 0 if none was sent
+    int count;
+    uint32_t job;
+};
+
+// Connect to the workers in addresses (separated by commas). Workers that can't be reached are skipped.
+// Must be freed with cluster_free().
+//
+// Returns NULL on error or if no worker could be reached.
+struct Cluster *cluster_connect(const char *addresses);
+
+void cluster_free(struct Cluster *cluster);
+
+// Split the free squares of board among the coordinator and the workers and send every worker its share,
+// to be searched until CLUSTER_REPLY_MARGIN_MS before deadline_ns (CLOCK_MONOTONIC). The coordinator's share,
+// never empty, is written into local_squares. Workers that can't be sent their job are dropped.
+//
+// Returns the number of jobs sent.
+int cluster_start(struct Cluster *cluster, const struct Board *board, int hand_piece, uint64_t deadline_ns,
+                  uint64_t *local_squares);
+
+// Wait until every worker of the current job has answered or deadline_ns has passed, and replace best with any
+// better result (by score, then depth). Workers that didn't answer in time are dropped.
+// The nodes of all workers are added to best->nodes.
+//
+// Returns the number of results received.
+int cluster_collect(struct Cluster *cluster, uint64_t deadline_ns, struct SearchResult *best);
+
+// Serve jobs of one coordinator after the other on address, evaluating positions of its field size
+// with nnue (may be NULL). Only returns on errors.
+//
+// Returns -1.
+int cluster_worker_run(const char *address, const struct Nnue *nnue);
+
+#endif
@@ -1,22 +1,45 @@
+#define _GNU_SOURCE //for cpu_set_t (must be at beginning of file)
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "client.h"
 #include "config.h"
+#include "log.h"
+#include "search.h"
 #include "strings.h"
 
+// Parses the null-terminated config file content into config, see read_config().
+//
+// Returns 0 on success and error code otherwise.
+static int config_parse(char *content, struct Config *config);
+
 struct Config *create_config() {
     struct Config *config = malloc(sizeof(struct Config));
     if (config == NULL) {
-        perror("config malloc failed");
+        log_error("config malloc failed: %s", strerror(errno));
         return NULL;
     }
 
     config->host_name = NULL;
     config->port_number = 0;
     config->game_type = NULL;
+    config->thinker_thread = false;
+    placement_init(&config->connector_placement);
+    placement_init(&config->thinker_placement);
+    config->log_level = LOG_LEVEL_INFO;
+    config->trace_file = NULL;
+    config->metrics_socket = NULL;
+    config->book_file = NULL;
+    config->nnue_file = NULL;
+    config->archive_file = NULL;
+    config->workers = NULL;
+    config->mcts = false;
+    config->hash_bits = SEARCH_TT_BITS;
+    config->move_margin = CLIENT_MOVE_MARGIN_MS;
+    config->reconnect_attempts = CLIENT_RECONNECT_ATTEMPTS;
 
     return config;
 }
@@ -27,7 +50,7 @@ int read_config(char *config_file_name, struct Config *config) {
 
     if (file == NULL) { //fopen gibt 0 zurück falls file nicht existiert
         int err = errno;
-        perror("could not open config file");
+        log_error("could not open config file: %s", strerror(errno));
 
         if (err == ENOENT) {
             return CONFIG_FILE_NOT_EXISTS;
@@ -36,12 +59,31 @@ int read_config(char *config_file_name, struct Config *config) {
         return CONFIG_FILE_NOT_READABLE;
     }
 
-    char content[MAX_CONFIG_FILE_SIZE+1]; // we save one extra byte for the terminating null byte
+    size_t capacity = CONFIG_READ_CHUNK;
+    char *content = malloc(capacity);
+    if (content == NULL) {
+        log_error("config content malloc failed: %s", strerror(errno));
+        fclose(file);
+        return CONFIG_FILE_ERROR;
+    }
     long unsigned int i = 0;
     long unsigned int line_breaks = 0;
 
-    //Liest komplettes file
-    while (i < sizeof(content) && (content[i] = fgetc(file)) != EOF) {
+    //Liest komplettes file, der Puffer wächst mit
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (i + 1 == capacity) { // one byte stays free for the terminating null byte
+            char *larger = realloc(content, capacity * 2);
+            if (larger == NULL) {
+                log_error("config content realloc failed: %s", strerror(errno));
+                free(content);
+                fclose(file);
+                return CONFIG_FILE_ERROR;
+            }
+            content = larger;
+            capacity *= 2;
+        }
+        content[i] = c;
         //zählt alle Zeilen also \n im file
         if (content[i] == '\n') {
             line_breaks++;
@@ -50,19 +92,20 @@ int read_config(char *config_file_name, struct Config *config) {
     }
 
     fclose(file);
-
-    if (content[i] != EOF) {
-        printf("Config file is too large! (more than %d bytes)\n", MAX_CONFIG_FILE_SIZE);
-        return CONFIG_FILE_TOO_LARGE;
-    }
-    
     content[i] = '\0';
 
     if (i == 0 || (i == line_breaks)) {
-        printf("Config file is empty.\n");
+        log_error("Config file is empty.");
+        free(content);
         return CONFIG_FILE_EMPTY;
     }
 
+    int ret = config_parse(content, config);
+    free(content);
+    return ret;
+}
+
+static int config_parse(char *content, struct Config *config) {
     bool host_found = false;
     bool port_found = false;
     bool game_found = false;
@@ -74,26 +117,135 @@ int read_config(char *config_file_name, struct Config *config) {
     //an richtigen stelle im struct gespeichert wird
     //-> Zeilen könne in der configfile untereinander beliebig vertauscht werden
     while (line != NULL) {
-        char *key = strtok(line, " =");
-        char *value = strtok(NULL, " =");
+        // strtok_r, as the config is also read by the reload thread while the connector parses messages
+        char *line_save_ptr;
+        char *key = strtok_r(line, " =", &line_save_ptr);
+        char *value = strtok_r(NULL, " =", &line_save_ptr);
         if (key == NULL || value == NULL) {
-            printf("Could not parse config line: '%s'\n", line);
+            log_error("Could not parse config line: '%s'", line);
         } else {
             if (strcasecmp(key, "host") == 0) {
                 host_found = true;
                 config->host_name = strdup(value);
                 if (config->host_name == NULL) {
-                    perror("strdup for host_name failed");
+                    log_error("strdup for host_name failed: %s", strerror(errno));
                     return CONFIG_FILE_ERROR;
                 }
             } else if (strcasecmp(key, "port") == 0) {
                 port_found = true;
                 config->port_number = atoi(value);
+            } else if (strcasecmp(key, "thinker") == 0) {
+                if (strcasecmp(value, "thread") == 0) {
+                    config->thinker_thread = true;
+                } else if (strcasecmp(value, "process") == 0) {
+                    config->thinker_thread = false;
+                } else {
+                    log_error("Unknown thinker mode '%s', expected 'process' or 'thread'.", value);
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "connector_cpus") == 0 || strcasecmp(key, "thinker_cpus") == 0) {
+                struct Placement *placement = strcasecmp(key, "connector_cpus") == 0 ? &config->connector_placement : &config->thinker_placement;
+                if (placement_parse_cpus(value, &placement->cpus) != 0) {
+                    log_error("Invalid CPU list '%s' for %s, expected e.g. '0,2-3'.", value, key);
+                    return CONFIG_FILE_ERROR;
+                }
+                placement->pin_cpus = true;
+            } else if (strcasecmp(key, "sched_policy") == 0) {
+                int policy;
+                if (placement_parse_policy(value, &policy) != 0) {
+                    log_error("Unknown scheduling policy '%s', expected 'other', 'fifo' or 'rr'.", value);
+                    return CONFIG_FILE_ERROR;
+                }
+                config->connector_placement.policy = policy;
+                config->thinker_placement.policy = policy;
+            } else if (strcasecmp(key, "sched_priority") == 0) {
+                config->connector_placement.priority = atoi(value);
+                config->thinker_placement.priority = atoi(value);
+            } else if (strcasecmp(key, "nice") == 0) {
+                config->connector_placement.nice = atoi(value);
+                config->thinker_placement.nice = atoi(value);
+            } else if (strcasecmp(key, "numa_local") == 0) {
+                config->thinker_placement.numa_local = strcasecmp(value, "yes") == 0 || strcmp(value, "1") == 0;
+            } else if (strcasecmp(key, "log_level") == 0) {
+                config->log_level = log_parse_level(value);
+                if (config->log_level < 0) {
+                    log_error("Unknown log level '%s', expected 'debug', 'info', 'warn' or 'error'.", value);
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "trace_file") == 0) {
+                free(config->trace_file);
+                config->trace_file = strdup(value);
+                if (config->trace_file == NULL) {
+                    log_error("strdup for trace_file failed: %s", strerror(errno));
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "metrics_socket") == 0) {
+                free(config->metrics_socket);
+                config->metrics_socket = strdup(value);
+                if (config->metrics_socket == NULL) {
+                    log_error("strdup for metrics_socket failed: %s", strerror(errno));
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "book_file") == 0) {
+                free(config->book_file);
+                config->book_file = strdup(value);
+                if (config->book_file == NULL) {
+                    log_error("strdup for book_file failed: %s", strerror(errno));
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "nnue_file") == 0) {
+                free(config->nnue_file);
+                config->nnue_file = strdup(value);
+                if (config->nnue_file == NULL) {
+                    log_error("strdup for nnue_file failed: %s", strerror(errno));
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "archive_file") == 0) {
+                free(config->archive_file);
+                config->archive_file = strdup(value);
+                if (config->archive_file == NULL) {
+                    log_error("strdup for archive_file failed: %s", strerror(errno));
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "workers") == 0) {
+                free(config->workers);
+                config->workers = strdup(value);
+                if (config->workers == NULL) {
+                    log_error("strdup for workers failed: %s", strerror(errno));
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "strategy") == 0) {
+                if (strcasecmp(value, "mcts") == 0) {
+                    config->mcts = true;
+                } else if (strcasecmp(value, "alphabeta") == 0) {
+                    config->mcts = false;
+                } else {
+                    log_error("Unknown strategy '%s', expected 'alphabeta' or 'mcts'.", value);
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "hash_bits") == 0) {
+                config->hash_bits = atoi(value);
+                if (config->hash_bits < CONFIG_MIN_HASH_BITS || config->hash_bits > CONFIG_MAX_HASH_BITS) {
+                    log_error("Invalid hash_bits '%s', expected %d to %d.", value, CONFIG_MIN_HASH_BITS, CONFIG_MAX_HASH_BITS);
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "move_margin") == 0) {
+                config->move_margin = atoi(value);
+                if (config->move_margin < 0) {
+                    log_error("Invalid move_margin '%s', expected milliseconds.", value);
+                    return CONFIG_FILE_ERROR;
+                }
+            } else if (strcasecmp(key, "reconnect_attempts") == 0) {
+                config->reconnect_attempts = atoi(value);
+                if (config->reconnect_attempts < 0) {
+                    log_error("Invalid reconnect_attempts '%s', expected a number.", value);
+                    return CONFIG_FILE_ERROR;
+                }
             } else if (strcasecmp(key, "game") == 0) {
                 game_found = true;
                 config->game_type = strdup(value);
                 if (config->game_type == NULL) {
-                    perror("strdup for game_type failed");
+                    log_error("strdup for game_type failed: %s", strerror(errno));
                     return CONFIG_FILE_ERROR;
                 }
             }
@@ -103,11 +255,11 @@ int read_config(char *config_file_name, struct Config *config) {
     }
 
     if (!host_found || !port_found || !game_found) {
-        printf("Missing specification of either host, port or game. Check your config file.\n");
+        log_error("Missing specification of either host, port or game. Check your config file.");
         return CONFIG_FILE_INCOMPLETE;
     }
 
-    printf("Config: host = %s, port = %i, game = %s\n", config->host_name, config->port_number, config->game_type);
+    log_info("Config: host = %s, port = %i, game = %s, thinker = %s", config->host_name, config->port_number, config->game_type, config->thinker_thread ? "thread" : "process");
 
     return 0;
 
@@ -118,15 +270,16 @@ int read_default_config(struct Config *config) {
 
     config->host_name = strdup(HOSTNAME);
     if (config->host_name == NULL) {
-        perror("strdup for game_type failed");
+        log_error("strdup for game_type failed: %s", strerror(errno));
         return -1;
     }
 
     config->port_number = PORTNUMBER;
+    config->thinker_thread = false;
 
     config->game_type = strdup(GAMEKINDNAME);
     if (config->game_type == NULL) {
-        perror("strdup for game_type failed");
+        log_error("strdup for game_type failed: %s", strerror(errno));
         return -1;
     }
 
@@ -137,12 +290,12 @@ int save_config(char *config_file_name, struct Config *config) {
     FILE *file;
     file = fopen(config_file_name, "w"); //w -> zum schreiben geöffnet und erzeugt wenn nötig
     if (file == NULL) {
-        perror("Error opening config file");
+        log_error("Error opening config file: %s", strerror(errno));
         return -1;
     }
 
-    if (fprintf(file, "host = %s\nport = %d\ngame = %s\n", config->host_name, config->port_number, config->game_type) < 0) {
-        printf("Error writing to config file (fprintf)\n");
+    if (fprintf(file, "host = %s\nport = %d\ngame = %s\nthinker = %s\n", config->host_name, config->port_number, config->game_type, config->thinker_thread ? "thread" : "process") < 0) {
+        log_error("Error writing to config file (fprintf)");
         fclose(file);
         return -1;
     }
@@ -151,6 +304,15 @@ int save_config(char *config_file_name, struct Config *config) {
     return 0;
 }
 
+void config_engine_settings(struct Config *config, struct EngineSettings *settings) {
+    settings->log_level = config->log_level;
+    settings->hash_bits = config->hash_bits;
+    settings->mcts = config->mcts;
+    settings->move_margin = config->move_margin;
+    settings->connector_placement = config->connector_placement;
+    settings->thinker_placement = config->thinker_placement;
+}
+
 void free_config(struct Config *config) {
     if (config->host_name != NULL) {
         free(config->host_name);
@@ -160,5 +322,29 @@ void free_config(struct Config *config) {
         free(config->game_type);
         config->game_type = NULL;
     }
+    if (config->trace_file != NULL) {
+        free(config->trace_file);
+        config->trace_file = NULL;
+    }
+    if (config->metrics_socket != NULL) {
+        free(config->metrics_socket);
+        config->metrics_socket = NULL;
+    }
+    if (config->book_file != NULL) {
+        free(config->book_file);
+        config->book_file = NULL;
+    }
+    if (config->nnue_file != NULL) {
+        free(config->nnue_file);
+        config->nnue_file = NULL;
+    }
+    if (config->archive_file != NULL) {
+        free(config->archive_file);
+        config->archive_file = NULL;
+    }
+    if (config->workers != NULL) {
+        free(config->workers);
+        config->workers = NULL;
+    }
     free(config);
 }
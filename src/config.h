@@ -3,6 +3,11 @@
 
 #define _GNU_SOURCE //for func: strcasestr (must be at beginning of file)
 
+#include <stdbool.h>
+
+#include "placement.h"
+#include "shm.h"
+
 
 #define GAMEKINDNAME "Quarto"
 #define PORTNUMBER 1357
@@ -11,17 +16,37 @@
 #define CONFIG_FILE_NOT_EXISTS -1
 #define CONFIG_FILE_NOT_READABLE -2
 #define CONFIG_FILE_EMPTY -3
-#define CONFIG_FILE_TOO_LARGE -4
 #define CONFIG_FILE_INCOMPLETE -5
 #define CONFIG_FILE_ERROR -6
 
-#define MAX_CONFIG_FILE_SIZE 1024
+#define CONFIG_MIN_HASH_BITS 10
+#define CONFIG_MAX_HASH_BITS 30
+#define CONFIG_READ_CHUNK 1024 // initial size of the read buffer, which doubles as needed
 
 //In struct werden ausgelesenen KonfigParameter abgelegt
 struct Config {
     char *host_name;
     int port_number; //datatype int for htons()
     char *game_type; //hier: Quarto
+    bool thinker_thread; // run the thinker as thread instead of a forked process ("thinker = thread")
+
+    // CPU pinning per role ("connector_cpus", "thinker_cpus"), scheduling shared by both
+    // ("sched_policy", "sched_priority", "nice") and "numa_local" for the thinker
+    struct Placement connector_placement;
+    struct Placement thinker_placement;
+
+    int log_level; // LOG_LEVEL_*, "log_level = debug|info|warn|error"
+
+    char *trace_file; // record a protocol trace into this file if non-null ("trace_file")
+    char *metrics_socket; // serve metrics on this Unix socket if non-null ("metrics_socket")
+    char *book_file; // opening book built by quarto-book-builder, optional ("book_file")
+    char *nnue_file; // evaluation network, optional ("nnue_file")
+    char *archive_file; // append every finished game to this archive if non-null ("archive_file")
+    char *workers; // addresses of search workers, separated by commas (no spaces), optional ("workers")
+    bool mcts; // search with Monte Carlo tree search instead of alpha-beta ("strategy = alphabeta|mcts")
+    int hash_bits; // transposition table size as power of two ("hash_bits")
+    int move_margin; // ms before the move timeout at which the connector stops waiting for the thinker ("move_margin")
+    int reconnect_attempts; // reconnects in a row after a lost connection, 0 to give up right away ("reconnect_attempts")
 };
 
 // Create empty config. Must be freed. Returns null on error.
@@ -46,6 +71,10 @@ int read_default_config(struct Config *conf);
 // Returns 0 on success, -1 otherwise.
 int save_config(char *config_file_name, struct Config *config);
 
+// Copies the engine parameters of config (those that can be reloaded while playing) into settings,
+// all but its generation.
+void config_engine_settings(struct Config *config, struct EngineSettings *settings);
+
 // Free config params (if non-null) and config struct itself.
 void free_config(struct Config *config);
 
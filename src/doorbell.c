@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "doorbell.h"
+
+static long futex(atomic_uint *address, int op, unsigned int value, const struct timespec *timeout) {
+    return syscall(SYS_futex, address, op, value, timeout, NULL, 0);
+}
+
+void doorbell_init(struct Doorbell *doorbell, bool process_shared) {
+    atomic_init(&doorbell->seq, 0);
+    atomic_init(&doorbell->waiters, 0);
+    doorbell->futex_flags = process_shared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
+unsigned int doorbell_ring(struct Doorbell *doorbell) {
+    unsigned int seq = atomic_fetch_add(&doorbell->seq, 1) + 1;
+
+    // skip the syscall if nobody is sleeping; seq_cst ordering pairs with the waiter's
+    // increment of waiters followed by its check of seq
+    if (atomic_load(&doorbell->waiters) > 0) {
+        futex(&doorbell->seq, FUTEX_WAKE | doorbell->futex_flags, __INT_MAX__, NULL);
+    }
+
+    return seq;
+}
+
+unsigned int doorbell_peek(struct Doorbell *doorbell) {
+    return atomic_load_explicit(&doorbell->seq, memory_order_acquire);
+}
+
+int doorbell_wait(struct Doorbell *doorbell, unsigned int seen, int timeout_ms) {
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    int ret = DOORBELL_RUNG;
+    atomic_fetch_add(&doorbell->waiters, 1);
+
+    while (atomic_load(&doorbell->seq) == seen) {
+        struct timespec remaining;
+        struct timespec *timeout = NULL;
+        if (timeout_ms >= 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000;
+            }
+            if (remaining.tv_sec < 0) {
+                ret = DOORBELL_TIMEOUT;
+                break;
+            }
+            timeout = &remaining;
+        }
+
+        // the kernel only puts us to sleep if seq still equals seen, so a ring in between is never lost
+        if (futex(&doorbell->seq, FUTEX_WAIT | doorbell->futex_flags, seen, timeout) == -1 && errno != EAGAIN && errno != EINTR) {
+            if (errno == ETIMEDOUT) {
+                ret = DOORBELL_TIMEOUT;
+            } else {
+                perror("futex wait failed");
+                ret = -1;
+            }
+            break;
+        }
+    }
+
+    atomic_fetch_sub(&doorbell->waiters, 1);
+    return ret;
+}
@@ -0,0 +1,40 @@
+#ifndef doorbell_h
+#define doorbell_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define DOORBELL_RUNG 0
+#define DOORBELL_TIMEOUT 1
+
+// Wakeup primitive that lives in shared memory and works across processes (futex based).
+// Ringing increments the sequence number, so waiters compare against the last number they have seen
+// and can never miss a ring that happened between checking and going to sleep.
+struct Doorbell {
+    atomic_uint seq;
+    atomic_uint waiters;
+    int futex_flags;
+};
+
+// Initialize the doorbell.
+//
+// process_shared: Whether the doorbell is rung and waited on from different processes (i.e. lives in shm).
+//                 Otherwise the cheaper process-private futex operations are used.
+void doorbell_init(struct Doorbell *doorbell, bool process_shared);
+
+// Ring the doorbell and wake all waiters. Async-signal-safe.
+//
+// Returns the new sequence number.
+unsigned int doorbell_ring(struct Doorbell *doorbell);
+
+// Returns the current sequence number without waiting, e.g. to check for a ring while doing other work.
+unsigned int doorbell_peek(struct Doorbell *doorbell);
+
+// Wait until the sequence number differs from seen.
+//
+// timeout_ms: Maximum time to wait in milliseconds, -1 to wait forever
+//
+// Returns DOORBELL_RUNG if the doorbell was rung, DOORBELL_TIMEOUT on timeout and -1 on error.
+int doorbell_wait(struct Doorbell *doorbell, unsigned int seen, int timeout_ms);
+
+#endif
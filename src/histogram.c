@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "histogram.h"
+
+static int histogram_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+    // value >> shift keeps the HISTOGRAM_SUB_BUCKET_BITS bits below the leading one
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+// Returns the largest value that falls into bucket index.
+static uint64_t histogram_bucket_max(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub_bucket = (uint64_t)(index % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_init(struct Histogram *histogram) {
+    memset(histogram, 0, sizeof(struct Histogram));
+}
+
+void histogram_record(struct Histogram *histogram, uint64_t value) {
+    histogram->buckets[histogram_index(value)]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t histogram_percentile(struct Histogram *histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = histogram_bucket_max(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
@@ -0,0 +1,29 @@
+#ifndef histogram_h
+#define histogram_h
+
+#include <stdint.h>
+
+// Log-linear (HDR-style) histogram over the full uint64_t range: values below 2^HISTOGRAM_SUB_BUCKET_BITS
+// are counted exactly, larger values in 2^HISTOGRAM_SUB_BUCKET_BITS linear sub-buckets per power of two,
+// i.e. with a relative error of at most 1/2^HISTOGRAM_SUB_BUCKET_BITS (~3%).
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct Histogram {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+// Reset histogram to empty.
+void histogram_init(struct Histogram *histogram);
+
+// Count value. Constant time, no allocation.
+void histogram_record(struct Histogram *histogram, uint64_t value);
+
+// Returns the value below which the given percentile (0..100) of all recorded values lies
+// (upper bound of its bucket, but never more than the maximum), 0 if the histogram is empty.
+uint64_t histogram_percentile(struct Histogram *histogram, double percentile);
+
+#endif
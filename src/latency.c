@@ -0,0 +1,103 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+#include "log.h"
+#include "quarto.h"
+
+static char *latency_phase_names[LATENCY_PHASE_COUNT] = {
+    "connect",
+    "handshake",
+    "parse field",
+    "send THINKING",
+    "wait OKTHINK",
+    "signal thinker",
+    "think",
+    "send PLAY",
+    "wait MOVEOK",
+    "move total",
+    "wakeup",
+    "search",
+};
+
+// incremented by the SIGUSR2 handler, every Latency dumps once per increment
+static volatile sig_atomic_t latency_dump_requests = 0;
+
+static void latency_sigusr2_handler(int signum) {
+    (void)signum;
+    latency_dump_requests++;
+}
+
+struct Latency *latency_create(char *role) {
+    struct Latency *latency = malloc(sizeof(struct Latency));
+    if (latency == NULL) {
+        perror("latency malloc failed");
+        return NULL;
+    }
+
+    latency->role = role;
+    latency->last_ns = quarto_now_ns();
+    latency->dumped_requests = latency_dump_requests;
+    for (int i = 0; i < LATENCY_PHASE_COUNT; i++) {
+        histogram_init(&latency->histograms[i]);
+    }
+    return latency;
+}
+
+void latency_begin(struct Latency *latency) {
+    latency->last_ns = quarto_now_ns();
+}
+
+void latency_begin_at(struct Latency *latency, uint64_t now_ns) {
+    latency->last_ns = now_ns;
+}
+
+void latency_mark(struct Latency *latency, enum LatencyPhase phase) {
+    uint64_t now = quarto_now_ns();
+    histogram_record(&latency->histograms[phase], now - latency->last_ns);
+    latency->last_ns = now;
+}
+
+void latency_record(struct Latency *latency, enum LatencyPhase phase, uint64_t duration_ns) {
+    histogram_record(&latency->histograms[phase], duration_ns);
+}
+
+void latency_dump(struct Latency *latency) {
+    for (int i = 0; i < LATENCY_PHASE_COUNT; i++) {
+        struct Histogram *histogram = &latency->histograms[i];
+        if (histogram->count == 0) {
+            continue;
+        }
+
+        log_info("Latency %s %-14s n=%-5lu p50=%8.3fms p99=%8.3fms p999=%8.3fms max=%8.3fms",
+                 latency->role, latency_phase_names[i], (unsigned long)histogram->count,
+                 histogram_percentile(histogram, 50) / 1e6,
+                 histogram_percentile(histogram, 99) / 1e6,
+                 histogram_percentile(histogram, 99.9) / 1e6,
+                 histogram->max / 1e6);
+    }
+}
+
+int latency_install_dump_signal() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = latency_sigusr2_handler;
+    action.sa_flags = SA_RESTART; // don't make blocking socket calls fail
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGUSR2, &action, NULL) != 0) {
+        perror("failed setting SIGUSR2 signal handler");
+        return -1;
+    }
+    return 0;
+}
+
+void latency_dump_if_requested(struct Latency *latency) {
+    unsigned int requests = latency_dump_requests;
+    if (requests != latency->dumped_requests) {
+        latency->dumped_requests = requests;
+        latency_dump(latency);
+    }
+}
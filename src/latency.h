@@ -0,0 +1,64 @@
+#ifndef latency_h
+#define latency_h
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Phases of the protocol state machine (connector) and of the thinker.
+// Each phase is the time between two consecutive boundaries marked with latency_mark().
+enum LatencyPhase {
+    LATENCY_CONNECT,        // DNS lookup and TCP connect
+    LATENCY_HANDSHAKE,      // connected until + ENDPLAYERS
+    LATENCY_PARSE_FIELD,    // + MOVE received until field parsed and stored
+    LATENCY_SEND_THINKING,  // field parsed until THINKING sent
+    LATENCY_OKTHINK,        // THINKING sent until + OKTHINK received
+    LATENCY_SIGNAL_THINKER, // + OKTHINK received until thinker requested
+    LATENCY_THINK,          // thinker requested until its final move received
+    LATENCY_SEND_PLAY,      // move received until PLAY sent
+    LATENCY_MOVEOK,         // PLAY sent until + MOVEOK received
+    LATENCY_MOVE_TOTAL,     // + MOVE received until PLAY sent
+    LATENCY_THINKER_WAKEUP, // thinker requested until thinker woke up
+    LATENCY_THINKER_SEARCH, // thinker woke up until final move published
+    LATENCY_PHASE_COUNT
+};
+
+// Latency histograms (in ns) of one process, or one role in thread mode.
+struct Latency {
+    char *role;
+    uint64_t last_ns; // last phase boundary
+    unsigned int dumped_requests;
+    struct Histogram histograms[LATENCY_PHASE_COUNT];
+};
+
+// Create latency histograms. Must be freed.
+//
+// role: Name used when dumping, e.g. "connector"
+//
+// Returns NULL on error.
+struct Latency *latency_create(char *role);
+
+// Mark a phase boundary without recording anything, e.g. at the start of a move.
+void latency_begin(struct Latency *latency);
+
+// Mark a phase boundary at the CLOCK_MONOTONIC time now_ns, e.g. when a message arrived (see Net.message_ns).
+void latency_begin_at(struct Latency *latency, uint64_t now_ns);
+
+// Mark a phase boundary and record the time since the previous one into phase.
+void latency_mark(struct Latency *latency, enum LatencyPhase phase);
+
+// Record a duration in ns into phase.
+void latency_record(struct Latency *latency, enum LatencyPhase phase, uint64_t duration_ns);
+
+// Log p50/p99/p999/max of every phase that has values.
+void latency_dump(struct Latency *latency);
+
+// Install a SIGUSR2 handler that requests a dump from every Latency of this process.
+//
+// Returns 0 on success, -1 otherwise.
+int latency_install_dump_signal();
+
+// Dump latency if SIGUSR2 was received since its last dump. Cheap enough to call on every protocol event.
+void latency_dump_if_requested(struct Latency *latency);
+
+#endif
@@ -0,0 +1,653 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "doorbell.h"
+#include "log.h"
+#include "quarto.h"
+
+// how log_text stores an argument in the record
+#define LOG_ARG_INVALID 0 // %n or unknown: formatting stops here
+#define LOG_ARG_PERCENT 1 // %%, no argument
+#define LOG_ARG_SIGNED 2 // stored as long long, printed with ll
+#define LOG_ARG_UNSIGNED 3 // stored as unsigned long long, printed with ll
+#define LOG_ARG_CHAR 4 // stored as int
+#define LOG_ARG_DOUBLE 5
+#define LOG_ARG_LONG_DOUBLE 6
+#define LOG_ARG_POINTER 7
+#define LOG_ARG_STRING 8 // the characters are copied, NUL terminated
+
+#define LOG_FIELD_NONE (-1) // no width or precision
+#define LOG_FIELD_STAR (-2) // width or precision passed as int argument
+
+// One conversion of a printf format.
+struct LogConversion {
+    const char *flags;
+    int flags_length;
+    int width; // or LOG_FIELD_NONE/LOG_FIELD_STAR
+    int precision; // or LOG_FIELD_NONE/LOG_FIELD_STAR
+    char length; // 'H' for hh, 'q' for ll, otherwise the modifier character or 0
+    char conversion;
+    int arg;
+};
+
+// Single-producer single-consumer ring: the owning thread writes at head, the flusher reads at tail.
+struct LogRing {
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic uint64_t dropped;
+    uint64_t dropped_reported; // only touched by the flusher
+    atomic_bool in_use; // owned by a thread; cleared when that thread exits, so a new thread can take the ring over
+    struct LogRing *next;
+    struct LogRecord records[LOG_RING_SIZE];
+};
+
+static atomic_int log_level = LOG_LEVEL_INFO;
+static atomic_bool log_running = false;
+static atomic_bool log_stop = false;
+static pthread_t log_flusher;
+
+// all rings ever registered; rings are only added, so the flusher can walk the list without locking
+static _Atomic(struct LogRing *) log_rings = NULL;
+static _Thread_local struct LogRing *log_thread_ring = NULL;
+static pthread_key_t log_ring_key; // releases the ring when its thread exits
+static pthread_once_t log_ring_key_once = PTHREAD_ONCE_INIT;
+
+// rung by a producer whose ring was empty, the flusher sleeps on it
+static struct Doorbell log_doorbell;
+
+static void log_format_text(FILE *out, const char *data, int length);
+
+static void log_print_record(FILE *out, struct LogRecord *record) {
+    if (record->formatter != NULL) {
+        record->formatter(out, record->data, record->length);
+    } else {
+        if (record->level >= LOG_LEVEL_WARN) {
+            fputs(record->level == LOG_LEVEL_WARN ? "WARNING: " : "ERROR: ", out);
+        }
+        log_format_text(out, record->data, record->length);
+        fputc('\n', out);
+    }
+}
+
+static void log_release_ring(void *arg) {
+    struct LogRing *ring = arg;
+    // release: the records committed by the exiting thread are visible to the next owner
+    atomic_store_explicit(&ring->in_use, false, memory_order_release);
+}
+
+static void log_create_ring_key() {
+    int err = pthread_key_create(&log_ring_key, log_release_ring);
+    if (err != 0) {
+        printf("Error creating log ring key: %s\n", strerror(err));
+    }
+}
+
+// Returns the ring of the calling thread. On first use, that's a ring released by an exited thread
+// (short-lived threads, e.g. one per move, then don't leave a ring behind each) or a new one.
+// NULL if out of memory.
+static struct LogRing *log_get_ring() {
+    if (log_thread_ring != NULL) {
+        return log_thread_ring;
+    }
+
+    struct LogRing *ring;
+    for (ring = atomic_load(&log_rings); ring != NULL; ring = ring->next) {
+        bool expected = false;
+        if (!atomic_load_explicit(&ring->in_use, memory_order_relaxed)
+            && atomic_compare_exchange_strong_explicit(&ring->in_use, &expected, true, memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(struct LogRing));
+        if (ring == NULL) {
+            return NULL;
+        }
+        atomic_init(&ring->in_use, true);
+
+        ring->next = atomic_load(&log_rings);
+        while (!atomic_compare_exchange_weak(&log_rings, &ring->next, ring)) {
+            // ring->next was updated to the current list head, retry
+        }
+    }
+
+    pthread_setspecific(log_ring_key, ring);
+    log_thread_ring = ring;
+    return ring;
+}
+
+// Reserve the next record of the calling thread's ring, NULL if the ring is full (the record is dropped then).
+static struct LogRecord *log_reserve(int level) {
+    struct LogRing *ring = log_get_ring();
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    struct LogRecord *record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    record->timestamp_ns = quarto_now_ns();
+    record->level = level;
+    return record;
+}
+
+// Publish the reserved record and wake the flusher if the ring was empty; otherwise the flusher hasn't
+// caught up with the ring yet and will find the record anyway.
+static void log_commit() {
+    struct LogRing *ring = log_thread_ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    // pairs with the fence in log_drain(): either we see the tail the flusher stored last,
+    // or the flusher sees our head on its next scan
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->tail, memory_order_relaxed) == head) {
+        doorbell_ring(&log_doorbell);
+    }
+}
+
+// Print all committed records of all rings, merged by timestamp.
+static void log_drain() {
+    bool printed = false;
+
+    while (true) {
+        struct LogRing *oldest = NULL;
+        struct LogRecord *oldest_record = NULL;
+
+        atomic_thread_fence(memory_order_seq_cst); // see log_commit()
+        for (struct LogRing *ring = atomic_load(&log_rings); ring != NULL; ring = ring->next) {
+            uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+                continue;
+            }
+
+            struct LogRecord *record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+            if (oldest == NULL || record->timestamp_ns < oldest_record->timestamp_ns) {
+                oldest = ring;
+                oldest_record = record;
+            }
+        }
+
+        if (oldest == NULL) {
+            break;
+        }
+
+        log_print_record(stdout, oldest_record);
+        atomic_store_explicit(&oldest->tail, atomic_load_explicit(&oldest->tail, memory_order_relaxed) + 1, memory_order_release);
+        printed = true;
+    }
+
+    for (struct LogRing *ring = atomic_load(&log_rings); ring != NULL; ring = ring->next) {
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if (dropped != ring->dropped_reported) {
+            fprintf(stdout, "WARNING: log buffer full, dropped %lu records\n", (unsigned long)(dropped - ring->dropped_reported));
+            ring->dropped_reported = dropped;
+            printed = true;
+        }
+    }
+
+    if (printed) {
+        fflush(stdout);
+    }
+}
+
+static void *log_flusher_main(void *arg) {
+    (void)arg;
+
+    while (!atomic_load(&log_stop)) {
+        unsigned int seen = doorbell_peek(&log_doorbell);
+        log_drain();
+        doorbell_wait(&log_doorbell, seen, -1);
+    }
+
+    log_drain();
+    return NULL;
+}
+
+int log_init() {
+    fflush(stdout);
+    atomic_store(&log_stop, false);
+    doorbell_init(&log_doorbell, false);
+    pthread_once(&log_ring_key_once, log_create_ring_key);
+
+    int err = pthread_create(&log_flusher, NULL, log_flusher_main, NULL);
+    if (err != 0) {
+        printf("Error creating log flusher thread: %s\n", strerror(err));
+        return -1;
+    }
+
+    atomic_store(&log_running, true);
+    return 0;
+}
+
+void log_shutdown() {
+    if (!atomic_load(&log_running)) {
+        return;
+    }
+
+    atomic_store(&log_stop, true);
+    doorbell_ring(&log_doorbell);
+    pthread_join(log_flusher, NULL);
+    atomic_store(&log_running, false);
+
+    struct LogRing *ring = atomic_exchange(&log_rings, NULL);
+    while (ring != NULL) {
+        struct LogRing *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    pthread_setspecific(log_ring_key, NULL);
+    log_thread_ring = NULL; // rings of other threads are gone as well, they must not log anymore
+}
+
+void log_set_level(int level) {
+    atomic_store(&log_level, level);
+}
+
+int log_parse_level(char *name) {
+    if (strcasecmp(name, "debug") == 0) {
+        return LOG_LEVEL_DEBUG;
+    } else if (strcasecmp(name, "info") == 0) {
+        return LOG_LEVEL_INFO;
+    } else if (strcasecmp(name, "warn") == 0) {
+        return LOG_LEVEL_WARN;
+    } else if (strcasecmp(name, "error") == 0) {
+        return LOG_LEVEL_ERROR;
+    }
+    return -1;
+}
+
+// Parse the conversion that starts at the '%' at format.
+//
+// Returns a pointer behind it.
+static const char *log_parse_conversion(const char *format, struct LogConversion *conversion) {
+    const char *p = format + 1;
+    conversion->flags = p;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        p++;
+    }
+    conversion->flags_length = (int)(p - conversion->flags);
+
+    conversion->width = LOG_FIELD_NONE;
+    if (*p == '*') {
+        conversion->width = LOG_FIELD_STAR;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        conversion->width = (int)strtol(p, (char **)&p, 10);
+    }
+    conversion->precision = LOG_FIELD_NONE;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            conversion->precision = LOG_FIELD_STAR;
+            p++;
+        } else {
+            conversion->precision = (int)strtol(p, (char **)&p, 10); // "." alone is precision 0
+        }
+    }
+
+    conversion->length = 0;
+    if ((p[0] == 'h' || p[0] == 'l') && p[1] == p[0]) {
+        conversion->length = p[0] == 'h' ? 'H' : 'q';
+        p += 2;
+    } else if (*p != '\0' && strchr("hlzjtL", *p) != NULL) {
+        conversion->length = *p++;
+    }
+
+    conversion->conversion = *p;
+    if (*p != '\0') {
+        p++;
+    }
+    switch (conversion->conversion) {
+        case '%':
+            conversion->arg = LOG_ARG_PERCENT;
+            break;
+        case 'd':
+        case 'i':
+            conversion->arg = LOG_ARG_SIGNED;
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            conversion->arg = LOG_ARG_UNSIGNED;
+            break;
+        case 'c':
+            conversion->arg = LOG_ARG_CHAR;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            conversion->arg = conversion->length == 'L' ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+            break;
+        case 'p':
+            conversion->arg = LOG_ARG_POINTER;
+            break;
+        case 's':
+            conversion->arg = LOG_ARG_STRING;
+            break;
+        default:
+            conversion->arg = LOG_ARG_INVALID;
+    }
+    return p;
+}
+
+static long long log_signed_arg(char length, va_list *args) {
+    switch (length) {
+        case 'H': return (signed char)va_arg(*args, int);
+        case 'h': return (short)va_arg(*args, int);
+        case 'l': return va_arg(*args, long);
+        case 'q': return va_arg(*args, long long);
+        case 'z': return va_arg(*args, ssize_t);
+        case 'j': return va_arg(*args, intmax_t);
+        case 't': return va_arg(*args, ptrdiff_t);
+        default: return va_arg(*args, int);
+    }
+}
+
+static unsigned long long log_unsigned_arg(char length, va_list *args) {
+    switch (length) {
+        case 'H': return (unsigned char)va_arg(*args, unsigned int);
+        case 'h': return (unsigned short)va_arg(*args, unsigned int);
+        case 'l': return va_arg(*args, unsigned long);
+        case 'q': return va_arg(*args, unsigned long long);
+        case 'z': return va_arg(*args, size_t);
+        case 'j': return va_arg(*args, uintmax_t);
+        case 't': return (unsigned long long)va_arg(*args, ptrdiff_t);
+        default: return va_arg(*args, unsigned int);
+    }
+}
+
+// Append size bytes to the record. Returns false if they don't fit.
+static bool log_pack(struct LogRecord *record, const void *value, size_t size) {
+    if (record->length + size > LOG_RECORD_DATA_SIZE) {
+        return false;
+    }
+    memcpy(record->data + record->length, value, size);
+    record->length += size;
+    return true;
+}
+
+// Store the format pointer and the arguments in the record without formatting them. Strings are copied,
+// as they may be gone when the flusher gets to the record. What doesn't fit is cut off.
+static void log_pack_text(struct LogRecord *record, const char *format, va_list *args) {
+    record->length = 0;
+    log_pack(record, &format, sizeof(format));
+
+    for (const char *p = strchr(format, '%'); p != NULL; p = strchr(p, '%')) {
+        struct LogConversion conversion;
+        p = log_parse_conversion(p, &conversion);
+        if (conversion.arg == LOG_ARG_INVALID) {
+            return;
+        }
+        if (conversion.arg == LOG_ARG_PERCENT) {
+            continue;
+        }
+
+        int width = 0;
+        int precision = conversion.precision;
+        if (conversion.width == LOG_FIELD_STAR) {
+            width = va_arg(*args, int);
+            if (!log_pack(record, &width, sizeof(width))) {
+                return;
+            }
+        }
+        if (conversion.precision == LOG_FIELD_STAR) {
+            precision = va_arg(*args, int);
+            if (!log_pack(record, &precision, sizeof(precision))) {
+                return;
+            }
+        }
+
+        bool packed;
+        switch (conversion.arg) {
+            case LOG_ARG_SIGNED: {
+                long long value = log_signed_arg(conversion.length, args);
+                packed = log_pack(record, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_UNSIGNED: {
+                unsigned long long value = log_unsigned_arg(conversion.length, args);
+                packed = log_pack(record, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_CHAR: {
+                int value = va_arg(*args, int);
+                packed = log_pack(record, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                double value = va_arg(*args, double);
+                packed = log_pack(record, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_LONG_DOUBLE: {
+                long double value = va_arg(*args, long double);
+                packed = log_pack(record, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_POINTER: {
+                void *value = va_arg(*args, void *);
+                packed = log_pack(record, &value, sizeof(value));
+                break;
+            }
+            default: {
+                const char *value = va_arg(*args, const char *);
+                if (value == NULL) {
+                    value = "(null)";
+                }
+                size_t length = precision >= 0 ? strnlen(value, precision) : strlen(value);
+                size_t space = LOG_RECORD_DATA_SIZE - record->length;
+                if (space == 0) {
+                    return;
+                }
+                if (length > space - 1) {
+                    length = space - 1;
+                }
+                memcpy(record->data + record->length, value, length);
+                record->data[record->length + length] = '\0';
+                record->length += length + 1;
+                packed = true;
+            }
+        }
+        if (!packed) {
+            return;
+        }
+    }
+}
+
+// Take size bytes from data at *offset. Returns false if the record ends before.
+static bool log_unpack(const char *data, int length, int *offset, void *value, size_t size) {
+    if (*offset + size > (size_t)length) {
+        return false;
+    }
+    memcpy(value, data + *offset, size);
+    *offset += size;
+    return true;
+}
+
+// Print a text record packed by log_pack_text(); runs on the flusher thread.
+static void log_format_text(FILE *out, const char *data, int length) {
+    const char *format;
+    int offset = 0;
+    if (!log_unpack(data, length, &offset, &format, sizeof(format))) {
+        return;
+    }
+
+    const char *p = format;
+    while (*p != '\0') {
+        const char *percent = strchr(p, '%');
+        if (percent == NULL) {
+            fputs(p, out);
+            return;
+        }
+        fwrite(p, 1, percent - p, out);
+
+        struct LogConversion conversion;
+        p = log_parse_conversion(percent, &conversion);
+        if (conversion.arg == LOG_ARG_INVALID) {
+            fputs(percent, out);
+            return;
+        }
+        if (conversion.arg == LOG_ARG_PERCENT) {
+            fputc('%', out);
+            continue;
+        }
+
+        int width = conversion.width;
+        int precision = conversion.precision;
+        bool left = false; // a negative width from an argument means left-justified
+        if (conversion.width == LOG_FIELD_STAR) {
+            if (!log_unpack(data, length, &offset, &width, sizeof(width))) {
+                return;
+            }
+            left = width < 0;
+            width = left ? -width : width;
+        }
+        if (conversion.precision == LOG_FIELD_STAR && !log_unpack(data, length, &offset, &precision, sizeof(precision))) {
+            return;
+        }
+
+        // rebuild the conversion with the stars resolved and the integer length normalized to ll
+        char spec[64];
+        int n = snprintf(spec, sizeof(spec), "%%%.*s%s", conversion.flags_length, conversion.flags, left ? "-" : "");
+        if (width >= 0) {
+            n += snprintf(spec + n, sizeof(spec) - n, "%d", width);
+        }
+        if (precision >= 0) {
+            n += snprintf(spec + n, sizeof(spec) - n, ".%d", precision);
+        }
+        if (conversion.arg == LOG_ARG_SIGNED || conversion.arg == LOG_ARG_UNSIGNED) {
+            n += snprintf(spec + n, sizeof(spec) - n, "ll");
+        } else if (conversion.arg == LOG_ARG_LONG_DOUBLE) {
+            n += snprintf(spec + n, sizeof(spec) - n, "L");
+        }
+        snprintf(spec + n, sizeof(spec) - n, "%c", conversion.conversion);
+
+        switch (conversion.arg) {
+            case LOG_ARG_SIGNED: {
+                long long value;
+                if (!log_unpack(data, length, &offset, &value, sizeof(value))) {
+                    return;
+                }
+                fprintf(out, spec, value);
+                break;
+            }
+            case LOG_ARG_UNSIGNED: {
+                unsigned long long value;
+                if (!log_unpack(data, length, &offset, &value, sizeof(value))) {
+                    return;
+                }
+                fprintf(out, spec, value);
+                break;
+            }
+            case LOG_ARG_CHAR: {
+                int value;
+                if (!log_unpack(data, length, &offset, &value, sizeof(value))) {
+                    return;
+                }
+                fprintf(out, spec, value);
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                double value;
+                if (!log_unpack(data, length, &offset, &value, sizeof(value))) {
+                    return;
+                }
+                fprintf(out, spec, value);
+                break;
+            }
+            case LOG_ARG_LONG_DOUBLE: {
+                long double value;
+                if (!log_unpack(data, length, &offset, &value, sizeof(value))) {
+                    return;
+                }
+                fprintf(out, spec, value);
+                break;
+            }
+            case LOG_ARG_POINTER: {
+                void *value;
+                if (!log_unpack(data, length, &offset, &value, sizeof(value))) {
+                    return;
+                }
+                fprintf(out, spec, value);
+                break;
+            }
+            default: {
+                if (offset >= length) {
+                    return;
+                }
+                const char *value = data + offset;
+                offset += strnlen(value, length - offset) + 1;
+                fprintf(out, spec, value);
+            }
+        }
+    }
+}
+
+void log_text(int level, const char *format, ...) {
+    if (level < atomic_load_explicit(&log_level, memory_order_relaxed)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    if (!atomic_load_explicit(&log_running, memory_order_relaxed)) {
+        if (level >= LOG_LEVEL_WARN) {
+            fputs(level == LOG_LEVEL_WARN ? "WARNING: " : "ERROR: ", stdout);
+        }
+        vprintf(format, args);
+        putchar('\n');
+    } else {
+        struct LogRecord *record = log_reserve(level);
+        if (record != NULL) {
+            log_pack_text(record, format, &args);
+            record->formatter = NULL;
+            log_commit();
+        }
+    }
+
+    va_end(args);
+}
+
+void log_binary(int level, log_formatter formatter, const void *data, int length) {
+    if (level < LOG_COMPILE_LEVEL || level < atomic_load_explicit(&log_level, memory_order_relaxed)) {
+        return;
+    }
+
+    if (length > LOG_RECORD_DATA_SIZE) {
+        length = LOG_RECORD_DATA_SIZE;
+    }
+
+    if (!atomic_load_explicit(&log_running, memory_order_relaxed)) {
+        formatter(stdout, data, length);
+        return;
+    }
+
+    struct LogRecord *record = log_reserve(level);
+    if (record != NULL) {
+        memcpy(record->data, data, length);
+        record->length = length;
+        record->formatter = formatter;
+        log_commit();
+    }
+}
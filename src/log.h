@@ -0,0 +1,68 @@
+#ifndef log_h
+#define log_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// Calls below this level are compiled out entirely, e.g. build with -DLOG_COMPILE_LEVEL=0 to keep debug output.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 1024 // records per producer thread (reused after it exits), must be a power of two
+#define LOG_RECORD_DATA_SIZE 496
+
+// Turns the binary payload of a record into text; runs on the flusher thread.
+typedef void (*log_formatter)(FILE *out, const void *data, int length);
+
+// One log record. Text records carry the format pointer and the raw arguments (strings copied), binary records
+// carry raw data plus the formatter; both are rendered later on the flusher thread, so the producer only pays
+// for copying the arguments. The flusher sleeps until a producer finds its ring empty and wakes it.
+struct LogRecord {
+    uint64_t timestamp_ns;
+    log_formatter formatter; // NULL for text records
+    uint8_t level;
+    uint16_t length;
+    char data[LOG_RECORD_DATA_SIZE];
+};
+
+// Start the background flusher thread of this process.
+// Until then (and after log_shutdown()), log calls write synchronously to stdout.
+// Must be called after fork(), since threads don't survive it.
+//
+// Returns 0 on success, -1 otherwise (logging then just stays synchronous).
+int log_init();
+
+// Flush all pending records and stop the flusher thread.
+// All other threads that log must have stopped before.
+void log_shutdown();
+
+// Set the minimum level that is logged at runtime.
+void log_set_level(int level);
+
+// Parse "debug", "info", "warn" or "error".
+//
+// Returns the level or -1 if name is unknown.
+int log_parse_level(char *name);
+
+// Log a printf-style message. Use the log_debug/log_info/... macros instead.
+// The format must stay valid (a string literal), since it is only read when the record is flushed;
+// %n is not supported.
+void log_text(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Log length bytes of data, which are rendered by formatter on the flusher thread.
+// Data longer than LOG_RECORD_DATA_SIZE is truncated.
+void log_binary(int level, log_formatter formatter, const void *data, int length);
+
+#define log_at(level, ...) do { if ((level) >= LOG_COMPILE_LEVEL) log_text((level), __VA_ARGS__); } while (0)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
@@ -1,20 +1,60 @@
 #define _GNU_SOURCE //for func: strcasestr (must be at beginning of file)
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <regex.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "archive.h"
 #include "client.h"
+#include "cluster.h"
 #include "config.h"
+#include "latency.h"
+#include "log.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
+#include "placement.h"
+#include "quarto.h"
+#include "reload.h"
 #include "shm.h"
 #include "thinker.h"
 
+// Connect to the server and play the game, i.e. the CONNECTOR part.
+// Reloads the engine settings from config_path while playing (see reload.h).
+// Tells the thinker to stop when done.
+//
+// Returns 0 on success, -1 otherwise.
+static int run_connector(struct Config *config, char *config_path, struct SharedMemory *shared_memory, char *game_id,
+                         int player_nr);
+
+// Load the book and network, enable MCTS and connect the workers, as far as config asks for them.
+// All of them are optional: without book, the thinker just searches; without network, only wins and losses
+// are scored; without its node pool, the thinker uses the alpha-beta search; without workers, it searches alone.
+static void configure_thinker(struct Thinker *thinker, struct Config *config);
+
+struct ThinkerThreadArgs {
+    struct SharedMemory *shared_memory;
+    struct Config *config;
+};
+
+// Thread entry point for running the thinker in-process (config "thinker = thread").
+//
+// arg: struct ThinkerThreadArgs
+static void *thinker_thread_main(void *arg);
+
+// Serve search jobs of coordinating clients on address (see cluster.h), with log level, thinker placement
+// and network from config_path if given ("--worker ADDRESS [CONFIG]").
+//
+// Returns only on errors, with EXIT_FAILURE.
+static int run_worker(char *address, char *config_path);
+
 int main(int argc, char **argv) {
     int ret_val = EXIT_SUCCESS;
 
@@ -24,6 +64,10 @@ int main(int argc, char **argv) {
     int player_nr = -1;
     struct Config *config = NULL;
 
+    if (argc >= 3 && strcmp(argv[1], "--worker") == 0) {
+        return run_worker(argv[2], argc >= 4 ? argv[3] : NULL);
+    }
+
     // TODO by Skruppy: argv[0] enthält den namen des Programms, i könnte bei 1 anfangen. aber man kann sich die prüfung hier auch ganz schenken, da man einfach nach der getopt() schleife schauen kann ob `game_id == NULL` ist. Die `-p` muss sogar fehlen dürfen. Das soll ein optionales argument sein (im gegensatzt zur game ID, die ein verpflichtendes argument sein soll). Fehlt die soll der gameserver den nächsten freien spieler zuweisen.
     for (int i = 0; i < argc; i++) {
         if(strcmp(argv[i], "-g") == 0) {
@@ -103,10 +147,68 @@ int main(int argc, char **argv) {
         goto error;
     }
 
-    //FORK Setup
-    int fd[2];
+    // SIGUSR2 dumps the latency histograms of the process; installed before fork() so both processes have it
+    if (latency_install_dump_signal() != 0) {
+        goto error;
+    }
+
+    // SIGHUP reloads the config file; the reload thread takes it from a signalfd, so it has to be blocked in every
+    // thread of both processes, i.e. before fork() and the first pthread_create()
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+
+    // the engine settings of the config file, replaced by the reload thread later on
+    struct EngineSettings settings = {0};
+    config_engine_settings(config, &settings);
+
+    struct SharedMemory *shared_memory = NULL;
+    if (config->thinker_thread) {
+        // thinker and connector share our address space, plain memory is all we need
+        shared_memory = shm_create_local();
+        if (shared_memory == NULL) {
+            goto error;
+        }
+        shm_init(shared_memory, false);
+        shm_set_settings(shared_memory, &settings);
+
+        shared_memory->thinker_pid = getpid();
+        shared_memory->connector_pid = getpid();
+
+        printf("Thinker thread begin\n");
+        log_set_level(config->log_level);
+        log_init();
+
+        pthread_t thinker_thread;
+        void *thinker_ret = NULL;
+        struct ThinkerThreadArgs thinker_args;
+        thinker_args.shared_memory = shared_memory;
+        thinker_args.config = config;
+        int pthread_ret = pthread_create(&thinker_thread, NULL, thinker_thread_main, &thinker_args);
+        if (pthread_ret != 0) {
+            printf("Error creating thinker thread: %s\n", strerror(pthread_ret));
+            log_shutdown();
+            free(shared_memory);
+            goto error;
+        }
+
+        if (run_connector(config, config_path, shared_memory, game_id, player_nr) != 0) {
+            ret_val = EXIT_FAILURE;
+        }
 
-    //Creating Shared Memory
+        // run_connector() has told the thinker to stop
+        pthread_join(thinker_thread, &thinker_ret);
+        if (thinker_ret != NULL) {
+            ret_val = EXIT_FAILURE;
+        }
+
+        log_shutdown();
+        free(shared_memory);
+        goto cleanup;
+    }
+
+    //Creating Shared Memory (one fixed-size arena for the whole game, see shm.h)
     int shm_id = create_shm_segment(sizeof(struct SharedMemory));
     if (shm_id < 0) {
         goto error;
@@ -115,15 +217,12 @@ int main(int argc, char **argv) {
     printf("Shared Memory ID: %d\n", shm_id);
 
     //Attaching Shared Memory
-    struct SharedMemory *shared_memory = shm_attach(shm_id);
+    shared_memory = shm_attach(shm_id);
     if (shared_memory == NULL) {
         goto error;
     }
-
-    if (pipe(fd) < 0) {
-        perror("Error while creating Pipe.");
-        goto error;
-    }
+    shm_init(shared_memory, true);
+    shm_set_settings(shared_memory, &settings);
 
     //Forking process
     pid_t thinker_pid = getpid();
@@ -138,13 +237,16 @@ int main(int argc, char **argv) {
         shared_memory->thinker_pid = thinker_pid;
         shared_memory->connector_pid = connector_pid;
 
-        // Close reading side of pipe as it's not needed
-        close(fd[0]);
+        placement_apply(&config->thinker_placement, "thinker");
+
+        log_set_level(config->log_level);
+        log_init();
 
-        struct Thinker *thinker = thinker_create(shared_memory, fd[1]);
+        struct Thinker *thinker = thinker_create(shared_memory);
         if (thinker == NULL) {
             goto thinker_error;
         }
+        configure_thinker(thinker, config);
 
         if (thinker_loop(thinker) != 0) {
             if (kill(connector_pid, SIGTERM) != 0) {
@@ -168,54 +270,21 @@ int main(int argc, char **argv) {
 
         thinker_cleanup:
         if (thinker != NULL) {
-            free(thinker);
+            thinker_free(thinker);
         }
+        log_shutdown();
     } else {
         // -----Child Process----- --> CONNECTOR
-        connector_pid = getpid();
         printf("Connector process begin\n");
 
-        struct Net *net = NULL;
-        struct Client *client = NULL;
-
-        // Close writing side of pipe as it's not needed
-        close(fd[1]);
-
-        net = net_create();
-        if (net == NULL) {
-            goto error_client;
-        }
-
-        if (net_connect(net, config->host_name, config->port_number) != 0) {
-            printf("Connecting failed.\n");
-            goto error_client;
-        };
-
-        //Calling Connector Function
-        client = client_create(net, shared_memory, fd[0]);
-        if (client == NULL) {
-            goto error_client;
-        }
+        log_set_level(config->log_level);
+        log_init();
 
-        if (client_play(client, game_id, player_nr) != 0) {
-            printf("Failure during playing!\n");
-            goto error_client;
+        if (run_connector(config, config_path, shared_memory, game_id, player_nr) != 0) {
+            ret_val = EXIT_FAILURE;
         }
 
-        goto cleanup_client;
-
-        error_client:
-        ret_val = EXIT_FAILURE;
-
-        cleanup_client:
-        if (client != NULL) {
-            free(client);
-            client = NULL;
-        }
-        if (net != NULL) {
-            net_free(net);
-            net = NULL;
-        }
+        log_shutdown();
     }
 
     goto cleanup;
@@ -233,6 +302,180 @@ int main(int argc, char **argv) {
     return ret_val;
 }
 
+static int run_connector(struct Config *config, char *config_path, struct SharedMemory *shared_memory, char *game_id,
+                         int player_nr) {
+    int ret_val = 0;
+    struct Net *net = NULL;
+    struct Client *client = NULL;
+    struct MetricsServer *metrics_server = NULL;
+    struct Archive *archive = NULL;
+    struct Reload *reload = NULL;
+
+    placement_apply(&config->connector_placement, "connector");
+
+    // without reloading, the settings of the config file stay as they are
+    reload = reload_start(config_path, shared_memory);
+
+    // metrics are optional, so the game goes on without them
+    if (config->metrics_socket != NULL) {
+        metrics_server = metrics_server_start(&shared_memory->metrics, config->metrics_socket);
+    }
+
+    net = net_create();
+    if (net == NULL) {
+        goto error_client;
+    }
+
+    net->metrics = &shared_memory->metrics;
+
+    if (config->trace_file != NULL && net_start_trace(net, config->trace_file) != 0) {
+        goto error_client;
+    }
+
+    uint64_t connect_start_ns = quarto_now_ns();
+    if (net_connect(net, config->host_name, config->port_number) != 0) {
+        printf("Connecting failed.\n");
+        goto error_client;
+    };
+
+    //Calling Connector Function
+    client = client_create(net, shared_memory);
+    if (client == NULL) {
+        goto error_client;
+    }
+    client->move_margin = config->move_margin;
+
+    // the archive is optional as well
+    if (config->archive_file != NULL) {
+        archive = archive_open(config->archive_file);
+        client->archive = archive;
+    }
+    latency_record(client->latency, LATENCY_CONNECT, quarto_now_ns() - connect_start_ns);
+
+    // a lost connection is resumed in the same game as the same player, the thinker and its tables stay as they are
+    int play_ret = client_play(client, game_id, player_nr);
+    int attempt = 0;
+    while (play_ret == CLIENT_DISCONNECTED && attempt < config->reconnect_attempts) {
+        attempt = client->joined ? 1 : attempt + 1;
+        int delay_ms = CLIENT_RECONNECT_DELAY_MS << (attempt - 1);
+        if (delay_ms > CLIENT_RECONNECT_MAX_DELAY_MS || delay_ms <= 0) {
+            delay_ms = CLIENT_RECONNECT_MAX_DELAY_MS;
+        }
+        log_warn("Connection lost, reconnecting in %d ms (attempt %d of %d)", delay_ms, attempt, config->reconnect_attempts);
+        struct timespec delay = {delay_ms / 1000, (delay_ms % 1000) * 1000000L};
+        while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {
+        }
+
+        metrics_add(shared_memory->metrics.reconnects, 1);
+        if (net_reconnect(net, config->host_name, config->port_number) != 0) {
+            client->joined = false;
+            continue;
+        }
+        play_ret = client_play(client, game_id, shared_memory->player_nr);
+    }
+    if (play_ret != 0) {
+        printf("Failure during playing!\n");
+        goto error_client;
+    }
+
+    goto cleanup_client;
+
+    error_client:
+    ret_val = -1;
+
+    cleanup_client:
+    // tell the thinker we're done
+    atomic_store(&shared_memory->connector_stopped, true);
+    doorbell_ring(&shared_memory->thinker_request);
+
+    if (client != NULL) {
+        client_free(client);
+        client = NULL;
+    }
+    if (net != NULL) {
+        net_free(net);
+        net = NULL;
+    }
+    if (metrics_server != NULL) {
+        metrics_server_stop(metrics_server);
+        metrics_server = NULL;
+    }
+    if (archive != NULL) {
+        archive_close(archive); // writes the last game
+        archive = NULL;
+    }
+    if (reload != NULL) {
+        reload_stop(reload);
+        reload = NULL;
+    }
+
+    return ret_val;
+}
+
+static void configure_thinker(struct Thinker *thinker, struct Config *config) {
+    if (config->book_file != NULL) {
+        thinker_load_book(thinker, config->book_file);
+    }
+    if (config->nnue_file != NULL) {
+        thinker_load_nnue(thinker, config->nnue_file);
+    }
+    if (config->mcts) {
+        thinker_use_mcts(thinker);
+    }
+    if (config->workers != NULL) {
+        thinker_connect_workers(thinker, config->workers);
+    }
+}
+
+static void *thinker_thread_main(void *arg) {
+    struct ThinkerThreadArgs *args = arg;
+    void *ret = NULL;
+
+    placement_apply(&args->config->thinker_placement, "thinker");
+
+    struct Thinker *thinker = thinker_create(args->shared_memory);
+    if (thinker != NULL) {
+        configure_thinker(thinker, args->config);
+    }
+    if (thinker == NULL || thinker_loop(thinker) != 0) {
+        printf("Thinker thread failed.\n");
+        ret = arg; // any non-NULL value reports the failure to pthread_join()
+    }
+
+    if (thinker != NULL) {
+        thinker_free(thinker);
+    }
+    return ret;
+}
+
+static int run_worker(char *address, char *config_path) {
+    struct Config *config = create_config();
+    if (config == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (config_path != NULL && read_config(config_path, config) != 0) {
+        free_config(config);
+        return EXIT_FAILURE;
+    }
+
+    placement_apply(&config->thinker_placement, "worker");
+    log_set_level(config->log_level);
+    log_init();
+
+    struct Nnue *nnue = NULL;
+    if (config->nnue_file != NULL) {
+        nnue = nnue_load(config->nnue_file);
+    }
+    cluster_worker_run(address, nnue);
+
+    if (nnue != NULL) {
+        nnue_free(nnue);
+    }
+    log_shutdown();
+    free_config(config);
+    return EXIT_FAILURE;
+}
+
 int wait_with_retry(pid_t pid) {
     while (waitpid(pid, NULL, 0) == -1) {
         if (errno != EINTR) {
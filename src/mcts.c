@@ -0,0 +1,432 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mcts.h"
+#include "quarto.h"
+
+struct Mcts *mcts_create(int pool_bits) {
+    struct Mcts *mcts = calloc(1, sizeof(struct Mcts));
+    if (mcts == NULL) {
+        perror("mcts calloc failed");
+        return NULL;
+    }
+
+    mcts->capacity = 1U << pool_bits;
+    mcts->nodes = calloc(mcts->capacity, sizeof(struct MctsNode));
+    if (mcts->nodes == NULL) {
+        perror("mcts node pool calloc failed");
+        free(mcts);
+        return NULL;
+    }
+    mcts->used = 0;
+    mcts->free_top = MCTS_NIL;
+    mcts->root = MCTS_NIL;
+    atomic_init(&mcts->stop, false);
+    mcts->external_stop = NULL;
+    mcts->random = 0x9e3779b97f4a7c15ULL ^ (uint64_t)time(NULL);
+    return mcts;
+}
+
+void mcts_free(struct Mcts *mcts) {
+    free(mcts->nodes);
+    free(mcts);
+}
+
+// xorshift64*
+static uint64_t mcts_random(struct Mcts *mcts) {
+    mcts->random ^= mcts->random >> 12;
+    mcts->random ^= mcts->random << 25;
+    mcts->random ^= mcts->random >> 27;
+    return mcts->random * 0x2545f4914f6cdd1dULL;
+}
+
+// Push a released node; its siblings after it and all their descendants are released with it.
+static void mcts_release(struct Mcts *mcts, uint32_t index) {
+    mcts->nodes[index].next_free = mcts->free_top;
+    mcts->free_top = index;
+}
+
+// Returns a fresh node, or MCTS_NIL if the pool is exhausted.
+static uint32_t mcts_alloc(struct Mcts *mcts, int square, int piece, int state) {
+    uint32_t index;
+    if (mcts->free_top != MCTS_NIL) {
+        index = mcts->free_top;
+        struct MctsNode *node = &mcts->nodes[index];
+        mcts->free_top = node->next_free;
+        // the nodes this one links to are released now
+        if (node->next_sibling != MCTS_NIL) {
+            mcts_release(mcts, node->next_sibling);
+        }
+        if (node->first_child != MCTS_NIL) {
+            mcts_release(mcts, node->first_child);
+        }
+    } else if (mcts->used < mcts->capacity) {
+        index = mcts->used++;
+    } else {
+        return MCTS_NIL;
+    }
+
+    struct MctsNode *node = &mcts->nodes[index];
+    node->first_child = MCTS_NIL;
+    node->next_sibling = MCTS_NIL;
+    node->next_free = MCTS_NIL;
+    node->visits = 0;
+    node->results = 0;
+    node->square = square;
+    node->piece = piece;
+    node->state = state;
+    return index;
+}
+
+// Prepend a new child to the list starting at *first.
+//
+// Returns false if the pool is exhausted.
+static bool mcts_add_child(struct Mcts *mcts, uint32_t *first, int square, int piece, int state) {
+    uint32_t child = mcts_alloc(mcts, square, piece, state);
+    if (child == MCTS_NIL) {
+        return false;
+    }
+    mcts->nodes[child].next_sibling = *first;
+    *first = child;
+    return true;
+}
+
+// Create the children of a leaf: a winning placement if there is one (nothing else is worth trying),
+// otherwise every placement with every safe piece, or with every piece if none is safe.
+//
+// Returns false if the pool is exhausted; the node stays a leaf then.
+static bool mcts_expand(struct Mcts *mcts, uint32_t index, struct Board *board, int hand_piece) {
+    uint32_t first = MCTS_NIL;
+    uint64_t free_squares = board_free_squares(board);
+
+    for (uint64_t f = free_squares; f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        if (board_wins_with(board, square, hand_piece)) {
+            if (!mcts_add_child(mcts, &first, square, BOARD_NO_PIECE, MCTS_WON)) {
+                return false;
+            }
+            mcts->nodes[index].first_child = first;
+            return true;
+        }
+    }
+
+    bool ok = true;
+    for (uint64_t f = free_squares; f != 0 && ok; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        if ((free_squares & (free_squares - 1)) == 0) {
+            ok = mcts_add_child(mcts, &first, square, BOARD_NO_PIECE, MCTS_DRAWN);
+            break;
+        }
+
+        int ones;
+        int zeros;
+        board_place(board, square, hand_piece);
+        board_threats(board, &ones, &zeros);
+        board_remove(board, square);
+
+        bool any_safe = false;
+        for (int pass = 0; pass < 2 && !any_safe && ok; pass++) {
+            for (int w = 0; w < (board->piece_count + 63) / 64 && ok; w++) {
+                for (uint64_t p = board->pieces_left[w]; p != 0 && ok; p &= p - 1) {
+                    int piece = w * 64 + __builtin_ctzll(p);
+                    if (pass == 0 && !board_piece_safe(board, piece, ones, zeros)) {
+                        continue;
+                    }
+                    any_safe = true;
+                    ok = mcts_add_child(mcts, &first, square, piece, MCTS_OPEN);
+                }
+            }
+        }
+    }
+
+    if (!ok) {
+        if (first != MCTS_NIL) {
+            mcts_release(mcts, first);
+        }
+        return false;
+    }
+    mcts->nodes[index].first_child = first;
+    return true;
+}
+
+// UCT: the child with the best mean result plus exploration bonus; unvisited children first.
+static uint32_t mcts_select(struct Mcts *mcts, uint32_t parent) {
+    float log_visits = logf((float)mcts->nodes[parent].visits + 1);
+    uint32_t best = MCTS_NIL;
+    float best_value = -1;
+    for (uint32_t c = mcts->nodes[parent].first_child; c != MCTS_NIL; c = mcts->nodes[c].next_sibling) {
+        const struct MctsNode *child = &mcts->nodes[c];
+        if (child->visits == 0) {
+            return c;
+        }
+        float value = child->results / child->visits + MCTS_EXPLORATION * sqrtf(log_visits / child->visits);
+        if (value > best_value) {
+            best_value = value;
+            best = c;
+        }
+    }
+    return best;
+}
+
+// Play random safe moves until the game ends.
+//
+// Returns the result for the side to move on board.
+static float mcts_playout(struct Mcts *mcts, struct Board *board, int hand_piece) {
+    int side = 0;
+    while (true) {
+        uint64_t free_squares = board_free_squares(board);
+        if (free_squares == 0) {
+            return 0.5f;
+        }
+        for (uint64_t f = free_squares; f != 0; f &= f - 1) {
+            if (board_wins_with(board, __builtin_ctzll(f), hand_piece)) {
+                return side == 0 ? 1.0f : 0.0f;
+            }
+        }
+
+        uint64_t f = free_squares;
+        for (int n = mcts_random(mcts) % __builtin_popcountll(free_squares); n > 0; n--) {
+            f &= f - 1;
+        }
+        board_place(board, __builtin_ctzll(f), hand_piece);
+        if ((free_squares & (free_squares - 1)) == 0) {
+            return 0.5f;
+        }
+
+        int ones;
+        int zeros;
+        board_threats(board, &ones, &zeros);
+        int safe_count = 0;
+        int left_count = 0;
+        for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+            for (uint64_t p = board->pieces_left[w]; p != 0; p &= p - 1) {
+                left_count++;
+                safe_count += board_piece_safe(board, w * 64 + __builtin_ctzll(p), ones, zeros);
+            }
+        }
+        if (left_count == 0) {
+            return 0.5f;
+        }
+
+        bool only_safe = safe_count > 0;
+        int n = mcts_random(mcts) % (only_safe ? safe_count : left_count);
+        hand_piece = BOARD_NO_PIECE;
+        for (int w = 0; w < (board->piece_count + 63) / 64 && hand_piece == BOARD_NO_PIECE; w++) {
+            for (uint64_t p = board->pieces_left[w]; p != 0; p &= p - 1) {
+                int piece = w * 64 + __builtin_ctzll(p);
+                if ((!only_safe || board_piece_safe(board, piece, ones, zeros)) && n-- == 0) {
+                    hand_piece = piece;
+                    break;
+                }
+            }
+        }
+        board_take_piece(board, hand_piece);
+        side ^= 1;
+    }
+}
+
+// One simulation: select down to a leaf, expand it if it was visited before, play out and back up the result.
+static void mcts_iterate(struct Mcts *mcts) {
+    struct Board board;
+    memcpy(&board, &mcts->root_board, sizeof(struct Board));
+    int hand_piece = mcts->root_hand_piece;
+    uint32_t path[SEARCH_MAX_PLY + 1];
+    int depth = 0;
+    uint32_t index = mcts->root;
+    path[0] = index;
+
+    float result; // for the side to move after path[depth]
+    while (true) {
+        struct MctsNode *node = &mcts->nodes[index];
+        if (node->state == MCTS_WON) {
+            result = 0.0f;
+            break;
+        }
+        if (node->state == MCTS_DRAWN) {
+            result = 0.5f;
+            break;
+        }
+        if (node->first_child == MCTS_NIL
+            && ((node->visits == 0 && depth > 0) || !mcts_expand(mcts, index, &board, hand_piece))) {
+            result = mcts_playout(mcts, &board, hand_piece);
+            break;
+        }
+
+        index = mcts_select(mcts, index);
+        node = &mcts->nodes[index];
+        board_place(&board, node->square, hand_piece);
+        if (node->piece != BOARD_NO_PIECE) {
+            board_take_piece(&board, node->piece);
+        }
+        hand_piece = node->piece;
+        path[++depth] = index;
+    }
+
+    if (depth > mcts->max_depth) {
+        mcts->max_depth = depth;
+    }
+    for (int d = depth; d >= 0; d--) {
+        result = 1.0f - result; // now for the side that made the move into path[d]
+        mcts->nodes[path[d]].visits++;
+        mcts->nodes[path[d]].results += result;
+    }
+}
+
+static void mcts_best(struct Mcts *mcts, struct SearchResult *result) {
+    uint32_t best = MCTS_NIL;
+    for (uint32_t c = mcts->nodes[mcts->root].first_child; c != MCTS_NIL; c = mcts->nodes[c].next_sibling) {
+        const struct MctsNode *child = &mcts->nodes[c];
+        if (best == MCTS_NIL || child->visits > mcts->nodes[best].visits
+            || (child->visits == mcts->nodes[best].visits && child->results > mcts->nodes[best].results)) {
+            best = c;
+        }
+    }
+
+    const struct MctsNode *node = &mcts->nodes[best];
+    result->square = node->square;
+    result->piece = node->piece;
+    if (node->state == MCTS_WON) {
+        result->score = SEARCH_WIN - 1;
+    } else {
+        float mean = node->visits > 0 ? node->results / node->visits : 0.5f;
+        result->score = (int)((2 * mean - 1) * MCTS_SCORE_SCALE);
+    }
+    result->depth = mcts->max_depth;
+    result->nodes = mcts->iterations;
+}
+
+static bool mcts_should_stop(struct Mcts *mcts) {
+    if (mcts->iterations % MCTS_CHECK_INTERVAL != 0) {
+        return false;
+    }
+    return atomic_load_explicit(&mcts->stop, memory_order_relaxed)
+           || (mcts->external_stop != NULL && atomic_load_explicit(mcts->external_stop, memory_order_relaxed))
+           || (mcts->deadline_ns != 0 && quarto_now_ns() >= mcts->deadline_ns)
+           || (mcts->iteration_budget != 0 && mcts->iterations >= mcts->iteration_budget);
+}
+
+// Returns the child of parent reached by square and piece (and in *previous its predecessor
+// in the child list, MCTS_NIL if it is the first), or MCTS_NIL if there is none.
+static uint32_t mcts_find_child(struct Mcts *mcts, uint32_t parent, int square, int piece, uint32_t *previous) {
+    *previous = MCTS_NIL;
+    for (uint32_t c = mcts->nodes[parent].first_child; c != MCTS_NIL; c = mcts->nodes[c].next_sibling) {
+        if (mcts->nodes[c].square == square && mcts->nodes[c].piece == piece) {
+            return c;
+        }
+        *previous = c;
+    }
+    return MCTS_NIL;
+}
+
+// Find the node two plies below the root that leads to board with hand_piece.
+//
+// Returns it (already unlinked from its parent) or MCTS_NIL.
+static uint32_t mcts_detach_successor(struct Mcts *mcts, const struct Board *board, int hand_piece) {
+    const struct Board *root_board = &mcts->root_board;
+    if (board->width != root_board->width || board->height != root_board->height
+        || (root_board->occupied & ~board->occupied) != 0) {
+        return MCTS_NIL;
+    }
+    for (uint64_t o = root_board->occupied; o != 0; o &= o - 1) {
+        int square = __builtin_ctzll(o);
+        if (board->pieces[square] != root_board->pieces[square]) {
+            return MCTS_NIL;
+        }
+    }
+
+    // our placement is the square with the piece we had in hand, the opponent's one holds the piece we handed over
+    uint64_t added = board->occupied & ~root_board->occupied;
+    if (__builtin_popcountll(added) != 2) {
+        return MCTS_NIL;
+    }
+    int ours = __builtin_ctzll(added);
+    int theirs = __builtin_ctzll(added & (added - 1));
+    if (board->pieces[ours] != mcts->root_hand_piece) {
+        int swap = ours;
+        ours = theirs;
+        theirs = swap;
+    }
+    if (board->pieces[ours] != mcts->root_hand_piece) {
+        return MCTS_NIL;
+    }
+
+    uint32_t previous;
+    uint32_t child = mcts_find_child(mcts, mcts->root, ours, board->pieces[theirs], &previous);
+    if (child == MCTS_NIL) {
+        return MCTS_NIL;
+    }
+    uint32_t successor = mcts_find_child(mcts, child, theirs, hand_piece, &previous);
+    if (successor == MCTS_NIL) {
+        return MCTS_NIL;
+    }
+    if (previous == MCTS_NIL) {
+        mcts->nodes[child].first_child = mcts->nodes[successor].next_sibling;
+    } else {
+        mcts->nodes[previous].next_sibling = mcts->nodes[successor].next_sibling;
+    }
+    mcts->nodes[successor].next_sibling = MCTS_NIL;
+    return successor;
+}
+
+bool mcts_set_root(struct Mcts *mcts, const struct Board *board, int hand_piece) {
+    bool reused = false;
+    if (mcts->root != MCTS_NIL) {
+        if (memcmp(mcts->root_board.pieces, board->pieces, sizeof(board->pieces)) == 0
+            && board->width == mcts->root_board.width && board->height == mcts->root_board.height
+            && hand_piece == mcts->root_hand_piece) {
+            reused = true; // asked again for the same position
+        } else {
+            uint32_t successor = mcts_detach_successor(mcts, board, hand_piece);
+            if (successor != MCTS_NIL) {
+                mcts_release(mcts, mcts->root);
+                mcts->root = successor;
+                reused = true;
+            }
+        }
+    }
+
+    if (!reused) {
+        mcts->used = 0;
+        mcts->free_top = MCTS_NIL;
+        mcts->root = mcts_alloc(mcts, -1, BOARD_NO_PIECE, MCTS_OPEN);
+    }
+    memcpy(&mcts->root_board, board, sizeof(struct Board));
+    mcts->root_hand_piece = hand_piece;
+    return reused;
+}
+
+int mcts_search(struct Mcts *mcts, search_progress progress, void *context, struct SearchResult *result) {
+    mcts->iterations = 0;
+    mcts->max_depth = 0;
+    result->square = -1;
+    result->piece = BOARD_NO_PIECE;
+    if (mcts->root == MCTS_NIL || board_free_squares(&mcts->root_board) == 0) {
+        return -1;
+    }
+
+    // without room for the root's children, start over with an empty pool
+    struct MctsNode *root = &mcts->nodes[mcts->root];
+    if (root->first_child == MCTS_NIL && !mcts_expand(mcts, mcts->root, &mcts->root_board, mcts->root_hand_piece)) {
+        mcts->used = 0;
+        mcts->free_top = MCTS_NIL;
+        mcts->root = mcts_alloc(mcts, -1, BOARD_NO_PIECE, MCTS_OPEN);
+        if (!mcts_expand(mcts, mcts->root, &mcts->root_board, mcts->root_hand_piece)) {
+            return -1;
+        }
+    }
+
+    // a winning move is the root's only child, nothing to simulate then
+    while (mcts->nodes[mcts->nodes[mcts->root].first_child].state != MCTS_WON && !mcts_should_stop(mcts)) {
+        mcts_iterate(mcts);
+        mcts->iterations++;
+        if (progress != NULL && mcts->iterations % MCTS_REPORT_INTERVAL == 0) {
+            mcts_best(mcts, result);
+            progress(context, result);
+        }
+    }
+    mcts_best(mcts, result);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#ifndef mcts_h
+#define mcts_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "search.h"
+
+// Monte Carlo tree search: UCT selection, expansion of all moves of a leaf at once and a playout with
+// random safe moves (pieces the opponent can't win with right away, if there are any).
+//
+// Nodes live in a fixed pool and are addressed by index; children of a node form a list linked by next_sibling.
+// The tree is kept between moves: mcts_set_root() finds the grandchild reached by our move and the opponent's
+// reply and promotes it to root, so the simulations below it are reused. Everything else is released in O(1)
+// by pushing the old root onto the free stack; its descendants are only pushed when the node that links them
+// is allocated again (lazy release).
+#define MCTS_POOL_BITS 20 // default pool size: 2^20 nodes of 32 bytes
+#define MCTS_NIL UINT32_MAX
+#define MCTS_EXPLORATION 1.4f
+#define MCTS_CHECK_INTERVAL 256 // iterations between checks of the stop flags and the deadline
+#define MCTS_REPORT_INTERVAL 16384 // iterations between progress reports
+#define MCTS_SCORE_SCALE 1000 // reported scores are the mean result of the best move mapped to -1000..1000
+
+#define MCTS_OPEN 0
+#define MCTS_WON 1 // the move into the node completes a line
+#define MCTS_DRAWN 2 // the move into the node fills the board
+
+struct MctsNode {
+    uint32_t first_child; // MCTS_NIL if not expanded
+    uint32_t next_sibling;
+    uint32_t next_free; // link of the free stack
+    uint32_t visits;
+    float results; // sum of results (1 won, 0.5 drawn, 0 lost) for the side that made the move into the node
+    int16_t square;
+    int16_t piece; // handed over, BOARD_NO_PIECE if none
+    uint8_t state; // MCTS_OPEN, MCTS_WON or MCTS_DRAWN
+    uint8_t reserved[3];
+};
+
+struct Mcts {
+    struct MctsNode *nodes;
+    uint32_t capacity;
+    uint32_t used; // nodes above are untouched
+    uint32_t free_top; // MCTS_NIL if the free stack is empty
+
+    // position of the root, to find the moves played since the last search
+    uint32_t root;
+    struct Board root_board;
+    int root_hand_piece;
+
+    atomic_bool stop; // set from another thread to abort the search
+    const atomic_bool *external_stop; // optional second stop flag
+    uint64_t deadline_ns; // CLOCK_MONOTONIC time to stop at, 0 for none
+    long iteration_budget; // 0 for none
+
+    uint64_t random;
+
+    // statistics of the last mcts_search()
+    long iterations;
+    int max_depth;
+};
+
+// Create a search with a pool of 2^pool_bits nodes. Must be freed with mcts_free().
+//
+// Returns NULL on error.
+struct Mcts *mcts_create(int pool_bits);
+
+void mcts_free(struct Mcts *mcts);
+
+// Make board with hand_piece the root. If it follows from the last root by two moves (or none),
+// the matching subtree is kept and the rest of the tree released; otherwise the tree starts empty.
+//
+// Returns true if a subtree was reused.
+bool mcts_set_root(struct Mcts *mcts, const struct Board *board, int hand_piece);
+
+// Run simulations from the root until a stop flag is set, the deadline or the iteration budget is reached,
+// or a winning move is found. progress (may be NULL) is called every MCTS_REPORT_INTERVAL iterations
+// with the best move so far.
+//
+// Returns 0 and the most visited move in result, -1 if the root has no move.
+int mcts_search(struct Mcts *mcts, search_progress progress, void *context, struct SearchResult *result);
+
+#endif
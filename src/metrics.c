@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#define METRICS_REQUEST_TIMEOUT_MS 100
+#define METRICS_STR(x) #x
+#define METRICS_XSTR(x) METRICS_STR(x)
+
+struct MetricsServer {
+    struct Metrics *metrics;
+    int sockfd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    atomic_bool stop;
+    pthread_t thread;
+};
+
+static void metrics_print(FILE *out, char *name, char *type, char *help, double value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n", name, help, name, type, name, value);
+}
+
+static unsigned long metrics_get(atomic_ulong *value) {
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+void metrics_write(struct Metrics *metrics, FILE *out) {
+    metrics_print(out, "quarto_games_played_total", "counter", "Games played to the end.", metrics_get(&metrics->games_played));
+    metrics_print(out, "quarto_games_won_total", "counter", "Games won.", metrics_get(&metrics->games_won));
+    metrics_print(out, "quarto_moves_total", "counter", "Moves sent to the server.", metrics_get(&metrics->moves));
+    metrics_print(out, "quarto_think_seconds_total", "counter", "Time from receiving MOVE to sending PLAY.", metrics_get(&metrics->think_time_us) / 1e6);
+    metrics_print(out, "quarto_move_timeout_seconds_total", "counter", "Move timeouts granted by the server.", metrics_get(&metrics->move_timeout_us) / 1e6);
+    metrics_print(out, "quarto_last_think_seconds", "gauge", "Time from receiving MOVE to sending PLAY of the last move.", metrics_get(&metrics->last_think_time_us) / 1e6);
+    metrics_print(out, "quarto_last_move_timeout_seconds", "gauge", "Move timeout of the last move.", metrics_get(&metrics->last_move_timeout_us) / 1e6);
+    metrics_print(out, "quarto_near_timeouts_total", "counter", "Moves that took more than " METRICS_XSTR(METRICS_NEAR_TIMEOUT_PERCENT) "% of the move timeout.", metrics_get(&metrics->near_timeouts));
+    metrics_print(out, "quarto_watchdog_moves_total", "counter", "Moves sent by the deadline watchdog without the final move of the thinker.", metrics_get(&metrics->watchdog_moves));
+    metrics_print(out, "quarto_search_seconds_total", "counter", "Time the thinker spent searching.", metrics_get(&metrics->search_time_us) / 1e6);
+    metrics_print(out, "quarto_nodes_total", "counter", "Nodes searched by the thinker.", metrics_get(&metrics->nodes));
+    metrics_print(out, "quarto_nodes_per_second", "gauge", "Search speed of the last move.", metrics_get(&metrics->last_nodes_per_second));
+    metrics_print(out, "quarto_reconnects_total", "counter", "Attempts to resume the game after a lost connection.", metrics_get(&metrics->reconnects));
+    metrics_print(out, "quarto_ipc_errors_total", "counter", "Failed doorbell waits and rejected shared memory writes.", metrics_get(&metrics->ipc_errors));
+    metrics_print(out, "quarto_received_bytes_total", "counter", "Bytes received from the game server.", metrics_get(&metrics->bytes_received));
+    metrics_print(out, "quarto_sent_bytes_total", "counter", "Bytes sent to the game server.", metrics_get(&metrics->bytes_sent));
+}
+
+void metrics_record_move(struct Metrics *metrics, unsigned long think_time_us, int move_timeout_ms) {
+    unsigned long move_timeout_us = (unsigned long)move_timeout_ms * 1000;
+
+    metrics_add(metrics->moves, 1);
+    metrics_add(metrics->think_time_us, think_time_us);
+    metrics_add(metrics->move_timeout_us, move_timeout_us);
+    metrics_set(metrics->last_think_time_us, think_time_us);
+    metrics_set(metrics->last_move_timeout_us, move_timeout_us);
+    if (think_time_us * 100 > move_timeout_us * METRICS_NEAR_TIMEOUT_PERCENT) {
+        metrics_add(metrics->near_timeouts, 1);
+    }
+}
+
+// Answer one connection. Waits briefly for a request to tell HTTP clients apart from plain readers.
+static void metrics_serve(struct MetricsServer *server, int fd) {
+    char request[256];
+    int request_length = 0;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, METRICS_REQUEST_TIMEOUT_MS) == 1) {
+        request_length = recv(fd, request, sizeof(request), MSG_DONTWAIT);
+    }
+    bool http = request_length >= 4 && memcmp(request, "GET ", 4) == 0;
+
+    char *body = NULL;
+    size_t body_length = 0;
+    FILE *out = open_memstream(&body, &body_length);
+    if (out == NULL) {
+        perror("open_memstream failed");
+        return;
+    }
+    metrics_write(server->metrics, out);
+    fclose(out);
+
+    if (http) {
+        char header[128];
+        int header_length = snprintf(header, sizeof(header),
+                                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_length);
+        send(fd, header, header_length, MSG_NOSIGNAL);
+    }
+    send(fd, body, body_length, MSG_NOSIGNAL);
+    free(body);
+}
+
+static void *metrics_server_main(void *arg) {
+    struct MetricsServer *server = arg;
+
+    while (!atomic_load(&server->stop)) {
+        struct pollfd pfd = {.fd = server->sockfd, .events = POLLIN};
+        if (poll(&pfd, 1, METRICS_POLL_MS) != 1) {
+            continue;
+        }
+
+        int fd = accept(server->sockfd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        metrics_serve(server, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+struct MetricsServer *metrics_server_start(struct Metrics *metrics, char *path) {
+    struct MetricsServer *server = malloc(sizeof(struct MetricsServer));
+    if (server == NULL) {
+        perror("metrics server malloc failed");
+        return NULL;
+    }
+    server->metrics = metrics;
+    atomic_init(&server->stop, false);
+
+    if (strlen(path) >= sizeof(server->path)) {
+        printf("Metrics socket path too long: %s\n", path);
+        goto error;
+    }
+    strcpy(server->path, path);
+
+    server->sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->sockfd < 0) {
+        perror("metrics socket creation failed");
+        goto error;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    // a stale socket of an earlier run is replaced, anything else at path is left alone (and bind() fails)
+    struct stat path_stat;
+    if (lstat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+        unlink(path);
+    }
+    if (bind(server->sockfd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server->sockfd, 8) != 0) {
+        perror("metrics socket bind failed");
+        close(server->sockfd);
+        goto error;
+    }
+
+    int err = pthread_create(&server->thread, NULL, metrics_server_main, server);
+    if (err != 0) {
+        printf("Error creating metrics thread: %s\n", strerror(err));
+        close(server->sockfd);
+        unlink(path);
+        goto error;
+    }
+
+    log_info("Serving metrics on %s", path);
+    return server;
+
+    error:
+    free(server);
+    return NULL;
+}
+
+void metrics_server_stop(struct MetricsServer *server) {
+    atomic_store(&server->stop, true);
+    pthread_join(server->thread, NULL);
+    close(server->sockfd);
+    unlink(server->path);
+    free(server);
+}
@@ -0,0 +1,62 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+// A move counts as narrowly avoided timeout if it took longer than this share of move_timeout.
+#define METRICS_NEAR_TIMEOUT_PERCENT 80
+#define METRICS_POLL_MS 200
+
+// Counters and gauges of one client. They live in the shm arena, so connector and thinker
+// both update them with relaxed atomics and the metrics server just reads them.
+struct Metrics {
+    atomic_ulong games_played;
+    atomic_ulong games_won;
+    atomic_ulong moves;
+
+    // connector: time from "+ MOVE" to sending PLAY, and the move_timeout granted by the server
+    atomic_ulong think_time_us;
+    atomic_ulong move_timeout_us;
+    atomic_ulong last_think_time_us;
+    atomic_ulong last_move_timeout_us;
+    atomic_ulong near_timeouts;
+    atomic_ulong watchdog_moves; // sent by the deadline watchdog instead of the thinker's final move
+
+    // thinker
+    atomic_ulong search_time_us;
+    atomic_ulong nodes;
+    atomic_ulong last_nodes_per_second;
+
+    atomic_ulong reconnects; // attempts to resume the game after a lost connection
+    atomic_ulong ipc_errors;
+    atomic_ulong bytes_received;
+    atomic_ulong bytes_sent;
+};
+
+#define metrics_add(counter, value) atomic_fetch_add_explicit(&(counter), (value), memory_order_relaxed)
+#define metrics_set(gauge, value) atomic_store_explicit(&(gauge), (value), memory_order_relaxed)
+
+// Serves the metrics of one client on a Unix socket.
+struct MetricsServer;
+
+// Write all metrics in Prometheus text format.
+void metrics_write(struct Metrics *metrics, FILE *out);
+
+// Record the connector's time for one move (including the NEAR_TIMEOUT check).
+//
+// think_time_us: time from receiving "+ MOVE" to sending PLAY
+// move_timeout_ms: timeout granted by the server
+void metrics_record_move(struct Metrics *metrics, unsigned long think_time_us, int move_timeout_ms);
+
+// Listen on the Unix socket at path (replacing a stale socket file) and answer every connection
+// with the current metrics, from a background thread. Plain HTTP GET requests (as sent by
+// curl --unix-socket or a scrape proxy) get an HTTP response, anything else just the text.
+//
+// Returns the server or NULL on error.
+struct MetricsServer *metrics_server_start(struct Metrics *metrics, char *path);
+
+// Stop the server thread and remove the socket file.
+void metrics_server_stop(struct MetricsServer *server);
+
+#endif
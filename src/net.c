@@ -8,7 +8,18 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "net.h"
+#include "quarto.h"
+
+// Formatters for the logged protocol lines, see log_binary()
+static void net_format_received(FILE *out, const void *data, int length) {
+    fprintf(out, "S: %.*s\n", length, (const char *)data);
+}
+
+static void net_format_sent(FILE *out, const void *data, int length) {
+    fprintf(out, "C: %.*s\n", length, (const char *)data);
+}
 
 struct Net *net_create() {
     struct Net *net = malloc(sizeof(struct Net));
@@ -20,7 +31,12 @@ struct Net *net_create() {
     net->sockfd = 0;
     net->buffer[0] = '\0';
     net->n_leftover = 0;
+    net->buffer_ns = 0;
     net->message[0] = '\0';
+    net->message_ns = 0;
+    net->trace = NULL;
+    net->metrics = NULL;
+    net->disconnected = false;
     return net;
 }
 
@@ -30,20 +46,30 @@ void net_free(struct Net *net) {
         net->sockfd = 0;
     }
 
+    if (net->trace != NULL) {
+        trace_close(net->trace);
+        net->trace = NULL;
+    }
+
     free(net);
 }
 
+int net_start_trace(struct Net *net, char *path) {
+    net->trace = trace_create(path);
+    return net->trace != NULL ? 0 : -1;
+}
+
 int net_connect(struct Net *net, char *hostname, int port) {
     struct hostent *host = gethostbyname(hostname);
     if (host == NULL) {
-        printf("Host not found: %s\n", hostname);
+        log_error("Host not found: %s", hostname);
         return -1;
     }
 
-    printf("Host name: %s\n", host->h_name);
+    log_info("Host name: %s", host->h_name);
 
     if (host->h_addr_list[0] == NULL) {
-        printf("No address found!\n");
+        log_error("No address found!");
         return -1;
     }
     struct in_addr address = *(struct in_addr*)(host->h_addr_list[0]);
@@ -55,8 +81,13 @@ int net_connect(struct Net *net, char *hostname, int port) {
     socket_address.sin_addr = address;
 
     net->sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (net->sockfd == -1) {
+        perror("Error creating socket");
+        net->sockfd = 0;
+        return -1;
+    }
 
-    printf("Trying to connect to IP %s at port %d ...\n", inet_ntoa(address), port);
+    log_info("Trying to connect to IP %s at port %d ...", inet_ntoa(address), port);
     if (connect(net->sockfd, (struct sockaddr*) &socket_address, sizeof(struct sockaddr)) == -1) {
         // fun fact:
         // sizeof(address) == 4 und sizeof(struct sockaddr) == 16,
@@ -66,10 +97,22 @@ int net_connect(struct Net *net, char *hostname, int port) {
         return -1;
     }
 
-    printf("Successfully connected to server.\n");
+    log_info("Successfully connected to server.");
+    net->disconnected = false;
     return 0;
 }
 
+int net_reconnect(struct Net *net, char *hostname, int port) {
+    if (net->sockfd != 0) {
+        close(net->sockfd);
+        net->sockfd = 0;
+    }
+    net->buffer[0] = '\0';
+    net->n_leftover = 0;
+    net->message[0] = '\0';
+    return net_connect(net, hostname, port);
+}
+
 int net_recvline(struct Net *net) {
     int message_length = 0;
 
@@ -88,7 +131,8 @@ int net_recvline(struct Net *net) {
             net->n_leftover = net->n_leftover - (i+1);
 
             net->message[i] = '\0';
-            printf("S: %s\n", net->message);
+            net->message_ns = net->buffer_ns;
+            log_binary(LOG_LEVEL_INFO, net_format_received, net->message, i);
             return message_length;
         }
     }
@@ -96,20 +140,30 @@ int net_recvline(struct Net *net) {
     // do as many recvs until we found a newline or an error occured
     while(true) {
         int n = recv(net->sockfd, net->buffer, NET_BUFFER_SIZE-1, 0); // We read size-1 bytes to keep enough space for null character
+        net->buffer_ns = quarto_now_ns(); // right after the wakeup, before any processing of the data
 
         if (n == -1) {
             perror("Error");
+            net->disconnected = true;
             return -1;
         }
         
         if (n == 0) {
-            printf("Error: Connection is closed.\n");
+            log_error("Connection is closed.");
+            net->disconnected = true;
             return -1;
         }
 
+        if (net->metrics != NULL) {
+            metrics_add(net->metrics->bytes_received, n);
+        }
+        if (net->trace != NULL) {
+            trace_write(net->trace, TRACE_RECEIVED, net->buffer, n);
+        }
+
         for (int i = 0; i < n; i++) {
             if (message_length + 1 > NET_BUFFER_SIZE) {
-                printf("Error: Message exceeds buffer size. buffer='%s', message='%s', n=%d\n", net->message, net->buffer, n);
+                log_error("Message exceeds buffer size. buffer='%s', message='%s', n=%d", net->message, net->buffer, n);
                 return -1;
             }
 
@@ -125,7 +179,8 @@ int net_recvline(struct Net *net) {
                 net->n_leftover = n - (i+1);
 
                 net->message[message_length-1] = '\0';
-                printf("S: %s\n", net->message);
+                net->message_ns = net->buffer_ns;
+                log_binary(LOG_LEVEL_INFO, net_format_received, net->message, message_length-1);
                 return message_length;
             }
         }
@@ -146,17 +201,31 @@ bool net_has_data(struct Net *net) {
 }
 
 int net_sendline(struct Net *net, char *msg, int n) {
-    printf("C: %s\n", msg);
+    log_binary(LOG_LEVEL_INFO, net_format_sent, msg, n);
 
-    if (send(net->sockfd, msg, n, 0) != n) {
-        perror("Error sending message");
+    // send message and newline at once: two small sends make Nagle's algorithm hold back the newline
+    // until the server acknowledges the message, which costs a delayed ACK (~40ms) per line
+    char line[NET_BUFFER_SIZE + 1];
+    if (n >= NET_BUFFER_SIZE) {
+        log_error("Message exceeds buffer size: '%s'", msg);
         return -1;
     }
+    memcpy(line, msg, n);
+    line[n] = '\n';
 
-    if (send(net->sockfd, "\n", 1, 0) != 1) {
-        perror("Error sending message's terminating newline character");
+    // MSG_NOSIGNAL: a connection reset by the server is an error to handle, not a SIGPIPE that kills us
+    if (send(net->sockfd, line, n + 1, MSG_NOSIGNAL) != n + 1) {
+        perror("Error sending message");
+        net->disconnected = true;
         return -1;
     }
 
+    if (net->metrics != NULL) {
+        metrics_add(net->metrics->bytes_sent, n + 1);
+    }
+    if (net->trace != NULL) {
+        trace_write(net->trace, TRACE_SENT, line, n + 1);
+    }
+
     return 0;
 }
@@ -2,6 +2,10 @@
 #define net_h
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "metrics.h"
+#include "trace.h"
 
 #define NET_BUFFER_SIZE 256
 
@@ -9,7 +13,12 @@ struct Net {
     int sockfd;
     char buffer[NET_BUFFER_SIZE];
     int n_leftover;
+    uint64_t buffer_ns; // CLOCK_MONOTONIC time at which the data in buffer arrived, i.e. recv() returned
     char message[NET_BUFFER_SIZE];
+    uint64_t message_ns; // CLOCK_MONOTONIC time at which the last bytes of message arrived
+    struct Trace *trace; // records all received and sent bytes if non-null
+    struct Metrics *metrics; // counts received and sent bytes if non-null
+    bool disconnected; // set when the connection failed or was closed by the server (as opposed to protocol errors)
 };
 
 struct Net *net_create();
@@ -17,11 +26,21 @@ struct Net *net_create();
 // Cleanup of net's fields and free net.
 void net_free(struct Net *net);
 
+// Record all bytes received and sent from now on into a trace file (see trace.h), closed by net_free().
+//
+// Returns 0 on success, -1 otherwise
+int net_start_trace(struct Net *net, char *path);
+
 // Create socket and connect to given hostname and port.
 //
 // Returns 0 on success, -1 otherwise
 int net_connect(struct Net *net, char *hostname, int port);
 
+// Close the current connection, drop unread data and connect again (trace and metrics are kept).
+//
+// Returns 0 on success, -1 otherwise
+int net_reconnect(struct Net *net, char *hostname, int port);
+
 // Receive a newline-terminated message from server.
 // Message is written to net->message.
 //
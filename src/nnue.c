@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86
+#endif
+
+#include "nnue.h"
+
+#define NNUE_ALIGNMENT 64
+
+static int nnue_board_feature(int square, int attribute, int piece) {
+    return (square * BOARD_MAX_ATTRIBUTES + attribute) * 2 + ((piece >> attribute) & 1);
+}
+
+static int nnue_hand_feature(int attribute, int piece) {
+    return NNUE_BOARD_INPUTS + attribute * 2 + ((piece >> attribute) & 1);
+}
+
+static int nnue_finish(const struct Nnue *nnue, int32_t sum) {
+    int score = (sum + nnue->output_bias) >> nnue->output_shift;
+    if (score > NNUE_MAX_SCORE) {
+        return NNUE_MAX_SCORE;
+    }
+    return score < -NNUE_MAX_SCORE ? -NNUE_MAX_SCORE : score;
+}
+
+static void nnue_add_features_scalar(const struct Nnue *nnue, const struct NnueAccumulator *from,
+                                     struct NnueAccumulator *to, const int *added, int added_count,
+                                     const int *removed, int removed_count) {
+    int16_t values[NNUE_HIDDEN];
+    memcpy(values, from->values, sizeof(values));
+    for (int f = 0; f < added_count; f++) {
+        const int16_t *row = &nnue->feature_weights[added[f] * NNUE_HIDDEN];
+        for (int i = 0; i < NNUE_HIDDEN; i++) {
+            values[i] += row[i];
+        }
+    }
+    for (int f = 0; f < removed_count; f++) {
+        const int16_t *row = &nnue->feature_weights[removed[f] * NNUE_HIDDEN];
+        for (int i = 0; i < NNUE_HIDDEN; i++) {
+            values[i] -= row[i];
+        }
+    }
+    memcpy(to->values, values, sizeof(values));
+}
+
+static int nnue_output_scalar(const struct Nnue *nnue, const struct NnueAccumulator *accumulator) {
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        int value = accumulator->values[i];
+        value = value < 0 ? 0 : (value > NNUE_CLIP ? NNUE_CLIP : value);
+        sum += value * nnue->output_weights[i];
+    }
+    return nnue_finish(nnue, sum);
+}
+
+#ifdef NNUE_X86
+// The accumulator (NNUE_HIDDEN = 32 int16) is two AVX2 registers, kept in registers for the whole update.
+__attribute__((target("avx2")))
+static void nnue_add_features_avx2(const struct Nnue *nnue, const struct NnueAccumulator *from,
+                                   struct NnueAccumulator *to, const int *added, int added_count,
+                                   const int *removed, int removed_count) {
+    __m256i low = _mm256_loadu_si256((const __m256i *)&from->values[0]);
+    __m256i high = _mm256_loadu_si256((const __m256i *)&from->values[16]);
+    for (int f = 0; f < added_count; f++) {
+        const int16_t *row = &nnue->feature_weights[added[f] * NNUE_HIDDEN];
+        low = _mm256_add_epi16(low, _mm256_load_si256((const __m256i *)&row[0]));
+        high = _mm256_add_epi16(high, _mm256_load_si256((const __m256i *)&row[16]));
+    }
+    for (int f = 0; f < removed_count; f++) {
+        const int16_t *row = &nnue->feature_weights[removed[f] * NNUE_HIDDEN];
+        low = _mm256_sub_epi16(low, _mm256_load_si256((const __m256i *)&row[0]));
+        high = _mm256_sub_epi16(high, _mm256_load_si256((const __m256i *)&row[16]));
+    }
+    _mm256_storeu_si256((__m256i *)&to->values[0], low);
+    _mm256_storeu_si256((__m256i *)&to->values[16], high);
+}
+
+__attribute__((target("avx2")))
+static int nnue_output_avx2(const struct Nnue *nnue, const struct NnueAccumulator *accumulator) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i clip = _mm256_set1_epi16(NNUE_CLIP);
+    __m256i low = _mm256_loadu_si256((const __m256i *)&accumulator->values[0]);
+    __m256i high = _mm256_loadu_si256((const __m256i *)&accumulator->values[16]);
+    low = _mm256_min_epi16(_mm256_max_epi16(low, zero), clip);
+    high = _mm256_min_epi16(_mm256_max_epi16(high, zero), clip);
+
+    __m256i weights_low = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *)&nnue->output_weights[0]));
+    __m256i weights_high = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *)&nnue->output_weights[16]));
+    __m256i products = _mm256_add_epi32(_mm256_madd_epi16(low, weights_low), _mm256_madd_epi16(high, weights_high));
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(products), _mm256_extracti128_si256(products, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return nnue_finish(nnue, _mm_cvtsi128_si32(sum));
+}
+#endif
+
+struct Nnue *nnue_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Error opening network file");
+        return NULL;
+    }
+
+    struct NnueHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, NNUE_MAGIC, sizeof(header.magic)) != 0
+        || header.hidden != NNUE_HIDDEN || header.field_width < 1 || header.field_width > BOARD_MAX_SIZE
+        || header.field_height < 1 || header.field_height > BOARD_MAX_SIZE
+        || header.output_shift < 0 || header.output_shift > 30) {
+        printf("Network file %s is no valid network\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    struct Nnue *nnue = malloc(sizeof(struct Nnue));
+    if (nnue == NULL) {
+        perror("nnue malloc failed");
+        fclose(file);
+        return NULL;
+    }
+
+    // one block, every part aligned for the vector loads
+    size_t feature_size = NNUE_INPUTS * NNUE_HIDDEN * sizeof(int16_t);
+    size_t bias_size = NNUE_HIDDEN * sizeof(int16_t);
+    size_t output_size = NNUE_HIDDEN * sizeof(int8_t);
+    void *weights;
+    if (posix_memalign(&weights, NNUE_ALIGNMENT, feature_size + bias_size + NNUE_ALIGNMENT) != 0) {
+        printf("Failed allocating network weights\n");
+        free(nnue);
+        fclose(file);
+        return NULL;
+    }
+    nnue->feature_weights = weights;
+    nnue->hidden_bias = (int16_t *)((char *)weights + feature_size);
+    nnue->output_weights = (int8_t *)((char *)weights + feature_size + bias_size);
+
+    if (fread(nnue->feature_weights, feature_size, 1, file) != 1
+        || fread(nnue->hidden_bias, bias_size, 1, file) != 1
+        || fread(nnue->output_weights, output_size, 1, file) != 1
+        || fgetc(file) != EOF) {
+        printf("Network file %s has the wrong size\n", path);
+        free(weights);
+        free(nnue);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    nnue->field_width = header.field_width;
+    nnue->field_height = header.field_height;
+    nnue->output_bias = header.output_bias;
+    nnue->output_shift = header.output_shift;
+    nnue->add_features = nnue_add_features_scalar;
+    nnue->output = nnue_output_scalar;
+#ifdef NNUE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        nnue->add_features = nnue_add_features_avx2;
+        nnue->output = nnue_output_avx2;
+    }
+#endif
+    return nnue;
+}
+
+void nnue_free(struct Nnue *nnue) {
+    free(nnue->feature_weights);
+    free(nnue);
+}
+
+void nnue_refresh(const struct Nnue *nnue, const struct Board *board, int hand_piece,
+                  struct NnueAccumulator *accumulator) {
+    int features[BOARD_MAX_ATTRIBUTES];
+    memcpy(accumulator->values, nnue->hidden_bias, sizeof(accumulator->values));
+
+    for (uint64_t occupied = board->occupied; occupied != 0; occupied &= occupied - 1) {
+        int square = __builtin_ctzll(occupied);
+        for (int a = 0; a < board->attributes; a++) {
+            features[a] = nnue_board_feature(square, a, board->pieces[square]);
+        }
+        nnue->add_features(nnue, accumulator, accumulator, features, board->attributes, NULL, 0);
+    }
+    if (hand_piece != BOARD_NO_PIECE) {
+        for (int a = 0; a < board->attributes; a++) {
+            features[a] = nnue_hand_feature(a, hand_piece);
+        }
+        nnue->add_features(nnue, accumulator, accumulator, features, board->attributes, NULL, 0);
+    }
+}
+
+void nnue_update(const struct Nnue *nnue, const struct Board *board, const struct NnueAccumulator *from,
+                 struct NnueAccumulator *to, int square, int hand_piece, int give_piece) {
+    int added[2 * BOARD_MAX_ATTRIBUTES];
+    int removed[BOARD_MAX_ATTRIBUTES];
+    int added_count = 0;
+    for (int a = 0; a < board->attributes; a++) {
+        added[added_count++] = nnue_board_feature(square, a, hand_piece);
+        removed[a] = nnue_hand_feature(a, hand_piece);
+        if (give_piece != BOARD_NO_PIECE) {
+            added[added_count++] = nnue_hand_feature(a, give_piece);
+        }
+    }
+    nnue->add_features(nnue, from, to, added, added_count, removed, board->attributes);
+}
+
+int nnue_evaluate(const struct Nnue *nnue, const struct NnueAccumulator *accumulator) {
+    return nnue->output(nnue, accumulator);
+}
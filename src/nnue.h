@@ -0,0 +1,71 @@
+#ifndef nnue_h
+#define nnue_h
+
+#include <stdint.h>
+
+#include "board.h"
+
+// Small quantized network that evaluates a position from the view of the side to move.
+//
+// Inputs are one-hot features: for every occupied square and attribute, whether the piece there has the
+// attribute bit set or not, and the same for the piece in hand. The first layer sums the int16 weight columns
+// of the active features into an accumulator, which is updated incrementally when a piece is placed and
+// another one handed over. The output is the clipped accumulator (0..NNUE_CLIP) dotted with int8 weights.
+//
+// File format: a NnueHeader followed by int16 feature_weights[NNUE_INPUTS][NNUE_HIDDEN],
+// int16 hidden_bias[NNUE_HIDDEN] and int8 output_weights[NNUE_HIDDEN], all little endian.
+#define NNUE_MAGIC "QNNUE2\n"
+#define NNUE_HIDDEN 32
+#define NNUE_BOARD_INPUTS (BOARD_MAX_SQUARES * BOARD_MAX_ATTRIBUTES * 2)
+#define NNUE_INPUTS (NNUE_BOARD_INPUTS + BOARD_MAX_ATTRIBUTES * 2)
+#define NNUE_CLIP 127
+#define NNUE_MAX_SCORE 8000 // evaluations stay clear of the proven win scores of the search
+
+struct NnueHeader {
+    char magic[8];
+    uint16_t field_width;
+    uint16_t field_height;
+    uint32_t hidden;
+    int32_t output_bias;
+    int32_t output_shift; // the output sum is shifted right by this to get a score
+};
+
+struct NnueAccumulator {
+    int16_t values[NNUE_HIDDEN];
+};
+
+struct Nnue {
+    int field_width;
+    int field_height;
+    int32_t output_bias;
+    int32_t output_shift;
+    int16_t *feature_weights; // NNUE_INPUTS rows of NNUE_HIDDEN
+    int16_t *hidden_bias;
+    int8_t *output_weights;
+
+    // AVX2 kernels if the CPU supports them, scalar ones otherwise
+    void (*add_features)(const struct Nnue *nnue, const struct NnueAccumulator *from, struct NnueAccumulator *to,
+                         const int *added, int added_count, const int *removed, int removed_count);
+    int (*output)(const struct Nnue *nnue, const struct NnueAccumulator *accumulator);
+};
+
+// Load the network at path. Must be freed with nnue_free().
+//
+// Returns NULL on error.
+struct Nnue *nnue_load(const char *path);
+
+void nnue_free(struct Nnue *nnue);
+
+// Compute the accumulator of board with hand_piece from scratch.
+void nnue_refresh(const struct Nnue *nnue, const struct Board *board, int hand_piece,
+                  struct NnueAccumulator *accumulator);
+
+// Derive the accumulator after placing hand_piece on square and handing over give_piece
+// from the accumulator before (from and to may be the same).
+void nnue_update(const struct Nnue *nnue, const struct Board *board, const struct NnueAccumulator *from,
+                 struct NnueAccumulator *to, int square, int hand_piece, int give_piece);
+
+// Returns the score of the position from the view of the side to move, within +-NNUE_MAX_SCORE.
+int nnue_evaluate(const struct Nnue *nnue, const struct NnueAccumulator *accumulator);
+
+#endif
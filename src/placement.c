@@ -0,0 +1,146 @@
+#define _GNU_SOURCE //for cpu_set_t and getcpu (must be at beginning of file)
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "placement.h"
+
+void placement_init(struct Placement *placement) {
+    placement->pin_cpus = false;
+    CPU_ZERO(&placement->cpus);
+    placement->policy = SCHED_OTHER;
+    placement->priority = 0;
+    placement->nice = 0;
+    placement->numa_local = false;
+}
+
+int placement_parse_cpus(char *list, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+
+    char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+int placement_parse_policy(char *name, int *policy) {
+    if (strcasecmp(name, "other") == 0) {
+        *policy = SCHED_OTHER;
+    } else if (strcasecmp(name, "fifo") == 0) {
+        *policy = SCHED_FIFO;
+    } else if (strcasecmp(name, "rr") == 0) {
+        *policy = SCHED_RR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Prefer allocations on the NUMA node we're currently running on (i.e. the node of the pinned CPUs).
+static int placement_bind_memory_local() {
+    unsigned int cpu;
+    unsigned int node;
+    if (getcpu(&cpu, &node) != 0) {
+        log_warn("getcpu failed: %s", strerror(errno));
+        return -1;
+    }
+
+    unsigned long nodemask[(node / (8 * sizeof(unsigned long))) + 1];
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, node + 1) != 0) {
+        log_warn("set_mempolicy failed: %s", strerror(errno));
+        return -1;
+    }
+
+    log_info("Preferring memory of NUMA node %u (running on CPU %u)", node, cpu);
+    return 0;
+}
+
+// CPUs the process was started with (e.g. restricted by taskset), saved before the first placement changes them.
+static cpu_set_t placement_startup_cpus;
+static pthread_once_t placement_startup_once = PTHREAD_ONCE_INIT;
+
+static void placement_save_startup_cpus() {
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &placement_startup_cpus) != 0) {
+        log_warn("Could not read the CPU affinity: %s", strerror(errno));
+        CPU_ZERO(&placement_startup_cpus);
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &placement_startup_cpus);
+        }
+    }
+}
+
+int placement_apply(struct Placement *placement, char *role) {
+    int ret = 0;
+    pthread_once(&placement_startup_once, placement_save_startup_cpus);
+
+    // every setting is applied, also the defaults, so that a reloaded config can undo an earlier placement
+    // pid 0 means the calling thread
+    cpu_set_t *cpus = placement->pin_cpus ? &placement->cpus : &placement_startup_cpus;
+    if (sched_setaffinity(0, sizeof(cpu_set_t), cpus) != 0) {
+        log_warn("Failed pinning %s to %d CPUs: %s", role, CPU_COUNT(cpus), strerror(errno));
+        ret = -1;
+    } else if (placement->pin_cpus) {
+        log_info("Pinned %s to %d CPUs", role, CPU_COUNT(cpus));
+    }
+
+    struct sched_param param;
+    param.sched_priority = placement->policy != SCHED_OTHER ? placement->priority : 0;
+    int err = pthread_setschedparam(pthread_self(), placement->policy, &param);
+    if (err != 0) {
+        log_warn("Failed setting scheduling policy of %s: %s", role, strerror(err));
+        ret = -1;
+    }
+    // the nice value is a per-thread attribute on Linux; raising the priority again may need CAP_SYS_NICE
+    if (placement->policy == SCHED_OTHER && setpriority(PRIO_PROCESS, syscall(SYS_gettid), placement->nice) != 0) {
+        log_warn("Failed setting nice value of %s: %s", role, strerror(errno));
+        ret = -1;
+    }
+
+    if (placement->numa_local) {
+        if (placement_bind_memory_local() != 0) {
+            ret = -1;
+        }
+    } else if (syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) != 0) {
+        log_warn("Failed resetting memory policy of %s: %s", role, strerror(errno));
+        ret = -1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,41 @@
+#ifndef placement_h
+#define placement_h
+
+#include <sched.h>
+#include <stdbool.h>
+
+// Where and how a process (or thread) runs: CPU pinning, scheduling policy and memory policy.
+struct Placement {
+    bool pin_cpus;
+    cpu_set_t cpus;
+
+    int policy;    // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int priority;  // static priority for SCHED_FIFO and SCHED_RR
+    int nice;      // nice value for SCHED_OTHER
+    bool numa_local; // prefer memory on the NUMA node of the (pinned) CPU
+};
+
+// Initialize placement with the defaults: the CPUs the process was started with, SCHED_OTHER, nice 0
+// and the default memory policy.
+void placement_init(struct Placement *placement);
+
+// Parse a CPU list like "0,2-3" into cpus.
+//
+// Returns 0 on success, -1 on a malformed list.
+int placement_parse_cpus(char *list, cpu_set_t *cpus);
+
+// Parse a scheduling policy name ("other", "fifo" or "rr") into policy.
+//
+// Returns 0 on success, -1 on an unknown name.
+int placement_parse_policy(char *name, int *policy);
+
+// Apply placement to the calling thread. Threads created afterwards inherit it,
+// so applying it at the start of a process (or thinker thread) also covers its search threads.
+// All settings are applied, including the defaults, so a reload can also undo an earlier placement.
+//
+// role: Name used in log messages, e.g. "connector"
+//
+// Returns 0 on success, -1 if any setting could not be applied (the other settings are still applied).
+int placement_apply(struct Placement *placement, char *role);
+
+#endif
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pns.h"
+#include "quarto.h"
+
+// distinguishes AND from OR nodes of the same position in the table
+#define PNS_AND_KEY 0x6a09e667f3bcc909ULL
+
+struct Pns *pns_create(int table_bits) {
+    struct Pns *pns = calloc(1, sizeof(struct Pns));
+    if (pns == NULL) {
+        perror("pns calloc failed");
+        return NULL;
+    }
+
+    pns->table = calloc(1ULL << table_bits, sizeof(struct PnsEntry));
+    if (pns->table == NULL) {
+        perror("proof-number table calloc failed");
+        free(pns);
+        return NULL;
+    }
+    pns->table_mask = (1ULL << table_bits) - 1;
+    pns->node_budget = PNS_NODE_BUDGET;
+    pns->moves = NULL;
+    pns->moves_capacity = 0;
+    atomic_init(&pns->stop, false);
+    return pns;
+}
+
+void pns_free(struct Pns *pns) {
+    free(pns->moves);
+    free(pns->table);
+    free(pns);
+}
+
+bool pns_is_sharp(const struct Board *board) {
+    int sharp_lines = 0;
+    for (int l = 0; l < board->line_count; l++) {
+        if (__builtin_popcountll(board->occupied & board->lines[l]) == __builtin_popcountll(board->lines[l]) - 1) {
+            sharp_lines++;
+        }
+    }
+    return sharp_lines >= PNS_SHARP_LINES;
+}
+
+static bool pns_should_abort(struct Pns *pns) {
+    if (!pns->aborted && pns->nodes % SEARCH_CHECK_INTERVAL == 0) {
+        if (pns->nodes >= pns->node_budget
+            || atomic_load_explicit(&pns->stop, memory_order_relaxed)
+            || (pns->deadline_ns != 0 && quarto_now_ns() >= pns->deadline_ns)) {
+            pns->aborted = true;
+        }
+    }
+    return pns->aborted;
+}
+
+static uint32_t pns_add(uint32_t a, uint32_t b) {
+    uint64_t sum = (uint64_t)a + b;
+    return sum < PNS_INFINITY ? (uint32_t)sum : PNS_INFINITY;
+}
+
+static uint64_t pns_key(const struct Board *board, int hand_piece, bool or_node) {
+    return board->key ^ board_hand_key(hand_piece) ^ (or_node ? 0 : PNS_AND_KEY);
+}
+
+static void pns_lookup(const struct Pns *pns, uint64_t key, uint32_t *proof, uint32_t *disproof) {
+    const struct PnsEntry *entry = &pns->table[key & pns->table_mask];
+    if (entry->key == key) {
+        *proof = entry->proof;
+        *disproof = entry->disproof;
+    } else {
+        *proof = 1;
+        *disproof = 1;
+    }
+}
+
+static void pns_store(struct Pns *pns, uint64_t key, uint32_t proof, uint32_t disproof) {
+    struct PnsEntry *entry = &pns->table[key & pns->table_mask];
+    bool solved = proof == 0 || disproof == 0;
+    bool entry_solved = entry->proof == 0 || entry->disproof == 0;
+    if (entry->key == key || solved || !entry_solved) {
+        entry->key = key;
+        entry->proof = proof;
+        entry->disproof = disproof;
+    }
+}
+
+// Write the safe moves of the node into moves, with proof and disproof numbers from the table.
+//
+// Returns the number of moves.
+static int pns_generate(struct Pns *pns, struct Board *board, int hand_piece, bool or_node, struct PnsMove *moves) {
+    int count = 0;
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        int ones;
+        int zeros;
+        board_place(board, square, hand_piece);
+        board_threats(board, &ones, &zeros);
+        board_remove(board, square);
+
+        uint64_t placed_key = board->key ^ board_square_key(square, hand_piece) ^ (or_node ? PNS_AND_KEY : 0);
+        for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+            for (uint64_t p = board->pieces_left[w]; p != 0; p &= p - 1) {
+                int piece = w * 64 + __builtin_ctzll(p);
+                if (!board_piece_safe(board, piece, ones, zeros)) {
+                    continue;
+                }
+                moves[count].square = square;
+                moves[count].piece = piece;
+                pns_lookup(pns, placed_key ^ board_hand_key(piece), &moves[count].proof, &moves[count].disproof);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// Expand the node until its proof number reaches proof_threshold or its disproof number disproof_threshold.
+// At the root (best_square not NULL), a proven node also yields the winning move.
+static void pns_node(struct Pns *pns, struct Board *board, int hand_piece, bool or_node,
+                     uint32_t proof_threshold, uint32_t disproof_threshold, struct PnsMove *moves,
+                     uint32_t *proof, uint32_t *disproof, int *best_square, int *best_piece) {
+    pns->nodes++;
+    uint64_t key = pns_key(board, hand_piece, or_node);
+
+    // the side to move wins right away
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        if (board_wins_with(board, square, hand_piece)) {
+            *proof = or_node ? 0 : PNS_INFINITY;
+            *disproof = or_node ? PNS_INFINITY : 0;
+            if (best_square != NULL) {
+                *best_square = square;
+                *best_piece = BOARD_NO_PIECE;
+            }
+            pns_store(pns, key, *proof, *disproof);
+            return;
+        }
+    }
+
+    // a full board is drawn, even if pieces are left (fields that aren't square have more pieces than squares);
+    // otherwise the side to move loses without a safe piece to hand over, and draws without any piece left
+    int count = pns_generate(pns, board, hand_piece, or_node, moves);
+    if (count == 0) {
+        bool pieces_left = false;
+        for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+            pieces_left |= board->pieces_left[w] != 0;
+        }
+        bool root_side_wins = board_free_squares(board) != 0 && pieces_left && !or_node;
+        *proof = root_side_wins ? 0 : PNS_INFINITY;
+        *disproof = root_side_wins ? PNS_INFINITY : 0;
+        pns_store(pns, key, *proof, *disproof);
+        return;
+    }
+
+    while (true) {
+        // OR: proof is the cheapest child proof, disproof needs all children; AND the other way around
+        uint32_t sum = 0;
+        uint32_t best = PNS_INFINITY;
+        uint32_t second = PNS_INFINITY;
+        int best_index = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t cheap = or_node ? moves[i].proof : moves[i].disproof;
+            sum = pns_add(sum, or_node ? moves[i].disproof : moves[i].proof);
+            if (cheap < best) {
+                second = best;
+                best = cheap;
+                best_index = i;
+            } else if (cheap < second) {
+                second = cheap;
+            }
+        }
+        *proof = or_node ? best : sum;
+        *disproof = or_node ? sum : best;
+
+        if (*proof >= proof_threshold || *disproof >= disproof_threshold || pns_should_abort(pns)) {
+            break;
+        }
+
+        // the child may use up the slack of the parent's thresholds, but not beyond its best sibling
+        struct PnsMove *move = &moves[best_index];
+        uint32_t child_proof_threshold;
+        uint32_t child_disproof_threshold;
+        if (or_node) {
+            child_proof_threshold = proof_threshold < second + 1 ? proof_threshold : second + 1;
+            child_disproof_threshold = disproof_threshold >= PNS_INFINITY
+                                       ? PNS_INFINITY : pns_add(disproof_threshold - *disproof, move->disproof);
+        } else {
+            child_disproof_threshold = disproof_threshold < second + 1 ? disproof_threshold : second + 1;
+            child_proof_threshold = proof_threshold >= PNS_INFINITY
+                                    ? PNS_INFINITY : pns_add(proof_threshold - *proof, move->proof);
+        }
+
+        board_place(board, move->square, hand_piece);
+        board_take_piece(board, move->piece);
+        pns_node(pns, board, move->piece, !or_node, child_proof_threshold, child_disproof_threshold, &moves[count],
+                 &move->proof, &move->disproof, NULL, NULL);
+        board_return_piece(board, move->piece);
+        board_remove(board, move->square);
+    }
+
+    if (best_square != NULL && *proof == 0) {
+        for (int i = 0; i < count; i++) {
+            if (moves[i].proof == 0) {
+                *best_square = moves[i].square;
+                *best_piece = moves[i].piece;
+                break;
+            }
+        }
+    }
+    pns_store(pns, key, *proof, *disproof);
+}
+
+// Make sure the move stack holds the child lists of a whole line of play.
+//
+// Returns 0 on success, -1 if out of memory.
+static int pns_reserve_moves(struct Pns *pns, const struct Board *board) {
+    int free_squares = __builtin_popcountll(board_free_squares(board));
+    int pieces_left = 0;
+    for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+        pieces_left += __builtin_popcountll(board->pieces_left[w]);
+    }
+
+    long needed = 0;
+    for (int ply = 0; ply < free_squares; ply++) {
+        int pieces = pieces_left - ply > 0 ? pieces_left - ply : 1;
+        needed += (long)(free_squares - ply) * pieces;
+    }
+    if (needed <= pns->moves_capacity) {
+        return 0;
+    }
+
+    struct PnsMove *moves = realloc(pns->moves, needed * sizeof(struct PnsMove));
+    if (moves == NULL) {
+        perror("pns move stack realloc failed");
+        return -1;
+    }
+    pns->moves = moves;
+    pns->moves_capacity = needed;
+    return 0;
+}
+
+int pns_reserve(struct Pns *pns, int width, int height) {
+    struct Board board;
+    if (board_init(&board, width, height) != 0) {
+        return -1;
+    }
+    return pns_reserve_moves(pns, &board);
+}
+
+int pns_solve(struct Pns *pns, struct Board *board, int hand_piece, struct SearchResult *result) {
+    pns->nodes = 0;
+    pns->aborted = false;
+    result->square = -1;
+    result->piece = BOARD_NO_PIECE;
+    result->score = 0;
+    result->depth = __builtin_popcountll(board_free_squares(board));
+    result->nodes = 0;
+
+    if (pns_reserve_moves(pns, board) != 0) {
+        return PNS_UNKNOWN;
+    }
+
+    uint32_t proof;
+    uint32_t disproof;
+    pns_node(pns, board, hand_piece, true, PNS_INFINITY, PNS_INFINITY, pns->moves, &proof, &disproof,
+             &result->square, &result->piece);
+    result->nodes = pns->nodes;
+
+    if (proof == 0) {
+        result->score = SEARCH_WIN_THRESHOLD + 1; // proven, but not how many plies it takes
+        return PNS_WIN;
+    }
+    return disproof == 0 ? PNS_NO_WIN : PNS_UNKNOWN;
+}
@@ -0,0 +1,79 @@
+#ifndef pns_h
+#define pns_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "search.h"
+
+#define PNS_INFINITY (1u << 30)
+#define PNS_TABLE_BITS 20 // default table size: 2^20 entries of 16 bytes
+#define PNS_NODE_BUDGET 4000000 // default node budget of pns_solve()
+#define PNS_SHARP_LINES 2 // lines one piece short of full that make a position sharp, see pns_is_sharp()
+
+#define PNS_UNKNOWN 0 // out of nodes or time, or stopped
+#define PNS_WIN 1 // the side to move at the root can force a win
+#define PNS_NO_WIN 2 // the opponent can force a win or a draw
+
+struct PnsEntry {
+    uint64_t key;
+    uint32_t proof;
+    uint32_t disproof;
+};
+
+// Child of a node, with its last known proof and disproof numbers.
+struct PnsMove {
+    int16_t square;
+    int16_t piece;
+    uint32_t proof;
+    uint32_t disproof;
+};
+
+// Depth-first proof-number search (df-pn) of whether the side to move at the root can force a win.
+// OR nodes are the root side to move, AND nodes the opponent; draws count as disproven.
+// As in the alpha-beta search, pieces the opponent could win with right away are never handed over
+// unless there is no other piece, so a node without such a safe move is decided on the spot.
+//
+// The table keeps proof and disproof numbers of 2^table_bits positions; colliding entries are replaced
+// unless they are proven or disproven, so memory stays bounded no matter how many nodes are searched.
+struct Pns {
+    struct PnsEntry *table;
+    uint64_t table_mask;
+
+    // child lists of all plies, stacked
+    struct PnsMove *moves;
+    long moves_capacity;
+
+    atomic_bool stop; // set from another thread to abort the search
+    uint64_t deadline_ns; // CLOCK_MONOTONIC time to abort at, 0 for none
+    long node_budget;
+    bool aborted;
+
+    long nodes; // of the last pns_solve()
+};
+
+// Create a solver with a table of 2^table_bits entries. Must be freed with pns_free().
+//
+// Returns NULL on error.
+struct Pns *pns_create(int table_bits);
+
+void pns_free(struct Pns *pns);
+
+// Grow the move stack for solving positions on fields of width x height, so that pns_solve() doesn't
+// allocate (otherwise it grows on demand).
+//
+// Returns 0 on success, -1 if out of memory or the size is invalid.
+int pns_reserve(struct Pns *pns, int width, int height);
+
+// Whether at least PNS_SHARP_LINES lines miss only one piece, where long forcing sequences are likely.
+bool pns_is_sharp(const struct Board *board);
+
+// Try to prove a forced win for the side to move with hand_piece. On PNS_WIN, result holds a winning move
+// (piece BOARD_NO_PIECE if it wins right away). The board is restored before returning.
+//
+// Returns PNS_WIN, PNS_NO_WIN or PNS_UNKNOWN (also on errors).
+int pns_solve(struct Pns *pns, struct Board *board, int hand_piece, struct SearchResult *result);
+
+#endif
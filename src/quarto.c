@@ -0,0 +1,375 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "board.h"
+#include "nnue.h"
+#include "quarto.h"
+#include "search.h"
+
+struct QuartoPosition {
+    struct Board board;
+    int hand_piece;
+    bool game_over;
+};
+
+// Searches with one search per thread; searches[0] belongs to the calling thread, the others to the workers.
+// A call of quarto_evaluate_positions() is one job: the workers wake up on a new generation, take positions
+// by incrementing next until all are taken, and the last one to finish signals the caller.
+struct QuartoEngine {
+    int threads;
+    struct Search **searches;
+    struct Nnue *nnue; // NULL if none is loaded
+    pthread_t *workers;
+    int started;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    unsigned long generation;
+    bool quit;
+    int busy; // workers still working on the current job
+
+    const struct QuartoPosition *const *positions;
+    int count;
+    const struct QuartoLimits *limits;
+    struct QuartoResult *results;
+    atomic_int next;
+    atomic_int searched;
+};
+
+int quarto_api_version(void) {
+    return QUARTO_API_VERSION;
+}
+
+uint64_t quarto_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool quarto_line_won(const struct Board *board, uint64_t line) {
+    if ((board->occupied & line) != line) {
+        return false;
+    }
+    for (int a = 0; a < board->attributes; a++) {
+        uint64_t set = board->planes[a] & line;
+        if (set == 0 || set == line) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct QuartoPosition *quarto_position_create(const int *field, int width, int height, int hand_piece) {
+    struct QuartoPosition *position = malloc(sizeof(struct QuartoPosition));
+    if (position == NULL) {
+        perror("position malloc failed");
+        return NULL;
+    }
+    if (board_from_field(&position->board, field, width, height, hand_piece) != 0) {
+        free(position);
+        return NULL;
+    }
+
+    position->hand_piece = hand_piece;
+    position->game_over = board_free_squares(&position->board) == 0;
+    for (int l = 0; l < position->board.line_count; l++) {
+        position->game_over |= quarto_line_won(&position->board, position->board.lines[l]);
+    }
+    return position;
+}
+
+struct QuartoPosition *quarto_position_copy(const struct QuartoPosition *position) {
+    struct QuartoPosition *copy = malloc(sizeof(struct QuartoPosition));
+    if (copy == NULL) {
+        perror("position malloc failed");
+        return NULL;
+    }
+    memcpy(copy, position, sizeof(struct QuartoPosition));
+    return copy;
+}
+
+void quarto_position_free(struct QuartoPosition *position) {
+    free(position);
+}
+
+void quarto_position_field(const struct QuartoPosition *position, int *field, int *width, int *height,
+                           int *hand_piece) {
+    const struct Board *board = &position->board;
+    for (int s = 0; s < board->squares; s++) {
+        field[s] = board->pieces[s];
+    }
+    *width = board->width;
+    *height = board->height;
+    *hand_piece = position->hand_piece;
+}
+
+bool quarto_position_game_over(const struct QuartoPosition *position) {
+    return position->game_over;
+}
+
+static bool quarto_any_piece_left(const struct Board *board) {
+    for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+        if (board->pieces_left[w] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int quarto_position_moves(const struct QuartoPosition *position, struct QuartoMove *moves, int capacity) {
+    const struct Board *board = &position->board;
+    if (position->game_over || position->hand_piece == QUARTO_NO_PIECE) {
+        return 0;
+    }
+
+    int count = 0;
+    bool pieces_left = quarto_any_piece_left(board);
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        struct QuartoMove move = {square % board->width, square / board->width, QUARTO_NO_PIECE};
+        if (!pieces_left) {
+            if (count < capacity) {
+                moves[count] = move;
+            }
+            count++;
+            continue;
+        }
+        for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+            for (uint64_t p = board->pieces_left[w]; p != 0; p &= p - 1) {
+                move.piece = w * 64 + __builtin_ctzll(p);
+                if (count < capacity) {
+                    moves[count] = move;
+                }
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+int quarto_position_play(struct QuartoPosition *position, const struct QuartoMove *move) {
+    struct Board *board = &position->board;
+    if (position->game_over || position->hand_piece == QUARTO_NO_PIECE
+        || move->x < 0 || move->x >= board->width || move->y < 0 || move->y >= board->height) {
+        return -1;
+    }
+    int square = move->y * board->width + move->x;
+    if ((board->occupied >> square) & 1) {
+        return -1;
+    }
+
+    bool wins = board_wins_with(board, square, position->hand_piece);
+    if (move->piece == QUARTO_NO_PIECE) {
+        if (!wins && quarto_any_piece_left(board)) {
+            return -1;
+        }
+    } else if (move->piece < 0 || move->piece >= board->piece_count || !board_piece_left(board, move->piece)) {
+        return -1;
+    }
+
+    board_place(board, square, position->hand_piece);
+    if (move->piece != QUARTO_NO_PIECE) {
+        board_take_piece(board, move->piece);
+    }
+    position->hand_piece = move->piece;
+    position->game_over = wins || board_free_squares(board) == 0;
+    return wins ? 1 : 0;
+}
+
+// Returns 0 on success, -1 if there is no legal move.
+static int quarto_search_with(struct QuartoEngine *engine, struct Search *search, const struct QuartoPosition *position,
+                              const struct QuartoLimits *limits, struct QuartoResult *result) {
+    memset(result, 0, sizeof(struct QuartoResult));
+    result->move.x = -1;
+    result->move.y = -1;
+    result->move.piece = QUARTO_NO_PIECE;
+    if (quarto_position_moves(position, &result->move, 1) == 0) {
+        return -1;
+    }
+
+    // search_iterate() restores the board, but position is shared with other threads
+    struct Board board;
+    memcpy(&board, &position->board, sizeof(struct Board));
+    struct Nnue *nnue = engine->nnue;
+    search->nnue = nnue != NULL && nnue->field_width == board.width && nnue->field_height == board.height
+                   ? nnue : NULL;
+    atomic_store(&search->stop, false);
+    int depth = 0;
+    search->deadline_ns = 0;
+    if (limits != NULL) {
+        depth = limits->depth;
+        search->deadline_ns = limits->time_ms > 0 ? quarto_now_ns() + (uint64_t)limits->time_ms * 1000000 : 0;
+    }
+
+    // without a completed iteration, the first legal move from above is kept
+    struct SearchResult search_result;
+    if (search_iterate(search, &board, position->hand_piece, depth, NULL, NULL, &search_result) > 0) {
+        result->move.x = search_result.square % board.width;
+        result->move.y = search_result.square / board.width;
+        result->move.piece = search_result.piece;
+        result->score = search_result.score;
+        result->depth = search_result.depth;
+    }
+    result->nodes = search_result.nodes;
+    return 0;
+}
+
+int quarto_search(struct QuartoEngine *engine, const struct QuartoPosition *position,
+                  const struct QuartoLimits *limits, struct QuartoResult *result) {
+    return quarto_search_with(engine, engine->searches[0], position, limits, result);
+}
+
+// Search positions of the current job until all are taken.
+static void quarto_evaluate_next(struct QuartoEngine *engine, struct Search *search) {
+    int i;
+    while ((i = atomic_fetch_add(&engine->next, 1)) < engine->count) {
+        if (quarto_search_with(engine, search, engine->positions[i], engine->limits, &engine->results[i]) == 0) {
+            atomic_fetch_add(&engine->searched, 1);
+        }
+    }
+}
+
+struct QuartoWorkerArgs {
+    struct QuartoEngine *engine;
+    int index;
+};
+
+static void *quarto_worker_main(void *arg) {
+    struct QuartoWorkerArgs *args = arg;
+    struct QuartoEngine *engine = args->engine;
+    struct Search *search = engine->searches[args->index];
+    free(args);
+
+    unsigned long generation = 0;
+    pthread_mutex_lock(&engine->mutex);
+    while (true) {
+        while (engine->generation == generation && !engine->quit) {
+            pthread_cond_wait(&engine->changed, &engine->mutex);
+        }
+        if (engine->quit) {
+            break;
+        }
+        generation = engine->generation;
+        pthread_mutex_unlock(&engine->mutex);
+
+        quarto_evaluate_next(engine, search);
+
+        pthread_mutex_lock(&engine->mutex);
+        if (--engine->busy == 0) {
+            pthread_cond_broadcast(&engine->changed);
+        }
+    }
+    pthread_mutex_unlock(&engine->mutex);
+    return NULL;
+}
+
+struct QuartoEngine *quarto_engine_create(int threads, int table_bits) {
+    if (threads < 1) {
+        return NULL;
+    }
+    struct QuartoEngine *engine = calloc(1, sizeof(struct QuartoEngine));
+    if (engine == NULL) {
+        perror("engine calloc failed");
+        return NULL;
+    }
+    pthread_mutex_init(&engine->mutex, NULL);
+    pthread_cond_init(&engine->changed, NULL);
+    atomic_init(&engine->next, 0);
+    atomic_init(&engine->searched, 0);
+
+    engine->searches = calloc(threads, sizeof(struct Search *));
+    engine->workers = calloc(threads, sizeof(pthread_t));
+    if (engine->searches == NULL || engine->workers == NULL) {
+        perror("engine calloc failed");
+        goto error;
+    }
+    for (engine->threads = 0; engine->threads < threads; engine->threads++) {
+        engine->searches[engine->threads] = search_create(table_bits > 0 ? table_bits : SEARCH_TT_BITS);
+        if (engine->searches[engine->threads] == NULL) {
+            goto error;
+        }
+    }
+
+    for (int w = 1; w < threads; w++) {
+        struct QuartoWorkerArgs *args = malloc(sizeof(struct QuartoWorkerArgs));
+        if (args == NULL) {
+            perror("worker malloc failed");
+            goto error;
+        }
+        args->engine = engine;
+        args->index = w;
+        int pthread_ret = pthread_create(&engine->workers[engine->started], NULL, quarto_worker_main, args);
+        if (pthread_ret != 0) {
+            printf("Error creating engine worker thread: %s\n", strerror(pthread_ret));
+            free(args);
+            goto error;
+        }
+        engine->started++;
+    }
+    return engine;
+
+    error:
+    quarto_engine_free(engine);
+    return NULL;
+}
+
+void quarto_engine_free(struct QuartoEngine *engine) {
+    pthread_mutex_lock(&engine->mutex);
+    engine->quit = true;
+    pthread_cond_broadcast(&engine->changed);
+    pthread_mutex_unlock(&engine->mutex);
+    for (int w = 0; w < engine->started; w++) {
+        pthread_join(engine->workers[w], NULL);
+    }
+
+    for (int i = 0; i < engine->threads; i++) {
+        search_free(engine->searches[i]);
+    }
+    if (engine->nnue != NULL) {
+        nnue_free(engine->nnue);
+    }
+    free(engine->searches);
+    free(engine->workers);
+    pthread_cond_destroy(&engine->changed);
+    pthread_mutex_destroy(&engine->mutex);
+    free(engine);
+}
+
+int quarto_engine_load_network(struct QuartoEngine *engine, const char *path) {
+    struct Nnue *nnue = nnue_load(path);
+    if (nnue == NULL) {
+        return -1;
+    }
+    if (engine->nnue != NULL) {
+        nnue_free(engine->nnue);
+    }
+    engine->nnue = nnue;
+    return 0;
+}
+
+int quarto_evaluate_positions(struct QuartoEngine *engine, const struct QuartoPosition *const *positions,
+                              int count, const struct QuartoLimits *limits, struct QuartoResult *results) {
+    pthread_mutex_lock(&engine->mutex);
+    engine->positions = positions;
+    engine->count = count;
+    engine->limits = limits;
+    engine->results = results;
+    atomic_store(&engine->next, 0);
+    atomic_store(&engine->searched, 0);
+    engine->busy = engine->started;
+    engine->generation++;
+    pthread_cond_broadcast(&engine->changed);
+    pthread_mutex_unlock(&engine->mutex);
+
+    quarto_evaluate_next(engine, engine->searches[0]);
+
+    pthread_mutex_lock(&engine->mutex);
+    while (engine->busy > 0) {
+        pthread_cond_wait(&engine->changed, &engine->mutex);
+    }
+    pthread_mutex_unlock(&engine->mutex);
+    return atomic_load(&engine->searched);
+}
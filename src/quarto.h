@@ -0,0 +1,114 @@
+#ifndef quarto_h
+#define quarto_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Public API of the Quarto engine, built as build/libquarto.a and build/libquarto.so.
+//
+// Only the declarations in this header are part of the API; positions and engines are opaque, so their
+// layout (and everything in the other headers) may change without breaking programs that link the library.
+// Squares are (x, y) with (0, 0) in the lower left corner, as in the PLAY command of the server.
+//
+// Positions may be used from any thread. An engine must not be used by several threads at the same time;
+// evaluating many positions in parallel is what quarto_evaluate_positions() is for.
+#define QUARTO_API_VERSION 1
+#define QUARTO_NO_PIECE (-1)
+#define QUARTO_WIN 10000 // a won position scores QUARTO_WIN minus the plies until the win
+#define QUARTO_WIN_THRESHOLD (QUARTO_WIN - 1000) // scores beyond are proven wins or losses
+
+#if defined(__GNUC__)
+#define QUARTO_EXPORT __attribute__((visibility("default")))
+#else
+#define QUARTO_EXPORT
+#endif
+
+struct QuartoPosition;
+struct QuartoEngine;
+
+// Place the piece in hand on (x, y), then hand piece to the opponent
+// (QUARTO_NO_PIECE if the placement wins or there is no piece left to hand over).
+struct QuartoMove {
+    int x;
+    int y;
+    int piece;
+};
+
+// Zero fields are no limit; without any limit, positions are searched to the end of the game.
+struct QuartoLimits {
+    int depth; // plies
+    int time_ms; // per position; the search may end early, but always returns a legal move
+};
+
+struct QuartoResult {
+    struct QuartoMove move;
+    int score; // from the view of the side to move, 0 if unknown or drawn
+    int depth; // plies of the last completed iteration, 0 if the move is just the first legal one
+    long nodes;
+};
+
+// Returns QUARTO_API_VERSION of the library, to check it against the header at runtime.
+QUARTO_EXPORT int quarto_api_version(void);
+
+// Returns the current CLOCK_MONOTONIC time in ns. Comparable across processes, the client's timestamps
+// (latencies, deadlines, logs and traces) all come from it.
+QUARTO_EXPORT uint64_t quarto_now_ns(void);
+
+// Create a position from a field array (row by row from y = 0, -1 for empty squares, pieces 0..2^attributes-1
+// with one attribute per square of the longer side) and the piece the side to move has to place.
+// Must be freed with quarto_position_free().
+//
+// Returns NULL if the size (1..8 each) or a piece is invalid, or a piece occurs twice.
+QUARTO_EXPORT struct QuartoPosition *quarto_position_create(const int *field, int width, int height, int hand_piece);
+
+// Returns a copy of position, or NULL on error.
+QUARTO_EXPORT struct QuartoPosition *quarto_position_copy(const struct QuartoPosition *position);
+
+QUARTO_EXPORT void quarto_position_free(struct QuartoPosition *position);
+
+// Writes the field array of position (width * height entries) into field.
+QUARTO_EXPORT void quarto_position_field(const struct QuartoPosition *position, int *field, int *width, int *height,
+                                         int *hand_piece);
+
+// Returns true if the last move played into position completed a line or filled the board.
+QUARTO_EXPORT bool quarto_position_game_over(const struct QuartoPosition *position);
+
+// Write up to capacity legal moves into moves (every free square with every piece left to hand over).
+//
+// Returns the number of legal moves, which may be more than capacity.
+QUARTO_EXPORT int quarto_position_moves(const struct QuartoPosition *position, struct QuartoMove *moves, int capacity);
+
+// Play move, so the opponent is to move with move->piece in hand.
+//
+// Returns 1 if the move wins, 0 if it is legal and doesn't win, -1 if it is illegal (nothing is changed then).
+QUARTO_EXPORT int quarto_position_play(struct QuartoPosition *position, const struct QuartoMove *move);
+
+// Create an engine with one search (with a transposition table of 2^table_bits entries, 0 for the default)
+// per thread; threads - 1 worker threads are started for quarto_evaluate_positions().
+// Must be freed with quarto_engine_free().
+//
+// Returns NULL on error.
+QUARTO_EXPORT struct QuartoEngine *quarto_engine_create(int threads, int table_bits);
+
+QUARTO_EXPORT void quarto_engine_free(struct QuartoEngine *engine);
+
+// Evaluate positions at the search horizon with the network at path, for positions of its field size.
+//
+// Returns 0 on success, -1 otherwise.
+QUARTO_EXPORT int quarto_engine_load_network(struct QuartoEngine *engine, const char *path);
+
+// Search position within limits (limits may be NULL) on the calling thread.
+//
+// Returns 0 on success, -1 if there is no legal move (the game is over).
+QUARTO_EXPORT int quarto_search(struct QuartoEngine *engine, const struct QuartoPosition *position,
+                                const struct QuartoLimits *limits, struct QuartoResult *result);
+
+// Search count positions within limits each, spread over all threads of the engine; results[i] belongs to
+// positions[i]. The calling thread searches too.
+//
+// Returns the number of positions with a legal move; results of the others are zero with move.x = -1.
+QUARTO_EXPORT int quarto_evaluate_positions(struct QuartoEngine *engine, const struct QuartoPosition *const *positions,
+                                            int count, const struct QuartoLimits *limits,
+                                            struct QuartoResult *results);
+
+#endif
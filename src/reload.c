@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "log.h"
+#include "reload.h"
+
+// Read the config file and publish its engine parameters with the next generation.
+static void reload_config(struct Reload *reload) {
+    struct Config *config = create_config();
+    if (config == NULL) {
+        return;
+    }
+    if (read_config(reload->config_path, config) != 0) {
+        log_warn("Could not reload config file %s, keeping the current settings", reload->config_path);
+        free_config(config);
+        return;
+    }
+
+    struct EngineSettings settings;
+    shm_get_settings(reload->shared_memory, &settings);
+    config_engine_settings(config, &settings);
+    settings.generation++;
+    shm_set_settings(reload->shared_memory, &settings);
+    log_info("Reloaded config file %s (settings %u: hash_bits %d, strategy %s, move_margin %d ms)", reload->config_path,
+             settings.generation, settings.hash_bits, settings.mcts ? "mcts" : "alphabeta", settings.move_margin);
+
+    free_config(config);
+}
+
+// Drain the inotify events.
+//
+// Returns true if one of them is about the config file.
+static bool reload_config_changed(struct Reload *reload) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t length;
+    while ((length = read(reload->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *position = buffer; position < buffer + length; ) {
+            struct inotify_event *event = (struct inotify_event *)position;
+            if (event->len > 0 && strcmp(event->name, reload->config_name) == 0) {
+                changed = true;
+            }
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+static void *reload_main(void *arg) {
+    struct Reload *reload = arg;
+    struct pollfd fds[3] = {
+        {reload->stop_fd, POLLIN, 0},
+        {reload->signal_fd, POLLIN, 0},
+        {reload->inotify_fd, POLLIN, 0}, // ignored by poll() if -1
+    };
+
+    while (true) {
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Config reload poll failed: %s", strerror(errno));
+            return NULL;
+        }
+        if (fds[0].revents != 0) {
+            return NULL;
+        }
+
+        bool changed = false;
+        if (fds[1].revents != 0) {
+            struct signalfd_siginfo info;
+            while (read(reload->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                changed = true;
+            }
+        }
+        if (fds[2].revents != 0 && reload_config_changed(reload)) {
+            changed = true;
+        }
+        if (changed) {
+            reload_config(reload);
+        }
+    }
+}
+
+struct Reload *reload_start(char *config_path, struct SharedMemory *shared_memory) {
+    struct Reload *reload = malloc(sizeof(struct Reload));
+    if (reload == NULL) {
+        perror("reload malloc failed");
+        return NULL;
+    }
+    reload->shared_memory = shared_memory;
+    reload->signal_fd = -1;
+    reload->inotify_fd = -1;
+    reload->stop_fd = -1;
+    reload->config_path = strdup(config_path);
+    if (reload->config_path == NULL) {
+        perror("strdup for config_path failed");
+        free(reload);
+        return NULL;
+    }
+
+    // inotify watches the directory, as editors often replace the file instead of writing it
+    char *directory = strdup(config_path);
+    if (directory == NULL) {
+        perror("strdup for config directory failed");
+        goto error;
+    }
+    char *slash = strrchr(directory, '/');
+    reload->config_name = reload->config_path + (slash != NULL ? slash - directory + 1 : 0);
+    if (slash == directory) {
+        slash[1] = '\0';
+    } else if (slash != NULL) {
+        *slash = '\0';
+    } else {
+        strcpy(directory, ".");
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    reload->signal_fd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (reload->signal_fd < 0) {
+        perror("Error creating signalfd for SIGHUP");
+        free(directory);
+        goto error;
+    }
+    reload->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (reload->stop_fd < 0) {
+        perror("Error creating eventfd");
+        free(directory);
+        goto error;
+    }
+
+    reload->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (reload->inotify_fd < 0 || inotify_add_watch(reload->inotify_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_warn("Can't watch %s for config changes (%s), only SIGHUP reloads it", directory, strerror(errno));
+        if (reload->inotify_fd >= 0) {
+            close(reload->inotify_fd);
+            reload->inotify_fd = -1;
+        }
+    }
+    free(directory);
+
+    int err = pthread_create(&reload->thread, NULL, reload_main, reload);
+    if (err != 0) {
+        log_error("Error creating config reload thread: %s", strerror(err));
+        goto error;
+    }
+    return reload;
+
+    error:
+    if (reload->signal_fd >= 0) {
+        close(reload->signal_fd);
+    }
+    if (reload->inotify_fd >= 0) {
+        close(reload->inotify_fd);
+    }
+    if (reload->stop_fd >= 0) {
+        close(reload->stop_fd);
+    }
+    free(reload->config_path);
+    free(reload);
+    return NULL;
+}
+
+void reload_stop(struct Reload *reload) {
+    uint64_t one = 1;
+    if (write(reload->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Error stopping config reload thread");
+    }
+    pthread_join(reload->thread, NULL);
+
+    close(reload->signal_fd);
+    if (reload->inotify_fd >= 0) {
+        close(reload->inotify_fd);
+    }
+    close(reload->stop_fd);
+    free(reload->config_path);
+    free(reload);
+}
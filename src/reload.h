@@ -0,0 +1,32 @@
+#ifndef reload_h
+#define reload_h
+
+#include <pthread.h>
+
+#include "shm.h"
+
+// Config reload: a thread of the connector re-reads the config file on SIGHUP (received through a signalfd;
+// main() blocks the signal in all threads of both processes) or when inotify reports that the file was written
+// or replaced, and publishes its engine parameters (struct EngineSettings) in the shared memory with a new
+// generation. Connector and thinker apply them between moves, so running games go on.
+//
+// Server, game, thinker mode and files (book, network, archive, ...) are only read at startup.
+// A config file that doesn't parse anymore is reported and the current settings are kept.
+struct Reload {
+    pthread_t thread;
+    int signal_fd;
+    int inotify_fd; // -1 if the file can't be watched, then only SIGHUP reloads
+    int stop_fd; // eventfd, written by reload_stop()
+    char *config_path;
+    char *config_name; // file name within the watched directory
+    struct SharedMemory *shared_memory;
+};
+
+// Start watching config_path. Must be stopped with reload_stop().
+//
+// Returns NULL on error.
+struct Reload *reload_start(char *config_path, struct SharedMemory *shared_memory);
+
+void reload_stop(struct Reload *reload);
+
+#endif
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quarto.h"
+#include "search.h"
+
+// ordering scores; history scores are clamped below the killers
+#define SEARCH_ORDER_TABLE (1 << 30)
+#define SEARCH_ORDER_KILLER_1 (1 << 29)
+#define SEARCH_ORDER_KILLER_2 (1 << 28)
+#define SEARCH_ORDER_HISTORY_MAX ((1 << 28) - 1)
+#define SEARCH_ORDER_UNSAFE (-(1 << 30))
+
+struct Search *search_create(int table_bits) {
+    struct Search *search = calloc(1, sizeof(struct Search));
+    if (search == NULL) {
+        perror("search calloc failed");
+        return NULL;
+    }
+
+    search->table = calloc(1ULL << table_bits, sizeof(struct SearchEntry));
+    if (search->table == NULL) {
+        perror("transposition table calloc failed");
+        free(search);
+        return NULL;
+    }
+    search->table_mask = (1ULL << table_bits) - 1;
+    search->ordering = false;
+    search->pruning = true;
+    search->root_squares = 0;
+    search->moves = NULL;
+    search->moves_capacity = 0;
+    atomic_init(&search->stop, false);
+    search->external_stop = NULL;
+    return search;
+}
+
+void search_free(struct Search *search) {
+    free(search->moves);
+    free(search->table);
+    free(search);
+}
+
+void search_clear(struct Search *search) {
+    memset(search->table, 0, (search->table_mask + 1) * sizeof(struct SearchEntry));
+    memset(search->killers, 0, sizeof(search->killers));
+    memset(search->history, 0, sizeof(search->history));
+}
+
+// wins and losses are stored relative to the node in the transposition table
+static int search_score_to_table(int score, int ply) {
+    if (score > SEARCH_WIN_THRESHOLD) {
+        return score + ply;
+    } else if (score < -SEARCH_WIN_THRESHOLD) {
+        return score - ply;
+    }
+    return score;
+}
+
+static int search_score_from_table(int score, int ply) {
+    if (score > SEARCH_WIN_THRESHOLD) {
+        return score - ply;
+    } else if (score < -SEARCH_WIN_THRESHOLD) {
+        return score + ply;
+    }
+    return score;
+}
+
+static bool search_any_piece_left(const struct Board *board) {
+    for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+        if (board->pieces_left[w] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int search_pieces_left(const struct Board *board) {
+    int count = 0;
+    for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+        count += __builtin_popcountll(board->pieces_left[w]);
+    }
+    return count;
+}
+
+// Whether some placement of hand_piece leaves a piece to hand over that doesn't win right away
+// (or leaves no piece at all, which ends the game in a draw).
+static bool search_has_safe_move(struct Board *board, int hand_piece) {
+    if (!search_any_piece_left(board)) {
+        return true;
+    }
+
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        int ones;
+        int zeros;
+        board_place(board, square, hand_piece);
+        board_threats(board, &ones, &zeros);
+        board_remove(board, square);
+
+        for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+            for (uint64_t p = board->pieces_left[w]; p != 0; p &= p - 1) {
+                int piece = w * 64 + __builtin_ctzll(p);
+                if (board_piece_safe(board, piece, ones, zeros)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static bool search_same_move(const struct SearchMove *move, int square, int piece) {
+    return move->square == square && move->piece == piece;
+}
+
+static int search_order_score(struct Search *search, int ply, int square, int piece, int table_square, int table_piece) {
+    if (square == table_square && piece == table_piece) {
+        return SEARCH_ORDER_TABLE;
+    }
+    if (!search->ordering) {
+        return 0;
+    }
+    if (search_same_move(&search->killers[ply][0], square, piece)) {
+        return SEARCH_ORDER_KILLER_1;
+    }
+    if (search_same_move(&search->killers[ply][1], square, piece)) {
+        return SEARCH_ORDER_KILLER_2;
+    }
+    if (piece == BOARD_NO_PIECE) {
+        return 0;
+    }
+    int history = search->history[square][piece];
+    return history < SEARCH_ORDER_HISTORY_MAX ? history : SEARCH_ORDER_HISTORY_MAX;
+}
+
+// Write all moves of the node into moves (with their ordering score).
+//
+// Returns the number of moves.
+static int search_generate(struct Search *search, struct Board *board, int hand_piece, int ply,
+                           int table_square, int table_piece, struct SearchMove *moves) {
+    int count = 0;
+    bool pieces_left = search_any_piece_left(board);
+    uint64_t squares = board_free_squares(board);
+    if (ply == 0 && search->root_squares != 0) {
+        squares &= search->root_squares;
+    }
+
+    for (uint64_t f = squares; f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+
+        if (!pieces_left) {
+            moves[count].square = square;
+            moves[count].piece = BOARD_NO_PIECE;
+            moves[count].score = search_order_score(search, ply, square, BOARD_NO_PIECE, table_square, table_piece);
+            count++;
+            continue;
+        }
+
+        int ones = 0;
+        int zeros = 0;
+        if (search->pruning) {
+            board_place(board, square, hand_piece);
+            board_threats(board, &ones, &zeros);
+            board_remove(board, square);
+        }
+
+        int first_unsafe = BOARD_NO_PIECE;
+        int safe_count = 0;
+        for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+            for (uint64_t p = board->pieces_left[w]; p != 0; p &= p - 1) {
+                int piece = w * 64 + __builtin_ctzll(p);
+                if (!board_piece_safe(board, piece, ones, zeros)) {
+                    if (first_unsafe == BOARD_NO_PIECE) {
+                        first_unsafe = piece;
+                    }
+                    continue;
+                }
+                moves[count].square = square;
+                moves[count].piece = piece;
+                moves[count].score = search_order_score(search, ply, square, piece, table_square, table_piece);
+                count++;
+                safe_count++;
+            }
+        }
+
+        // every piece loses on the spot, so one of them is enough
+        if (safe_count == 0) {
+            moves[count].square = square;
+            moves[count].piece = first_unsafe;
+            moves[count].score = SEARCH_ORDER_UNSAFE;
+            count++;
+        }
+    }
+    return count;
+}
+
+static int search_node(struct Search *search, struct Board *board, int hand_piece, int depth, int alpha, int beta, int ply,
+                       struct SearchMove *moves, int *best_square, int *best_piece);
+
+// Place hand_piece on square, hand give_piece to the opponent (BOARD_NO_PIECE if none is left) and search on.
+//
+// Returns the score from the view of the side that moved.
+static int search_move(struct Search *search, struct Board *board, int hand_piece, int square, int give_piece,
+                       int depth, int alpha, int beta, int ply, struct SearchMove *moves) {
+    int score = 0; // no piece left to hand over: draw
+    board_place(board, square, hand_piece);
+    if (give_piece != BOARD_NO_PIECE) {
+        board_take_piece(board, give_piece);
+        if (search->nnue != NULL) {
+            nnue_update(search->nnue, board, &search->accumulators[ply], &search->accumulators[ply + 1],
+                        square, hand_piece, give_piece);
+        }
+        score = -search_node(search, board, give_piece, depth - 1, -beta, -alpha, ply + 1, moves, NULL, NULL);
+        board_return_piece(board, give_piece);
+    }
+    board_remove(board, square);
+    return score;
+}
+
+static bool search_should_abort(struct Search *search) {
+    if (!search->aborted && search->nodes % SEARCH_CHECK_INTERVAL == 0) {
+        if (atomic_load_explicit(&search->stop, memory_order_relaxed)
+            || (search->external_stop != NULL && atomic_load_explicit(search->external_stop, memory_order_relaxed))
+            || (search->deadline_ns != 0 && quarto_now_ns() >= search->deadline_ns)) {
+            search->aborted = true;
+        }
+    }
+    return search->aborted;
+}
+
+static int search_node(struct Search *search, struct Board *board, int hand_piece, int depth, int alpha, int beta, int ply,
+                       struct SearchMove *moves, int *best_square, int *best_piece) {
+    search->nodes++;
+    if (search_should_abort(search)) {
+        return 0;
+    }
+
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        if (board_wins_with(board, square, hand_piece)) {
+            if (best_square != NULL) {
+                *best_square = square;
+                *best_piece = BOARD_NO_PIECE;
+            }
+            return SEARCH_WIN - ply;
+        }
+    }
+
+    if (depth <= 0 && best_square == NULL) {
+        return search->nnue != NULL ? nnue_evaluate(search->nnue, &search->accumulators[ply]) : 0;
+    }
+
+    uint64_t key = board->key ^ board_hand_key(hand_piece);
+    struct SearchEntry *entry = &search->table[key & search->table_mask];
+    int table_square = -1;
+    int table_piece = BOARD_NO_PIECE;
+    if (entry->key == key) {
+        table_square = entry->square;
+        table_piece = entry->piece;
+        if (entry->depth >= depth && best_square == NULL) {
+            int score = search_score_from_table(entry->score, ply);
+            if (entry->bound == SEARCH_BOUND_EXACT
+                || (entry->bound == SEARCH_BOUND_LOWER && score >= beta)
+                || (entry->bound == SEARCH_BOUND_UPPER && score <= alpha)) {
+                return score;
+            }
+        }
+    }
+
+    // without a network, a child one ply before the horizon scores 0 unless it was handed a piece that wins
+    // right away, so whether there is a safe piece decides the node without visiting the children
+    if (search->pruning && search->nnue == NULL && depth == 1 && best_square == NULL) {
+        return search_has_safe_move(board, hand_piece) ? 0 : -(SEARCH_WIN - (ply + 1));
+    }
+
+    int count = search_generate(search, board, hand_piece, ply, table_square, table_piece, moves);
+    int original_alpha = alpha;
+    int best_score = count == 0 ? 0 : -SEARCH_INFINITY; // no free square: draw
+    int move_square = -1;
+    int move_piece = BOARD_NO_PIECE;
+
+    for (int i = 0; i < count; i++) {
+        // selection sort step: the best remaining move goes next, the rest often isn't needed after a cutoff
+        int best_index = i;
+        for (int j = i + 1; j < count; j++) {
+            if (moves[j].score > moves[best_index].score) {
+                best_index = j;
+            }
+        }
+        struct SearchMove move = moves[best_index];
+        moves[best_index] = moves[i];
+        moves[i] = move;
+
+        int score = search_move(search, board, hand_piece, move.square, move.piece, depth, alpha, beta, ply, &moves[count]);
+        if (search->aborted) {
+            return 0;
+        }
+
+        if (score > best_score) {
+            best_score = score;
+            move_square = move.square;
+            move_piece = move.piece;
+        }
+        if (score > alpha) {
+            alpha = score;
+        }
+        if (alpha >= beta) {
+            search->cutoffs++;
+            if (i == 0) {
+                search->first_move_cutoffs++;
+            }
+            if (search->ordering && move.score != SEARCH_ORDER_TABLE) {
+                if (!search_same_move(&search->killers[ply][0], move.square, move.piece)) {
+                    search->killers[ply][1] = search->killers[ply][0];
+                    search->killers[ply][0] = move;
+                }
+                if (move.piece != BOARD_NO_PIECE) {
+                    search->history[move.square][move.piece] += depth * depth;
+                }
+            }
+            break;
+        }
+    }
+
+    if (best_square != NULL) {
+        *best_square = move_square;
+        *best_piece = move_piece;
+    }
+
+    entry->key = key;
+    entry->score = search_score_to_table(best_score, ply);
+    entry->depth = depth;
+    entry->square = move_square;
+    entry->piece = move_piece;
+    if (best_score <= original_alpha) {
+        entry->bound = SEARCH_BOUND_UPPER;
+    } else if (best_score >= beta) {
+        entry->bound = SEARCH_BOUND_LOWER;
+    } else {
+        entry->bound = SEARCH_BOUND_EXACT;
+    }
+
+    return best_score;
+}
+
+// Make sure the move stack holds the move lists of all plies of a search to depth.
+//
+// Returns 0 on success, -1 if out of memory.
+static int search_reserve_moves(struct Search *search, const struct Board *board, int depth) {
+    int free_squares = __builtin_popcountll(board_free_squares(board));
+    int pieces_left = search_pieces_left(board);
+
+    long needed = 0;
+    for (int ply = 0; ply <= depth && ply < free_squares; ply++) {
+        int pieces = pieces_left - ply > 0 ? pieces_left - ply : 1;
+        needed += (long)(free_squares - ply) * pieces;
+    }
+    if (needed <= search->moves_capacity) {
+        return 0;
+    }
+
+    struct SearchMove *moves = realloc(search->moves, needed * sizeof(struct SearchMove));
+    if (moves == NULL) {
+        perror("search move stack realloc failed");
+        return -1;
+    }
+    search->moves = moves;
+    search->moves_capacity = needed;
+    return 0;
+}
+
+int search_reserve(struct Search *search, int width, int height) {
+    struct Board board;
+    if (board_init(&board, width, height) != 0) {
+        return -1;
+    }
+    return search_reserve_moves(search, &board, board.squares);
+}
+
+int search_root(struct Search *search, struct Board *board, int hand_piece, int depth, struct SearchResult *result) {
+    search->nodes = 0;
+    search->cutoffs = 0;
+    search->first_move_cutoffs = 0;
+    search->aborted = false;
+    result->square = -1;
+    result->piece = BOARD_NO_PIECE;
+
+    if (search_reserve_moves(search, board, depth) != 0) {
+        return -1;
+    }
+
+    // older history counts less; killers are per ply and therefore only valid for the same root
+    for (int s = 0; s < BOARD_MAX_SQUARES; s++) {
+        for (int p = 0; p < BOARD_MAX_PIECES; p++) {
+            search->history[s][p] /= 2;
+        }
+    }
+
+    if (search->nnue != NULL) {
+        nnue_refresh(search->nnue, board, hand_piece, &search->accumulators[0]);
+    }
+    result->score = search_node(search, board, hand_piece, depth, -SEARCH_INFINITY, SEARCH_INFINITY, 0,
+                                search->moves, &result->square, &result->piece);
+    result->depth = depth;
+    result->nodes = search->nodes;
+    return search->aborted ? -1 : 0;
+}
+
+int search_iterate(struct Search *search, struct Board *board, int hand_piece, int max_depth,
+                   search_progress progress, void *context, struct SearchResult *result) {
+    int free_squares = __builtin_popcountll(board_free_squares(board));
+    if (max_depth <= 0 || max_depth > free_squares) {
+        max_depth = free_squares;
+    }
+    result->square = -1;
+    result->piece = BOARD_NO_PIECE;
+    result->score = 0;
+    result->depth = 0;
+    result->nodes = 0;
+
+    long nodes = 0;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        struct SearchResult iteration;
+        int ret = search_root(search, board, hand_piece, depth, &iteration);
+        nodes += iteration.nodes;
+        if (ret != 0 || iteration.square < 0) {
+            break;
+        }
+
+        *result = iteration;
+        if (progress != NULL) {
+            progress(context, result);
+        }
+        if (iteration.score > SEARCH_WIN_THRESHOLD || iteration.score < -SEARCH_WIN_THRESHOLD) {
+            break; // proven, deeper search can't change the outcome
+        }
+    }
+    result->nodes = nodes;
+    return result->depth;
+}
@@ -0,0 +1,121 @@
+#ifndef search_h
+#define search_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "nnue.h"
+
+// Scores are from the view of the side to move; a won position scores SEARCH_WIN minus the plies until the win.
+#define SEARCH_WIN 10000
+#define SEARCH_WIN_THRESHOLD (SEARCH_WIN - 1000) // scores beyond are proven wins or losses
+#define SEARCH_INFINITY 32000
+#define SEARCH_TT_BITS 20 // default transposition table size: 2^20 entries of 16 bytes
+#define SEARCH_MAX_PLY (BOARD_MAX_SQUARES + 1)
+#define SEARCH_CHECK_INTERVAL 1024 // nodes between checks of the stop flag and the deadline
+
+#define SEARCH_BOUND_EXACT 0
+#define SEARCH_BOUND_LOWER 1
+#define SEARCH_BOUND_UPPER 2
+
+struct SearchEntry {
+    uint64_t key;
+    int16_t score;
+    int8_t depth;
+    uint8_t bound;
+    int8_t square;
+    int16_t piece;
+};
+
+// One move: place the piece in hand on square, hand piece to the opponent.
+struct SearchMove {
+    int16_t square;
+    int16_t piece;
+    int score; // ordering score
+};
+
+// Negamax alpha-beta search with a transposition table. One ply is placing the piece in hand
+// and handing a piece to the opponent.
+//
+// Moves are ordered by: the transposition table move, two killer moves per ply (moves that caused a cutoff
+// in a sibling node), then a history table indexed by (square, piece handed over). Pieces the opponent could
+// win with right away are only tried if there is no other piece for a square, since they lose on the spot.
+// For the same reason, nodes one ply before the horizon are decided by whether such a safe piece exists.
+//
+// Without a network, positions at the horizon score 0 (only wins and losses count). With a network,
+// they are evaluated by it, and its accumulator is updated along with every move.
+struct Search {
+    struct SearchEntry *table;
+    uint64_t table_mask;
+
+    bool ordering; // killers and history after the table move; off by default, they grow the tree (quarto-bench)
+    bool pruning; // false: no safe-piece pruning and no shortcut one ply before the horizon, see above
+    struct SearchMove killers[SEARCH_MAX_PLY][2];
+    int history[BOARD_MAX_SQUARES][BOARD_MAX_PIECES];
+
+    const struct Nnue *nnue; // NULL: no evaluation at the horizon
+    struct NnueAccumulator accumulators[SEARCH_MAX_PLY + 1]; // per ply, valid if nnue is set
+
+    // move lists of all plies, stacked
+    struct SearchMove *moves;
+    long moves_capacity;
+
+    uint64_t root_squares; // only placements on these squares are searched at the root, 0 for all
+
+    atomic_bool stop; // set from another thread to abort the search
+    const atomic_bool *external_stop; // optional second stop flag, e.g. in memory shared with another process
+    uint64_t deadline_ns; // CLOCK_MONOTONIC time to abort at, 0 for none
+    bool aborted;
+
+    // statistics of the last search_root()
+    long nodes;
+    long cutoffs;
+    long first_move_cutoffs; // cutoffs by the first move tried; cutoffs / first_move_cutoffs shows the ordering quality
+};
+
+// Best move found by search_root().
+struct SearchResult {
+    int square;
+    int piece; // piece to hand over, BOARD_NO_PIECE if the game ends with this placement
+    int score;
+    int depth;
+    long nodes;
+};
+
+// Create a search with a transposition table of 2^table_bits entries. Must be freed with search_free().
+//
+// Returns NULL on error.
+struct Search *search_create(int table_bits);
+
+void search_free(struct Search *search);
+
+// Forget all transposition table entries, killers and history, e.g. between unrelated positions.
+void search_clear(struct Search *search);
+
+// Grow the move stack for searches of any depth on fields of width x height, so that searching them
+// doesn't allocate (otherwise it grows on demand).
+//
+// Returns 0 on success, -1 if out of memory or the size is invalid.
+int search_reserve(struct Search *search, int width, int height);
+
+// Search board with hand_piece to place to the given depth (in plies) and store the best move in result.
+// The board is restored before returning.
+//
+// Returns 0 if the search completed, -1 if it was stopped (stop flag or deadline) and result is unusable.
+int search_root(struct Search *search, struct Board *board, int hand_piece, int depth, struct SearchResult *result);
+
+// Called by search_iterate() with the result of every completed iteration (nodes of that iteration only).
+typedef void (*search_progress)(void *context, const struct SearchResult *result);
+
+// Iterative deepening: search_root() with depth 1, 2, ... up to max_depth (0 for all free squares), until the
+// search is stopped, a win or loss is proven or the depths are exhausted. Every completed iteration is a better
+// move, and fills the table and history for the next one. progress may be NULL.
+//
+// Returns the depth of the last completed iteration, whose move is in result (with the nodes of all
+// iterations), or 0 if not even the first one completed.
+int search_iterate(struct Search *search, struct Board *board, int hand_piece, int max_depth,
+                   search_progress progress, void *context, struct SearchResult *result);
+
+#endif
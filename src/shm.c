@@ -5,6 +5,8 @@
 #include <sys/types.h>
 #include <sys/shm.h>
 
+#include "alloc.h"
+#include "log.h"
 #include "shm.h"
 
 
@@ -33,13 +35,13 @@ int create_shm_segment(size_t size) {
 
 //Segment an Adressraum des Erzeugerprozesses anhaengen
 void *shm_attach(int shm_id) {
-    if (shm_id == 0) {
-        printf("Given shm_id is 0\n");
+    if (shm_id < 0) {
+        printf("Given shm_id %d is invalid\n", shm_id);
         return NULL;
     }
 
     void *pointer;
-    if ((pointer = shmat(shm_id, NULL, 0)) == NULL) {
+    if ((pointer = shmat(shm_id, NULL, 0)) == (void *) -1) {
         perror("failed to attach shm");
         return NULL;
     }
@@ -55,6 +57,25 @@ void *shm_attach(int shm_id) {
 }
 
 
+struct SharedMemory *shm_create_local() {
+    struct SharedMemory *shared_memory = calloc(1, sizeof(struct SharedMemory));
+    if (shared_memory == NULL) {
+        perror("shared memory calloc failed");
+        return NULL;
+    }
+    return shared_memory;
+}
+
+void shm_init(struct SharedMemory *shared_memory, bool process_shared) {
+    shared_memory->process_shared = process_shared;
+    doorbell_init(&shared_memory->thinker_request, process_shared);
+    doorbell_init(&shared_memory->thinker_response, process_shared);
+    atomic_init(&shared_memory->connector_stopped, false);
+    atomic_init(&shared_memory->thinker_stop, false);
+    atomic_init(&shared_memory->thinker_stop_request, 0);
+    atomic_init(&shared_memory->thinker_ready, false);
+}
+
 int shm_remove_segment(int shm_id) {
     int shm_ch;
     if((shm_ch = shmctl(shm_id, IPC_RMID, NULL)) < 0) {
@@ -64,117 +85,155 @@ int shm_remove_segment(int shm_id) {
     return 0;
 }
 
-int shm_set_player_name(struct SharedMemory *shared_memory, char *player_name) {
-    int n = (strlen(player_name)+1);
-
-    int shm_id = shmget(SHM_KEY, n*sizeof(char), SHM_FLAG);
-    if (shm_id == -1) {
-        perror("Shared Memory creation error");
-        return -1;
+// Copies src into the fixed-size name buffer dest, truncating if necessary.
+static void shm_copy_name(char *dest, char *src) {
+    if (strlen(src) >= MAX_PLAYER_NAME_LENGTH) {
+        log_warn("Player name '%s' is too long, truncating to %d characters", src, MAX_PLAYER_NAME_LENGTH - 1);
     }
+    strncpy(dest, src, MAX_PLAYER_NAME_LENGTH - 1);
+    dest[MAX_PLAYER_NAME_LENGTH - 1] = '\0';
+}
+
+int shm_set_player_name(struct SharedMemory *shared_memory, char *player_name) {
+    shm_copy_name(shared_memory->player_name, player_name);
+    return 0;
+}
 
-    printf("Created player_name shm segment %d\n", shm_id);
+char *shm_get_player_name(struct SharedMemory *shared_memory) {
+    return shared_memory->player_name;
+}
 
-    char *player_name_shm = shm_attach(shm_id);
-    if (player_name_shm == NULL) {
+int shm_set_players(struct SharedMemory *shared_memory, struct PlayerData *players, int total_player_count) {
+    int previous_phase = alloc_phase_enter(ALLOC_SHM_PLAYERS);
+    if (total_player_count > MAX_PLAYERS) {
+        alloc_phase_leave(previous_phase);
+        log_error("Too many players: %d (at most %d are supported)", total_player_count, MAX_PLAYERS);
         return -1;
     }
 
-    memcpy(player_name_shm, player_name, n);
-    shared_memory->player_name_shm_id = shm_id;
+    for (int i = 0; i < total_player_count; i++) {
+        shared_memory->players[i].player_nr = players[i].player_nr;
+        shm_copy_name(shared_memory->players[i].player_name, players[i].player_name);
+        shared_memory->players[i].ready = players[i].ready;
+    }
 
+    shared_memory->total_player_count = total_player_count;
+    alloc_phase_leave(previous_phase);
     return 0;
 }
 
-char *shm_get_player_name(struct SharedMemory *shared_memory) {
-    return shm_attach(shared_memory->player_name_shm_id);
+int shm_get_players(struct SharedMemory *shared_memory, struct PlayerData *players) {
+    int previous_phase = alloc_phase_enter(ALLOC_SHM_PLAYERS);
+    for (int i = 0; i < shared_memory->total_player_count; i++) {
+        players[i].player_nr = shared_memory->players[i].player_nr;
+        players[i].player_name = shared_memory->players[i].player_name;
+        players[i].ready = shared_memory->players[i].ready;
+    }
+
+    alloc_phase_leave(previous_phase);
+    return shared_memory->total_player_count;
 }
 
-int shm_set_players(struct SharedMemory *shared_memory, struct PlayerData *players, int total_player_count) {
-    size_t size = sizeof(struct PlayerDataInternal) * total_player_count;
+// Seqlock helpers. The sequence number is odd while a write is in progress;
+// readers retry until they saw the same even number before and after copying.
+static void seqlock_write_begin(atomic_uint *seq) {
+    // there is only one writer per slot, so a relaxed load of our own sequence number is enough
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
 
-    int shm_id = shmget(SHM_KEY, size, SHM_FLAG);
-    if (shm_id == -1) {
-        perror("Shared Memory creation error");
-        return -1;
+static void seqlock_write_end(atomic_uint *seq) {
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static unsigned int seqlock_read_begin(atomic_uint *seq) {
+    unsigned int value;
+    while ((value = atomic_load_explicit(seq, memory_order_acquire)) % 2 == 1) {
+        // write in progress
     }
+    return value;
+}
 
-    printf("Created players shm segment %d\n", shm_id);
+static bool seqlock_read_retry(atomic_uint *seq, unsigned int value) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != value;
+}
 
-    struct PlayerDataInternal *players_internal = shm_attach(shm_id);
-    if (players_internal == NULL) {
+int shm_set_field(struct SharedMemory *shared_memory, int *field, int width, int height) {
+    if (width > MAX_FIELD_SIZE || height > MAX_FIELD_SIZE) {
+        log_error("Field size %dx%d exceeds maximum of %dx%d", width, height, MAX_FIELD_SIZE, MAX_FIELD_SIZE);
         return -1;
     }
 
-    for (int i = 0; i < total_player_count; i++) {
-        int player_name_n = strlen(players[i].player_name) + 1;
-        int player_name_shm_id = shmget(SHM_KEY, player_name_n*sizeof(char), SHM_FLAG);
-        if (player_name_shm_id == -1) {
-            perror("Shared Memory creation error");
-            return -1;
-        }
+    struct FieldSlot *slot = &shared_memory->field_slot;
 
-        printf("Created players[%d].player_name shm segment %d\n", i, player_name_shm_id);
+    seqlock_write_begin(&slot->seq);
+    slot->field_width = width;
+    slot->field_height = height;
+    memcpy(slot->field, field, sizeof(int) * (width*height));
+    seqlock_write_end(&slot->seq);
 
-        char *player_name_shm = shm_attach(player_name_shm_id);
-        if (player_name_shm == NULL) {
-            return -1;
-        }
+    return 0;
+}
 
-        memcpy(player_name_shm, players[i].player_name, player_name_n);
+void shm_get_field(struct SharedMemory *shared_memory, int *field, int *width, int *height) {
+    struct FieldSlot *slot = &shared_memory->field_slot;
+    unsigned int seq;
 
-        players_internal[i].player_nr = players[i].player_nr;
-        players_internal[i].player_name_shm_id = player_name_shm_id;
-        players_internal[i].ready = players[i].ready;
-    }
+    do {
+        seq = seqlock_read_begin(&slot->seq);
 
-    shared_memory->total_player_count = total_player_count;
-    shared_memory->players_shm_id = shm_id;
-    return 0;
+        *width = slot->field_width;
+        *height = slot->field_height;
+        if (*width > MAX_FIELD_SIZE || *height > MAX_FIELD_SIZE) {
+            *width = *height = 0; // torn read, will be retried
+        }
+        memcpy(field, slot->field, sizeof(int) * (*width * *height));
+    } while (seqlock_read_retry(&slot->seq, seq));
 }
 
-struct PlayerData *shm_get_players(struct SharedMemory *shared_memory) {
-    struct PlayerDataInternal *players_internal = shm_attach(shared_memory->players_shm_id);
-    if (players_internal == NULL) {
-        return NULL;
-    }
+void shm_publish_result(struct SharedMemory *shared_memory, struct MoveResult *result) {
+    struct ResultSlot *slot = &shared_memory->result_slot;
 
-    struct PlayerData *players = malloc(sizeof(struct PlayerData) * shared_memory->total_player_count);
+    seqlock_write_begin(&slot->seq);
+    slot->result = *result;
+    seqlock_write_end(&slot->seq);
 
-    for (int i = 0; i < shared_memory->total_player_count; i++) {
-        players[i].player_nr = players_internal[i].player_nr;
-        players[i].player_name = shm_attach(players_internal[i].player_name_shm_id);
-        players[i].ready = players_internal[i].ready;
-    }
-
-    return players;
+    doorbell_ring(&shared_memory->thinker_response);
 }
 
-int shm_set_field(struct SharedMemory *shared_memory, int *field, int field_size) {
-    size_t size = sizeof(int) * (field_size*field_size);
+void shm_get_result(struct SharedMemory *shared_memory, struct MoveResult *result) {
+    struct ResultSlot *slot = &shared_memory->result_slot;
+    unsigned int seq;
 
-    int shm_id = shmget(SHM_KEY, size, SHM_FLAG);
-    if (shm_id == -1) {
-        perror("Shared Memory creation error for field");
-        return -1;
-    }
+    do {
+        seq = seqlock_read_begin(&slot->seq);
+        *result = slot->result;
+    } while (seqlock_read_retry(&slot->seq, seq));
+}
 
-    printf("Created field shm segment %d\n", shm_id);
+void shm_set_settings(struct SharedMemory *shared_memory, const struct EngineSettings *settings) {
+    struct SettingsSlot *slot = &shared_memory->settings_slot;
 
-    char *field_shm = shm_attach(shm_id);
-    if (field_shm == NULL) {
-        return -1;
-    }
+    seqlock_write_begin(&slot->seq);
+    slot->settings = *settings;
+    seqlock_write_end(&slot->seq);
 
-    memcpy(field_shm, field, size);
-    shared_memory->field_size = field_size;
-    shared_memory->field_shm_id = shm_id;
+    atomic_store(&slot->generation, settings->generation);
+}
 
-    return 0;
+void shm_get_settings(struct SharedMemory *shared_memory, struct EngineSettings *settings) {
+    struct SettingsSlot *slot = &shared_memory->settings_slot;
+    unsigned int seq;
+
+    do {
+        seq = seqlock_read_begin(&slot->seq);
+        *settings = slot->settings;
+    } while (seqlock_read_retry(&slot->seq, seq));
 }
 
-int *shm_get_field(struct SharedMemory *shared_memory) {
-    return shm_attach(shared_memory->field_shm_id);
+unsigned int shm_settings_generation(struct SharedMemory *shared_memory) {
+    return atomic_load(&shared_memory->settings_slot.generation);
 }
 
 //Speicheranbindung entfernen
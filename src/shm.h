@@ -3,13 +3,32 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <regex.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 
+#include "doorbell.h"
+#include "metrics.h"
+#include "placement.h"
+
+// The whole shared memory is one fixed-size arena, created once in main() before fork().
+// Everything that is handed from the connector to the thinker lives at a fixed offset in it,
+// so no further shm segments have to be created or attached while playing.
+#define MAX_FIELD_SIZE 8
+#define MAX_PLAYERS 16
+#define MAX_PLAYER_NAME_LENGTH 128
+
+struct Move {
+    int x;
+    int y;
+    int next_block_nr;
+};
+
 //Every player has at least three properties:
 struct PlayerData {
     int player_nr;
@@ -19,27 +38,99 @@ struct PlayerData {
 
 struct PlayerDataInternal {
     int player_nr;
-    int player_name_shm_id;
+    char player_name[MAX_PLAYER_NAME_LENGTH];
     bool ready;
 };
 
+// Board slot sized for the largest supported field.
+// Protected by a seqlock: seq is odd while the connector is writing, so the thinker
+// retries its copy if seq was odd or changed while it was reading.
+struct FieldSlot {
+    atomic_uint seq;
+    int field_width;
+    int field_height;
+    int field[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+};
+
+// Answer of the thinker to one request. The thinker may publish several times per request,
+// each time with a better best-so-far move, and marks the last one as final.
+struct MoveResult {
+    unsigned int request; // sequence number of the thinker_request ring this move answers
+    bool final;
+    struct Move move;
+
+    // search metadata, informational only
+    int score;
+    int depth;
+    long nodes;
+};
+
+// Result slot, protected by a seqlock like the board slot (only the thinker writes).
+struct ResultSlot {
+    atomic_uint seq;
+    struct MoveResult result;
+};
+
+// Engine parameters that may change while a game is running (config reload, see reload.h).
+// Connector and thinker apply them between moves once generation has changed.
+struct EngineSettings {
+    unsigned int generation;
+    int log_level;
+    int hash_bits; // transposition table size as power of two, 0 for SEARCH_TT_BITS
+    bool mcts;
+    int move_margin; // ms, see CLIENT_MOVE_MARGIN_MS; reaches the thinker's budget through move_deadline_ns
+    struct Placement connector_placement;
+    struct Placement thinker_placement;
+};
+
+// Settings slot, protected by a seqlock like the board slot (only one thread writes, see shm_set_settings()).
+struct SettingsSlot {
+    atomic_uint seq;
+    atomic_uint generation; // settings.generation, to check for changes without copying the settings
+    struct EngineSettings settings;
+};
+
 struct SharedMemory {
+    // false if the thinker runs as thread and this arena is plain process memory
+    bool process_shared;
+
     pid_t thinker_pid;
     pid_t connector_pid;
 
     int player_nr;
-    int player_name_shm_id;
+    char player_name[MAX_PLAYER_NAME_LENGTH];
     int total_player_count;
 
-    int players_shm_id;
+    struct PlayerDataInternal players[MAX_PLAYERS];
 
     int move_timeout;
     int move_block_nr;
 
-    int field_size;
-    int field_shm_id;
-
-    bool thinker_request;
+    struct FieldSlot field_slot;
+
+    // rung by the connector to request a move; the thinker answers by publishing into result_slot,
+    // which rings thinker_response
+    struct Doorbell thinker_request;
+    struct Doorbell thinker_response;
+    struct ResultSlot result_slot;
+    struct SettingsSlot settings_slot;
+    uint64_t request_time_ns; // CLOCK_MONOTONIC time of the last request, for measuring the thinker's wakeup latency
+    // CLOCK_MONOTONIC time at which the connector sends the best move so far: arrival of "+ MOVE" plus
+    // move_timeout minus the move margin; the thinker plans its search up to it
+    uint64_t move_deadline_ns;
+
+    // set (and thinker_request rung) when the connector is gone and the thinker should stop
+    atomic_bool connector_stopped;
+    // set when the connector's deadline watchdog answered the current request without waiting any longer (or the
+    // connection is gone); the thinker's search stops on it. The thinker clears it when it picks up the next
+    // request, unless thinker_stop_request says it was set for that very request already.
+    atomic_bool thinker_stop;
+    atomic_uint thinker_stop_request;
+    // set by the thinker once it has warmed up (see thinker_loop()), so the first move is as fast as the others
+    atomic_bool thinker_ready;
+
+    // updated by connector and thinker, served by the metrics server ("metrics_socket")
+    struct Metrics metrics;
 };
 
 int create_shm_segment(size_t size_struct);
@@ -48,13 +139,48 @@ int create_shm_segment(size_t size_struct);
 
 void *shm_attach(int shm_id);
 
+// Allocates the arena in plain memory instead of a SysV segment, for running the thinker as a thread.
+// Must be freed. Returns NULL on error.
+struct SharedMemory *shm_create_local();
+
+// Initialize a freshly created arena.
+//
+// process_shared: Whether thinker and connector are different processes
+void shm_init(struct SharedMemory *shared_memory, bool process_shared);
+
 int shm_set_player_name(struct SharedMemory *shared_memory, char *player_name);
 char *shm_get_player_name(struct SharedMemory *shared_memory);
 
 int shm_set_players(struct SharedMemory *shared_memory, struct PlayerData *players, int total_player_count);
-struct PlayerData *shm_get_players(struct SharedMemory *shared_memory);
 
-int shm_set_field(struct SharedMemory *shared_memory, int *field, int field_size);
-int *shm_get_field(struct SharedMemory *shared_memory);
+// Fills players (array of at least MAX_PLAYERS entries) with the player table.
+// The player names point into the shared memory and must not be freed.
+//
+// Returns the number of players.
+int shm_get_players(struct SharedMemory *shared_memory, struct PlayerData *players);
+
+// Copies field (height rows of width squares) into the board slot.
+//
+// Returns 0 on success, -1 if width or height exceeds MAX_FIELD_SIZE.
+int shm_set_field(struct SharedMemory *shared_memory, int *field, int width, int height);
+
+// Copies a consistent snapshot of the board slot into field (array of at least MAX_FIELD_SIZE * MAX_FIELD_SIZE entries)
+// and its dimensions into width and height.
+void shm_get_field(struct SharedMemory *shared_memory, int *field, int *width, int *height);
+
+// Writes result into the result slot and rings the thinker_response doorbell.
+void shm_publish_result(struct SharedMemory *shared_memory, struct MoveResult *result);
+
+// Copies a consistent snapshot of the result slot into result.
+void shm_get_result(struct SharedMemory *shared_memory, struct MoveResult *result);
+
+// Publishes new engine settings. Only main() (before the game starts) and the reload thread write them.
+void shm_set_settings(struct SharedMemory *shared_memory, const struct EngineSettings *settings);
+
+// Copies a consistent snapshot of the settings slot into settings.
+void shm_get_settings(struct SharedMemory *shared_memory, struct EngineSettings *settings);
+
+// Returns the generation of the published settings; cheap enough to check before every move.
+unsigned int shm_settings_generation(struct SharedMemory *shared_memory);
 
 #endif //QUARTO_CLIENT_SHM_H
@@ -1,7 +1,21 @@
+#include "alloc.h"
+#include "log.h"
+#include "quarto.h"
 #include "thinker.h"
-#include <time.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-struct Thinker *thinker_create(struct SharedMemory *shared_memory, int pipe_fd) {
+// Looks the snapshot up in the opening book.
+//
+// Returns 0 and fills result (request, move, score and depth) on a hit, -1 otherwise.
+static int thinker_book_move(struct Thinker *thinker, struct MoveResult *result);
+
+// Applies the engine settings if the reload thread has published new ones (see reload.h): log level, placement,
+// transposition table size and strategy. Only called between moves; a new table is allocated and faulted in here.
+static void thinker_apply_settings(struct Thinker *thinker);
+
+struct Thinker *thinker_create(struct SharedMemory *shared_memory) {
     struct Thinker *thinker = malloc(sizeof(struct Thinker));
     if (thinker == NULL) {
         perror("thinker malloc failed");
@@ -9,328 +23,664 @@ struct Thinker *thinker_create(struct SharedMemory *shared_memory, int pipe_fd)
     }
 
     thinker->shared_memory = shared_memory;
-    thinker->pipe_fd = pipe_fd;
+    thinker->field_width = 0;
+    thinker->field_height = 0;
+    thinker->book = NULL;
+    thinker->nnue = NULL;
+    thinker->mcts = NULL;
+    thinker->cluster = NULL;
+    thinker->latency = latency_create("thinker");
+    if (thinker->latency == NULL) {
+        free(thinker);
+        return NULL;
+    }
+    struct EngineSettings settings;
+    shm_get_settings(shared_memory, &settings);
+    thinker->settings_generation = settings.generation;
+    thinker->hash_bits = settings.hash_bits > 0 ? settings.hash_bits : SEARCH_TT_BITS;
+    thinker->search = search_create(thinker->hash_bits);
+    if (thinker->search == NULL) {
+        free(thinker->latency);
+        free(thinker);
+        return NULL;
+    }
+    thinker->search->external_stop = &shared_memory->thinker_stop;
+    thinker->pns = pns_create(PNS_TABLE_BITS);
+    if (thinker->pns == NULL) {
+        search_free(thinker->search);
+        free(thinker->latency);
+        free(thinker);
+        return NULL;
+    }
+
     return thinker;
 }
 
-static int last_signal = 0;
-static void signal_handler(int signum) {
-    last_signal = signum;
+void thinker_free(struct Thinker *thinker) {
+    if (thinker->book != NULL) {
+        book_close(thinker->book);
+    }
+    if (thinker->nnue != NULL) {
+        nnue_free(thinker->nnue);
+    }
+    if (thinker->mcts != NULL) {
+        mcts_free(thinker->mcts);
+    }
+    if (thinker->cluster != NULL) {
+        cluster_free(thinker->cluster);
+    }
+    pns_free(thinker->pns);
+    search_free(thinker->search);
+    free(thinker->latency);
+    free(thinker);
 }
 
-int thinker_loop(struct Thinker *thinker) {
-    if (signal(SIGUSR1, signal_handler) == SIG_ERR) {
-        perror("failed setting SIGUSR1 signal handler");
+int thinker_load_book(struct Thinker *thinker, char *path) {
+    struct Book *book = book_open(path);
+    if (book == NULL) {
         return -1;
     }
-    if (signal(SIGCHLD, signal_handler) == SIG_ERR) {
-        perror("failed setting SIGCHLD signal handler");
+    if (thinker->book != NULL) {
+        book_close(thinker->book);
+    }
+    thinker->book = book;
+    log_info("Loaded opening book %s with %lu positions", path, (unsigned long)book->entry_count);
+    return 0;
+}
+
+int thinker_load_nnue(struct Thinker *thinker, char *path) {
+    struct Nnue *nnue = nnue_load(path);
+    if (nnue == NULL) {
         return -1;
     }
+    if (thinker->nnue != NULL) {
+        nnue_free(thinker->nnue);
+    }
+    thinker->nnue = nnue;
+    log_info("Loaded evaluation network %s for field size %dx%d", path, nnue->field_width, nnue->field_height);
+    return 0;
+}
 
-    while (pause() == -1) {
-        printf("While iteration (ready: %d)\n", thinker->shared_memory->thinker_request);
+int thinker_use_mcts(struct Thinker *thinker) {
+    if (thinker->mcts != NULL) {
+        return 0;
+    }
+    thinker->mcts = mcts_create(MCTS_POOL_BITS);
+    if (thinker->mcts == NULL) {
+        return -1;
+    }
+    thinker->mcts->external_stop = &thinker->shared_memory->thinker_stop;
+    log_info("Using Monte Carlo tree search with %u nodes", thinker->mcts->capacity);
+    return 0;
+}
 
-        if (last_signal == SIGCHLD) {
-            printf("Stopping thinker loop since child was terminated.\n");
-            return 0;
-        }
+int thinker_connect_workers(struct Thinker *thinker, char *addresses) {
+    struct Cluster *cluster = cluster_connect(addresses);
+    if (cluster == NULL) {
+        return -1;
+    }
+    if (thinker->cluster != NULL) {
+        cluster_free(thinker->cluster);
+    }
+    thinker->cluster = cluster;
+    log_info("Searching with %d workers", cluster->count);
+    return 0;
+}
 
-        if (last_signal == SIGUSR1) {
-            if (!thinker->shared_memory->thinker_request) {
-                printf("Thinker requested with thinker_request = false, won't think.\n");
-            } else {
-                // reset thinker_request, since we're thinking now
-                thinker->shared_memory->thinker_request = false;
-                thinker_think(thinker);
-            }
-        }
+static int thinker_book_move(struct Thinker *thinker, struct MoveResult *result) {
+    struct Board board;
+    int hand_piece = thinker->shared_memory->move_block_nr;
+    if (thinker->book == NULL || board_from_field(&board, thinker->field, thinker->field_width, thinker->field_height, hand_piece) != 0) {
+        return -1;
+    }
+
+    struct SearchResult book_result;
+    if (book_lookup(thinker->book, &board, hand_piece, &book_result) != 0) {
+        return -1;
     }
 
+    result->final = true;
+    result->move.x = book_result.square % thinker->field_width;
+    result->move.y = book_result.square / thinker->field_width;
+    result->move.next_block_nr = book_result.piece;
+    result->score = book_result.score;
+    result->depth = book_result.depth;
+    result->nodes = 0;
     return 0;
 }
 
-void thinker_think(struct Thinker *thinker) {
-    //Print board
-    print_board(thinker);
-    char *player_name = shm_get_player_name(thinker->shared_memory);
-    printf("Thinker is thinking for player '%s'...\n", player_name);
+// State of the iterative deepening in thinker_think(), passed to thinker_publish_iteration().
+struct ThinkerIteration {
+    struct Thinker *thinker;
+    struct MoveResult *result;
+    long nodes;
+};
+
+static void thinker_publish_iteration(void *context, const struct SearchResult *search_result) {
+    struct ThinkerIteration *iteration = context;
+    struct MoveResult *result = iteration->result;
+    struct Search *search = iteration->thinker->search;
+
+    iteration->nodes += search_result->nodes;
+    result->move.x = search_result->square % iteration->thinker->field_width;
+    result->move.y = search_result->square / iteration->thinker->field_width;
+    result->move.next_block_nr = search_result->piece;
+    result->score = search_result->score;
+    result->depth = search_result->depth;
+    result->nodes = iteration->nodes;
+    shm_publish_result(iteration->thinker->shared_memory, result);
+    log_debug("Depth %d: score %d, %ld nodes, %ld/%ld cutoffs by the first move", search_result->depth,
+              search_result->score, search_result->nodes, search->first_move_cutoffs, search->cutoffs);
+}
 
-    int next_block_nr = thinker->shared_memory->move_block_nr;
-    int *field = shm_get_field(thinker->shared_memory);
-    int field_size = thinker->shared_memory->field_size;
+// Publishes the most visited move of the Monte Carlo tree search (passed as context) so far.
+static void thinker_publish_simulations(void *context, const struct SearchResult *search_result) {
+    struct ThinkerIteration *iteration = context;
+    struct MoveResult *result = iteration->result;
+
+    iteration->nodes = search_result->nodes;
+    result->move.x = search_result->square % iteration->thinker->field_width;
+    result->move.y = search_result->square / iteration->thinker->field_width;
+    result->move.next_block_nr = search_result->piece;
+    result->score = search_result->score;
+    result->depth = search_result->depth;
+    result->nodes = iteration->nodes;
+    shm_publish_result(iteration->thinker->shared_memory, result);
+}
 
-    //AI move
-    struct Move ai_move = get_best_move(field, field_size, next_block_nr);
-    printf("Ai chose field: (%i, %i)\n", ai_move.x, ai_move.y);
-    printf("Ai chose block: %i\n", ai_move.next_block_nr);
+// A proven win makes the rest of the search pointless, so it is stopped right away.
+static void *thinker_pns_main(void *arg) {
+    struct Thinker *thinker = arg;
+    int previous_phase = alloc_phase_enter(ALLOC_THINKER_MOVE); // part of the move, see thinker_loop()
+    thinker->pns_status = pns_solve(thinker->pns, &thinker->pns_board, thinker->pns_hand_piece, &thinker->pns_result);
+    alloc_phase_leave(previous_phase);
+    if (thinker->pns_status == PNS_WIN) {
+        atomic_store(&thinker->search->stop, true);
+        if (thinker->mcts != NULL) {
+            atomic_store(&thinker->mcts->stop, true);
+        }
+    }
+    return NULL;
+}
 
-    struct Move move;
-    move.x = ai_move.x;
-    move.y = ai_move.y;
-    move.next_block_nr = ai_move.next_block_nr;
+// Does nothing. Started once by the warm-up, so that glibc caches a thread stack with its thread-local storage
+// and the proof-number threads start without allocating.
+static void *thinker_idle_main(void *arg) {
+    return arg;
+}
 
-    if (write(thinker->pipe_fd, &move, sizeof(move)) == -1) {
-        perror("Error sending move into pipe\n");
-        return;
+// In process mode the connector is our child, so SIGCHLD tells us it has terminated (even if it crashed).
+// Ringing the request doorbell wakes up thinker_loop() no matter where it currently is.
+static struct SharedMemory *signal_shared_memory = NULL;
+static void sigchld_handler(int signum) {
+    (void)signum;
+    if (signal_shared_memory != NULL) {
+        atomic_store(&signal_shared_memory->connector_stopped, true);
+        doorbell_ring(&signal_shared_memory->thinker_request);
     }
 }
 
-struct Move get_best_move(int *field_array, int field_size, int block_nr){
-    //List of not-played fields, to know which field we can move our piece to
-    int fields_num = field_size * field_size;
-    int playable_fields[fields_num];
-    for (int i = 0; i < fields_num; i++) {
-        playable_fields[i] = i;
+// Fault in the pages of memory now instead of during the first search. Locking them also keeps them out of swap;
+// without the privilege (RLIMIT_MEMLOCK), every page is touched instead.
+//
+// Returns true if the pages are locked.
+static bool thinker_prefault(void *memory, size_t size) {
+    if (mlock(memory, size) == 0) {
+        return true;
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    volatile char *bytes = memory;
+    for (size_t offset = 0; offset < size; offset += page_size) {
+        bytes[offset] = bytes[offset];
     }
+    return false;
+}
 
-    //Remove fields that are already played from playable_fields
-    for (int i = 0; i < fields_num; i++) {
-        if (field_array[i] != -1) {
-            remove_element(playable_fields, i, fields_num);
+static void thinker_warm_up(struct Thinker *thinker) {
+    uint64_t start_ns = quarto_now_ns();
+    struct Search *search = thinker->search;
+    bool locked = thinker_prefault(search->table, (search->table_mask + 1) * sizeof(struct SearchEntry));
+    locked &= thinker_prefault(thinker->pns->table, (thinker->pns->table_mask + 1) * sizeof(struct PnsEntry));
+    if (thinker->mcts != NULL) {
+        locked &= thinker_prefault(thinker->mcts->nodes, (size_t)thinker->mcts->capacity * sizeof(struct MctsNode));
+    }
+    if (thinker->book != NULL) {
+        madvise(thinker->book->map, thinker->book->map_size, MADV_WILLNEED); // read ahead in the background
+    }
+
+    // self-test on the empty field of the size the book or network was made for (the field size of the game
+    // is only known with the first move), to get code, branch predictors and the network weights into the caches
+    int width = 4;
+    int height = 4;
+    if (thinker->nnue != NULL) {
+        width = thinker->nnue->field_width;
+        height = thinker->nnue->field_height;
+    } else if (thinker->book != NULL) {
+        width = thinker->book->field_width;
+        height = thinker->book->field_height;
+    }
+    // the move stack would otherwise grow during the first searches of the game; reserved for the largest field
+    // it is ~4 MB of address space, of which only the part that deep searches reach is ever touched
+    search_reserve(search, BOARD_MAX_SIZE, BOARD_MAX_SIZE);
+    // the same for the solver, which would otherwise grow its stack on its own thread in the first sharp position;
+    // ~1 MB for the largest field, small enough to fault in right away
+    if (pns_reserve(thinker->pns, BOARD_MAX_SIZE, BOARD_MAX_SIZE) == 0) {
+        locked &= thinker_prefault(thinker->pns->moves, thinker->pns->moves_capacity * sizeof(struct PnsMove));
+    }
+    pthread_t idle_thread;
+    if (pthread_create(&idle_thread, NULL, thinker_idle_main, NULL) == 0) {
+        pthread_join(idle_thread, NULL);
+    }
+    struct Board board;
+    struct SearchResult result;
+    result.nodes = 0;
+    if (board_init(&board, width, height) == 0) {
+        board_take_piece(&board, 0);
+        uint64_t deadline_ns = quarto_now_ns() + (uint64_t)THINKER_WARMUP_MS * 1000000;
+        struct Nnue *nnue = thinker->nnue;
+        search->nnue = nnue != NULL && nnue->field_width == width && nnue->field_height == height ? nnue : NULL;
+        search->deadline_ns = deadline_ns;
+        atomic_store(&search->stop, false);
+        if (thinker->mcts != NULL) {
+            thinker->mcts->deadline_ns = deadline_ns;
+            atomic_store(&thinker->mcts->stop, false);
+            mcts_set_root(thinker->mcts, &board, 0);
+            mcts_search(thinker->mcts, NULL, NULL, &result);
+        } else {
+            search_iterate(search, &board, 0, 0, NULL, NULL, &result);
         }
+        search_clear(search); // its entries are of no use in the game
     }
 
-    //List of not-played blocks, to know which block we can give to the opponent
-    int playable_blocks[fields_num];
-    for (int i = 0; i < fields_num; i++) {
-        playable_blocks[i] = i;
+    atomic_store(&thinker->shared_memory->thinker_ready, true);
+    log_info("Thinker warmed up in %lu ms (tables %s, self-test %ld nodes)",
+             (unsigned long)((quarto_now_ns() - start_ns) / 1000000), locked ? "locked" : "touched", result.nodes);
+}
+
+static void thinker_apply_settings(struct Thinker *thinker) {
+    struct SharedMemory *shared_memory = thinker->shared_memory;
+    if (shm_settings_generation(shared_memory) == thinker->settings_generation) {
+        return;
     }
 
-    //Remove the block we have to play from playable_blocks
-    remove_element(playable_blocks, block_nr, fields_num);
+    struct EngineSettings settings;
+    shm_get_settings(shared_memory, &settings);
+    thinker->settings_generation = settings.generation;
 
-    //Remove blocks that are already on the field
-    for (int i = 0; i < fields_num; i++) {
-        if (field_array[i] != -1) {
-            remove_element(playable_blocks, field_array[i], fields_num);
+    log_set_level(settings.log_level);
+    placement_apply(&settings.thinker_placement, "thinker");
+
+    int hash_bits = settings.hash_bits > 0 ? settings.hash_bits : SEARCH_TT_BITS;
+    if (hash_bits != thinker->hash_bits) {
+        // the entries of the old table are lost, the next searches refill the new one
+        struct Search *search = search_create(hash_bits);
+        if (search == NULL) {
+            log_warn("Keeping the transposition table of 2^%d entries", thinker->hash_bits);
+        } else {
+            search->external_stop = &shared_memory->thinker_stop;
+            search_reserve(search, BOARD_MAX_SIZE, BOARD_MAX_SIZE);
+            thinker_prefault(search->table, (search->table_mask + 1) * sizeof(struct SearchEntry));
+            search_free(thinker->search);
+            thinker->search = search;
+            thinker->hash_bits = hash_bits;
         }
     }
 
-    //Find winning move
-    int best_field = find_possible_win_on_field(field_array, field_size, block_nr, playable_fields);
-    int best_block = -1;
-    if (best_field == -1) {
-        best_field = find_random_free_field(field_array, fields_num);
-        //No best field found. Picking random field
-
-        //Find best block for opponent
-        field_array[best_field] = block_nr;
-        //Remove fields that are already played from playable_fields
-        remove_element(playable_fields, best_field, fields_num);
-
-        best_block = search_best_block_for_opponent(field_array, field_size, playable_blocks, playable_fields);
-        if (best_block == -1) {
-            //No best block found. Picking random block
-            int blocks_num = count_elements_in_array(playable_blocks, fields_num);
-            int random_block_found = (rand() % blocks_num + 1) - 1;
-            best_block = playable_blocks[random_block_found];
+    if (settings.mcts && thinker->mcts == NULL) {
+        if (thinker_use_mcts(thinker) == 0) {
+            thinker_prefault(thinker->mcts->nodes, (size_t)thinker->mcts->capacity * sizeof(struct MctsNode));
         }
+    } else if (!settings.mcts && thinker->mcts != NULL) {
+        mcts_free(thinker->mcts);
+        thinker->mcts = NULL;
+        log_info("Using the alpha-beta search");
     }
 
-    int best_field_x = best_field % field_size;
-    int best_field_y = best_field / field_size;
-
-    struct Move best_move;
-    best_move.x = best_field_x;
-    best_move.y = best_field_y;
-    best_move.next_block_nr = best_block;
-
-    return best_move;
+    log_info("Thinker applied settings %u (hash_bits %d, strategy %s)", settings.generation, thinker->hash_bits,
+             thinker->mcts != NULL ? "mcts" : "alphabeta");
 }
 
-int find_possible_win_on_field(int *field_array, int field_size, int block_nr, int *playable_fields) {
-    //This function looks one move ahead and checks if there is any move that it can make that is winning
-    int fields_num = field_size * field_size;
-    //Iterate through all possible fields
-    for (int i = 0; i < count_elements_in_array(playable_fields, fields_num); i++) {
-        //Setting up new board position with new move
-        int current_field_array[fields_num];
-        copyArray(field_array, current_field_array, fields_num);
-        int current_field = playable_fields[i];
-        current_field_array[current_field] = block_nr;
-
-        if (is_winning(current_field_array, field_size)) {
-            //Winning move found
-            return current_field;
+int thinker_loop(struct Thinker *thinker) {
+    struct SharedMemory *shared_memory = thinker->shared_memory;
+
+    // as a thread, we only stop when the connector tells us to
+    if (shared_memory->process_shared) {
+        signal_shared_memory = shared_memory;
+        if (signal(SIGCHLD, sigchld_handler) == SIG_ERR) {
+            perror("failed setting SIGCHLD signal handler");
+            return -1;
         }
     }
-    //No Winning move possible
-    return -1;
-}
 
-int search_best_block_for_opponent(int *field_array, int field_size , int *playable_blocks, int *playable_fields) {
-    // This function looks one move ahead and checks, for every block, if there is no winning position,
-    // and if so, give this block
-    // Also: this is happening after we DIDN'T find a "best_field"(=winning field) we play!
-    for (int i = 0; i < count_elements_in_array(playable_blocks, field_size * field_size); i++) {
-        int current_block = playable_blocks[i];
-        if (find_possible_win_on_field(field_array, field_size, current_block, playable_fields) == -1) {
-            //No move is winning with this block, so we use that one
-            return current_block;
+    thinker_warm_up(thinker);
+
+    // the arena starts zeroed, so a request rung before we got here is still noticed
+    unsigned int seen = 0;
+    while (true) {
+        if (atomic_load(&shared_memory->connector_stopped)) {
+            log_info("Stopping thinker loop since connector has stopped.");
+            latency_dump(thinker->latency);
+            return 0;
+        }
+
+        latency_dump_if_requested(thinker->latency);
+        if (doorbell_peek(&shared_memory->thinker_request) == seen) {
+            thinker_apply_settings(thinker); // not while a request waits, a new table takes a while
+        }
+
+        int wait_ret = doorbell_wait(&shared_memory->thinker_request, seen, THINKER_IDLE_POLL_MS);
+        if (wait_ret < 0) {
+            metrics_add(shared_memory->metrics.ipc_errors, 1);
+            return -1;
+        }
+        if (wait_ret == DOORBELL_TIMEOUT) {
+            continue;
+        }
+
+        unsigned int request = doorbell_peek(&shared_memory->thinker_request);
+        if (request == seen || atomic_load(&shared_memory->connector_stopped)) {
+            continue;
+        }
+        seen = request;
+
+        // a stop belongs to the request it was set for; the search for the previous one has returned by now.
+        // If the connector has already given up on this request, the stop stays set (both seq_cst: either we
+        // see its thinker_stop_request, or its thinker_stop comes after our store)
+        atomic_store(&shared_memory->thinker_stop, false);
+        if (atomic_load(&shared_memory->thinker_stop_request) == request) {
+            atomic_store(&shared_memory->thinker_stop, true);
+        }
+
+        latency_begin(thinker->latency);
+        latency_record(thinker->latency, LATENCY_THINKER_WAKEUP, thinker->latency->last_ns - shared_memory->request_time_ns);
+        uint64_t search_start_ns = thinker->latency->last_ns;
+        int previous_phase = alloc_phase_enter(ALLOC_THINKER_MOVE);
+        long nodes = thinker_think(thinker, request);
+        alloc_phase_leave(previous_phase);
+        latency_mark(thinker->latency, LATENCY_THINKER_SEARCH);
+
+        uint64_t search_ns = thinker->latency->last_ns - search_start_ns;
+        metrics_add(shared_memory->metrics.search_time_us, search_ns / 1000);
+        metrics_add(shared_memory->metrics.nodes, nodes);
+        if (search_ns > 0) {
+            metrics_set(shared_memory->metrics.last_nodes_per_second, (unsigned long)(nodes * 1e9 / search_ns));
         }
     }
-    return -1;
 }
 
-void copyArray(int *old_array, int *new_array, int old_array_size) {
-    // loop to iterate through array
-    for (int i = 0; i < old_array_size; ++i) {
-        new_array[i] = old_array[i];
+long thinker_think(struct Thinker *thinker, unsigned int request) {
+    shm_get_field(thinker->shared_memory, thinker->field, &thinker->field_width, &thinker->field_height);
+
+    //Print board
+    print_board(thinker);
+    char *player_name = shm_get_player_name(thinker->shared_memory);
+    log_debug("Thinker is thinking for player '%s'...", player_name);
+
+    int next_block_nr = thinker->shared_memory->move_block_nr;
+    int *field = thinker->field;
+    int width = thinker->field_width;
+    int height = thinker->field_height;
+
+    struct MoveResult result;
+    result.request = request;
+    result.final = false;
+    result.score = 0;
+    result.depth = 0;
+    result.nodes = 0;
+
+    if (thinker_book_move(thinker, &result) == 0) {
+        log_info("Book move: field (%i, %i), block: %i", result.move.x, result.move.y, result.move.next_block_nr);
+        shm_publish_result(thinker->shared_memory, &result);
+        return 0;
     }
-}
 
-void print_board(struct Thinker *thinker) {
-    int field_size = thinker->shared_memory->field_size;
-    int *field = shm_get_field(thinker->shared_memory);
-
-    printf("\n\n");
-    char* nextBlock = int_to_binary_str(thinker->shared_memory->move_block_nr, field_size);
-    printf("We have to move block %s %d in %dms.\n", nextBlock, thinker->shared_memory->move_block_nr, thinker->shared_memory->move_timeout);
-    free(nextBlock);
-    printf("\n");
-
-    for (int y = field_size - 1; y >= 0; y--) {
-        printf("%2d  ", y+1);
-        for (int x = 0; x < field_size; x++) {
-            int block = field[y*field_size + x];
-            char* binary = int_to_binary_str(block, field_size);
-            printf("%s ", binary);
-            free(binary);
-        }
-        printf("\n");
+    // publish any legal move right away, so the connector always has something to send
+    result.move = get_any_move(field, width, height, next_block_nr);
+    shm_publish_result(thinker->shared_memory, &result);
+
+    struct Board board;
+    if (board_from_field(&board, field, width, height, next_block_nr) != 0) {
+        log_warn("Invalid board, sending the first legal move.");
+        result.final = true;
+        shm_publish_result(thinker->shared_memory, &result);
+        return 0;
     }
-    printf("   ");
-    for (int x = 0; x < field_size; x++) {
-        printf("  %c  ", 'A' + x);
+
+    // iterative deepening until the deadline; every completed iteration is published as the new best-so-far move
+    struct Search *search = thinker->search;
+    uint64_t request_time_ns = thinker->shared_memory->request_time_ns;
+    uint64_t move_deadline_ns = thinker->shared_memory->move_deadline_ns;
+    search->deadline_ns = move_deadline_ns > request_time_ns
+                          ? request_time_ns + (move_deadline_ns - request_time_ns) * THINKER_TIME_PERCENT / 100 : request_time_ns;
+    atomic_store(&search->stop, false);
+    struct Nnue *nnue = thinker->nnue;
+    search->nnue = nnue != NULL && nnue->field_width == width && nnue->field_height == height ? nnue : NULL;
+    struct Mcts *mcts = thinker->mcts;
+    if (mcts != NULL) {
+        mcts->deadline_ns = search->deadline_ns;
+        atomic_store(&mcts->stop, false);
     }
-    printf("\n\n");
-}
 
-void remove_element(int *array, int element, int array_size) {
-    int index = find_index(array, element, array_size);
-    for (int i = index; i < array_size; i++) {
-        if (i == array_size - 1){
-            array[i] = -1;
-        } else{
-            array[i] = array[i + 1];
+    bool pns_running = false;
+    if (pns_is_sharp(&board)) {
+        memcpy(&thinker->pns_board, &board, sizeof(struct Board));
+        thinker->pns_hand_piece = next_block_nr;
+        thinker->pns_status = PNS_UNKNOWN;
+        thinker->pns->deadline_ns = search->deadline_ns;
+        atomic_store(&thinker->pns->stop, false);
+        int pthread_ret = pthread_create(&thinker->pns_thread, NULL, thinker_pns_main, thinker);
+        if (pthread_ret != 0) {
+            log_warn("Error creating proof-number search thread: %s", strerror(pthread_ret));
+        } else {
+            pns_running = true;
         }
     }
-}
 
-int find_index (const int *array, int target, int array_size) {
-    int i = 0;
-    while ((i < array_size) && (array[i] != target)) i++;
-
-    return (i < array_size) ? (i) : (-1);
-}
-
-int find_random_free_field(const int *field_array, int array_size) {
-    for(int i = 0; i < 1000; i++){
-        srand(i);
-        int random_index = (rand() % array_size + 1) - 1;
-        if (field_array[random_index] != -1) {
-            continue;
+    struct ThinkerIteration iteration = {thinker, &result, 0};
+    struct SearchResult search_result;
+    long nodes;
+    if (mcts != NULL) {
+        // the subtree below our last move and the opponent's reply still holds the simulations of the last search
+        bool reused = mcts_set_root(mcts, &board, next_block_nr);
+        long reused_visits = reused ? (long)mcts->nodes[mcts->root].visits : 0;
+        if (mcts_search(mcts, thinker_publish_simulations, &iteration, &search_result) == 0) {
+            thinker_publish_simulations(&iteration, &search_result);
         }
+        nodes = search_result.nodes;
+        log_debug("Monte Carlo tree search: %ld simulations (%ld reused), depth %d, score %d", nodes, reused_visits,
+                  search_result.depth, search_result.score);
+    } else {
+        // the workers search their share of the root squares meanwhile; the iterations published until then
+        // only cover our own share
+        struct Cluster *cluster = thinker->cluster;
+        uint64_t local_squares = 0;
+        int jobs = cluster != NULL && cluster->count > 0
+                   ? cluster_start(cluster, &board, next_block_nr, search->deadline_ns, &local_squares) : 0;
+        search->root_squares = jobs > 0 ? local_squares : 0;
+        search_iterate(search, &board, next_block_nr, 0, thinker_publish_iteration, &iteration, &search_result);
+        search->root_squares = 0;
+        if (jobs > 0) {
+            int answers = cluster_collect(cluster, search->deadline_ns, &search_result);
+            if (search_result.square >= 0) {
+                result.move.x = search_result.square % width;
+                result.move.y = search_result.square / width;
+                result.move.next_block_nr = search_result.piece;
+                result.score = search_result.score;
+                result.depth = search_result.depth;
+            }
+            log_debug("%d of %d workers answered, %d left", answers, jobs, cluster->count);
+        }
+        nodes = search_result.nodes;
+    }
 
-        return random_index;
+    if (pns_running) {
+        atomic_store(&thinker->pns->stop, true);
+        pthread_join(thinker->pns_thread, NULL);
+        nodes += thinker->pns_result.nodes;
+
+        // a win found by the search itself also tells the fastest way, so it is kept
+        if (thinker->pns_status == PNS_WIN && result.score <= SEARCH_WIN_THRESHOLD) {
+            struct SearchResult *proven = &thinker->pns_result;
+            result.move.x = proven->square % width;
+            result.move.y = proven->square / width;
+            result.move.next_block_nr = proven->piece;
+            result.score = proven->score;
+            result.depth = proven->depth;
+            log_info("Proof-number search proved a forced win after %ld nodes", proven->nodes);
+        } else {
+            log_debug("Proof-number search: %s after %ld nodes", thinker->pns_status == PNS_NO_WIN ? "no forced win"
+                      : thinker->pns_status == PNS_WIN ? "win" : "unknown", thinker->pns_result.nodes);
+        }
     }
-    return -1;
+
+    log_info("Ai chose field: (%i, %i), block: %i", result.move.x, result.move.y, result.move.next_block_nr);
+    result.final = true;
+    result.nodes = nodes;
+    shm_publish_result(thinker->shared_memory, &result);
+    return nodes;
 }
 
-bool is_winning(int *field_array, int field_size) {
-    //Pointer array to contain all lines
-    int *all_lines[field_size * 2 + 2];
-    int *dia1 = malloc(sizeof (int) * field_size);
-    int *dia2 = malloc(sizeof (int) * field_size);
-
-    for (int i = 0; i < field_size; i++) {
-        int *row = malloc(sizeof (int) * field_size);
-        int *col = malloc(sizeof (int) * field_size);
-        dia1[i] = field_array[i * (1 + field_size)];
-        dia2[i] = field_array[field_size * (field_size - 1) - (i * (field_size - 1))];
-        for (int j = 0; j < field_size; j++) {
-            row[j] =  field_array[i *field_size + j];
-            col[j] = field_array[j * field_size + i];
-        }
-        all_lines[i + 2] = row;
-        all_lines[i + 2 + field_size] = col;
+struct Move get_any_move(const int *field_array, int width, int height, int block_nr) {
+    int fields_num = width * height;
+    int blocks_num = 1 << board_attributes(width, height);
+    uint64_t block_used[BOARD_MAX_PIECES / 64] = {0};
+    int free_fields = 0;
+
+    struct Move move;
+    move.x = -1;
+    move.y = -1;
+    move.next_block_nr = -1;
 
+    if (block_nr >= 0 && block_nr < blocks_num) {
+        block_used[block_nr / 64] |= 1ULL << (block_nr % 64);
     }
-    all_lines[0] = dia1;
-    all_lines[1] = dia2;
 
-    for (int i = 0; i < field_size * 2 + 2; i++) {
-        int *line = all_lines[i];
-        int count = 0;
-        for (int j = 0; j < field_size; j++) {
-            if (line[j] != -1) {
-                count ++;
+    for (int i = 0; i < fields_num; i++) {
+        if (field_array[i] == -1) {
+            free_fields++;
+            if (move.x == -1) {
+                move.x = i % width;
+                move.y = i / width;
             }
+        } else if (field_array[i] >= 0 && field_array[i] < blocks_num) {
+            block_used[field_array[i] / 64] |= 1ULL << (field_array[i] % 64);
         }
-        if (count == field_size) {
-            if(compare_line(line, field_size)){
-                for (int j = 0; j < field_size * 2 + 2; j++) {
-                    free(all_lines[j]);
-                }
-                return true;
+    }
+
+    // after placing on the last free field, there is no block left to give
+    if (free_fields > 1) {
+        for (int i = 0; i < blocks_num; i++) {
+            if (!(block_used[i / 64] >> (i % 64) & 1)) {
+                move.next_block_nr = i;
+                break;
             }
         }
     }
-    for (int i = 0; i < field_size * 2 + 2; i++) {
-        free(all_lines[i]);
-    }
 
-    return false;
+    return move;
 }
 
-bool compare_line(int *line, int field_size){
-    int blocks[field_size];
-    for (int i = 0; i < field_size; i++) {
-        blocks[i] = line[i];
+struct Move get_safe_move(const int *field_array, int width, int height, int block_nr) {
+    struct Move move = get_any_move(field_array, width, height, block_nr);
+    struct Board board;
+    if (block_nr < 0 || board_from_field(&board, field_array, width, height, block_nr) != 0) {
+        return move;
     }
 
-    for (int i = 0; i < field_size; i++) {
-        int sum = 0;
-        for (int j = 0; j < field_size; j++) {
-            sum += ((blocks[j] & (1<<i))>>i);
+    // a completed line ends the game, no piece is handed over
+    for (uint64_t f = board_free_squares(&board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        if (board_wins_with(&board, square, block_nr)) {
+            move.x = square % width;
+            move.y = square / width;
+            move.next_block_nr = -1;
+            return move;
         }
-        if (sum == 0 || sum == field_size) {
+    }
 
-            return true;
+    // otherwise a placement and a piece the opponent can't win with right away
+    for (uint64_t f = board_free_squares(&board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        int ones;
+        int zeros;
+        board_place(&board, square, block_nr);
+        board_threats(&board, &ones, &zeros);
+        board_remove(&board, square);
+        for (int w = 0; w < (board.piece_count + 63) / 64; w++) {
+            for (uint64_t p = board.pieces_left[w]; p != 0; p &= p - 1) {
+                int piece = w * 64 + __builtin_ctzll(p);
+                if (board_piece_safe(&board, piece, ones, zeros)) {
+                    move.x = square % width;
+                    move.y = square / width;
+                    move.next_block_nr = piece;
+                    return move;
+                }
+            }
         }
     }
-    return false;
+    return move;
 }
 
-void print_array(const int *array, int array_size) {
-    for (int i = 0; i < array_size; i++) {
-        printf("%i: %i\n", i, array[i]);
+// Binary log record of a board, rendered by print_board_record() on the log flusher thread.
+struct BoardRecord {
+    int field_width;
+    int field_height;
+    int block_nr;
+    int move_timeout;
+    short field[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+};
+
+static void print_board_record(FILE *out, const void *data, int length) {
+    (void)length;
+    const struct BoardRecord *record = data;
+    int width = record->field_width;
+    int height = record->field_height;
+    int attributes = board_attributes(width, height);
+    char binary[BOARD_MAX_ATTRIBUTES + 1];
+
+    fprintf(out, "\n\n");
+    block_to_binary_str(record->block_nr, attributes, binary);
+    fprintf(out, "We have to move block %s %d in %dms.\n", binary, record->block_nr, record->move_timeout);
+    fprintf(out, "\n");
+
+    for (int y = height - 1; y >= 0; y--) {
+        fprintf(out, "%2d  ", y+1);
+        for (int x = 0; x < width; x++) {
+            block_to_binary_str(record->field[y*width + x], attributes, binary);
+            fprintf(out, "%s ", binary);
+        }
+        fprintf(out, "\n");
     }
+    fprintf(out, "   ");
+    for (int x = 0; x < width; x++) {
+        fprintf(out, " %*c%*s", (attributes + 1) / 2, 'A' + x, attributes / 2, "");
+    }
+    fprintf(out, "\n\n");
 }
 
-int count_elements_in_array(const int *array, int array_size) {
-    int count = 0;
-    for (int i = 0; i < array_size; i++) {
-        if (array[i] != -1) {
-            count++;
-        }
+void print_board(struct Thinker *thinker) {
+    struct BoardRecord record;
+    record.field_width = thinker->field_width;
+    record.field_height = thinker->field_height;
+    record.block_nr = thinker->shared_memory->move_block_nr;
+    record.move_timeout = thinker->shared_memory->move_timeout;
+    for (int i = 0; i < thinker->field_width * thinker->field_height; i++) {
+        record.field[i] = thinker->field[i];
     }
-    return count;
+
+    log_binary(LOG_LEVEL_INFO, print_board_record, &record, sizeof(record));
 }
 
-char *int_to_binary_str(int block, int field_size) {
-    char *binary = malloc(sizeof(char) * (field_size+1));
-    binary[field_size] = '\0';
+void block_to_binary_str(int block, int attributes, char *binary) {
+    binary[attributes] = '\0';
 
-    for (int i = 0; i < field_size; i++) {
+    for (int i = 0; i < attributes; i++) {
         if (block < 0) {
             binary[i] = '*';
-        } else if ((block >> (field_size-i-1)) % 2 == 0) {
+        } else if ((block >> (attributes-i-1)) % 2 == 0) {
             binary[i] = '0';
         } else {
             binary[i] = '1';
         }
     }
-    return binary;
 }
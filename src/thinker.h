@@ -1,64 +1,115 @@
 #ifndef thinker_h
 #define thinker_h
 
+#include <pthread.h>
+
+#include "book.h"
+#include "cluster.h"
+#include "latency.h"
+#include "mcts.h"
+#include "pns.h"
+#include "search.h"
 #include "shm.h"
 
+// How often the idle thinker checks whether a latency dump was requested (SIGUSR2)
+#define THINKER_IDLE_POLL_MS 200
+// Share of the time until the connector's deadline (move timeout minus move margin, counted from "+ MOVE") that
+// the search may use; the rest is for stopping the proof-number search and publishing the final move
+#define THINKER_TIME_PERCENT 90
+// Time the self-test search of the warm-up may take, see thinker_loop()
+#define THINKER_WARMUP_MS 100
+
 struct Thinker {
     struct SharedMemory *shared_memory;
-    int pipe_fd;
+    struct Latency *latency;
+    struct Book *book; // opening book, NULL if none is loaded
+    struct Search *search;
+    int hash_bits; // size of search's transposition table as power of two
+    struct Nnue *nnue; // evaluation network, NULL if none is loaded
+    struct Mcts *mcts; // Monte Carlo tree search used instead of the alpha-beta search, NULL if not enabled
+    struct Cluster *cluster; // workers that search a share of the root squares, NULL if none
+    unsigned int settings_generation; // of the engine settings in use, see shm_get_settings()
+
+    // proof-number search, run on its own thread next to the search in sharp positions
+    struct Pns *pns;
+    pthread_t pns_thread;
+    struct Board pns_board;
+    int pns_hand_piece;
+    int pns_status;
+    struct SearchResult pns_result;
+
+    // snapshot of the board slot, taken at the start of thinker_think()
+    int field[MAX_FIELD_SIZE * MAX_FIELD_SIZE];
+    int field_width;
+    int field_height;
 };
 
 // Create a new thinker
 // 
 // shared_memory: Shared memory
-// pipe_fd: File descriptor of writing pipe to write thinker results
 // 
-// Returns pointer to Thinker which must be freed after use
-struct Thinker *thinker_create(struct SharedMemory *shared_memory, int pipe_fd);
+// Returns pointer to Thinker which must be freed with thinker_free() after use
+struct Thinker *thinker_create(struct SharedMemory *shared_memory);
 
-// Start loop that responds to SIGUSR1 events by thinking and ends when the connector stops.
-//
-// thinker: The thinker that will be used
+// Free thinker (but not its shared memory).
+void thinker_free(struct Thinker *thinker);
+
+// Answer positions found in the opening book at path from the book instead of searching.
 //
 // Returns 0 on success, -1 otherwise.
-int thinker_loop(struct Thinker *thinker);
-
-// Calculate next move and write it into pipe
-void thinker_think(struct Thinker *thinker);
+int thinker_load_book(struct Thinker *thinker, char *path);
 
-struct Move {
-    int x;
-    int y;
-    int next_block_nr;
-};
+// Evaluate positions at the search horizon with the network at path (if it was trained for the field size played).
+//
+// Returns 0 on success, -1 otherwise.
+int thinker_load_nnue(struct Thinker *thinker, char *path);
 
-struct Move get_best_move(int *field_array, int field_size, int block_nr);
+// Search with Monte Carlo tree search instead of alpha-beta; its tree is kept between the moves of a game.
+//
+// Returns 0 on success, -1 otherwise.
+int thinker_use_mcts(struct Thinker *thinker);
 
-struct Move get_random_move(int *field_array, int field_size, int block_nr);
+// Let the workers at addresses (separated by commas, see cluster.h) search a share of the root squares
+// of every alpha-beta search.
+//
+// Returns 0 if at least one worker is connected, -1 otherwise.
+int thinker_connect_workers(struct Thinker *thinker, char *addresses);
 
-void copyArray(int *old_array, int *new_array, int old_array_size);
+// Start loop that responds to rings of the thinker_request doorbell by thinking and ends when the connector stops.
+// Before waiting for the first request (while the connector still connects and runs the handshake), the thinker
+// warms up: it faults in and tries to lock its tables, has the book read ahead and runs a short self-test search,
+// so the first move isn't slower than the others. thinker_ready in the shared memory is set afterwards.
+//
+// thinker: The thinker that will be used
+//
+// Returns 0 on success, -1 otherwise.
+int thinker_loop(struct Thinker *thinker);
 
-int search_best_block_for_opponent(int *field_array, int fields_num , int *playable_blocks, int *playable_fields);
+// Calculate next move and publish it into the result slot.
+// Book moves are published as final right away. Otherwise a quick legal move is published first,
+// then the move of every completed iteration of the iterative deepening search (or the most visited move
+// of the Monte Carlo tree search every MCTS_REPORT_INTERVAL simulations); the last one is marked as final.
+// In sharp positions (see pns_is_sharp()), a proof-number search tries to prove a forced win meanwhile;
+// once it does, the search is stopped and the proven move is published as final instead.
+//
+// request: Sequence number of the thinker_request ring that is answered
+//
+// Returns the number of nodes searched.
+long thinker_think(struct Thinker *thinker, unsigned int request);
 
-int find_possible_win_on_field(int *field_array, int field_size, int block_nr, int *playable_fields);
+// Returns the first legal move without any search.
+struct Move get_any_move(const int *field_array, int width, int height, int block_nr);
 
-void print_array(const int *array, int array_size);
+// Returns a winning move if there is one, otherwise a move that hands over a piece the opponent can't win with
+// right away (if there is such a piece), otherwise the first legal move. Doesn't allocate, so the connector
+// can use it as last resort when the thinker misses the deadline.
+struct Move get_safe_move(const int *field_array, int width, int height, int block_nr);
 
+// Logs the board snapshot of the thinker; only a binary copy is taken here, rendering happens on the log flusher thread.
 void print_board(struct Thinker *thinker);
 
-int find_random_free_field(const int *field_array, int array_size);
-
-int find_index (const int *array, int target, int array_size);
-
-bool compare_line(int *line, int field_size);
-
-bool is_winning(int *field, int field_size);
-
-int count_elements_in_array(const int *array, int array_size);
-
-void remove_element(int *array, int index, int array_size);
-
-char *int_to_binary_str(int block, int field_size);
+// Writes block as string of its attribute bits, most significant first (all '*' for no block),
+// into binary (at least attributes + 1 chars).
+void block_to_binary_str(int block, int attributes, char *binary);
 
 #endif
-
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "quarto.h"
+#include "trace.h"
+
+static void trace_put_varint(FILE *file, uint64_t value) {
+    while (value >= 0x80) {
+        putc_unlocked((int)(value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    putc_unlocked((int)value, file);
+}
+
+// Returns 0 on success, -1 on EOF or overlong varint.
+static int trace_get_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc_unlocked(file);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static struct Trace *trace_new(FILE *file) {
+    struct Trace *trace = malloc(sizeof(struct Trace));
+    if (trace == NULL) {
+        perror("trace malloc failed");
+        fclose(file);
+        return NULL;
+    }
+
+    trace->file = file;
+    trace->last_us = quarto_now_ns() / 1000;
+    return trace;
+}
+
+struct Trace *trace_create(char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Error creating trace file");
+        return NULL;
+    }
+
+    if (fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LENGTH, file) != TRACE_MAGIC_LENGTH) {
+        perror("Error writing trace file");
+        fclose(file);
+        return NULL;
+    }
+
+    return trace_new(file);
+}
+
+struct Trace *trace_open(char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Error opening trace file");
+        return NULL;
+    }
+
+    char magic[TRACE_MAGIC_LENGTH];
+    if (fread(magic, 1, TRACE_MAGIC_LENGTH, file) != TRACE_MAGIC_LENGTH || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LENGTH) != 0) {
+        printf("%s is not a trace file\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    return trace_new(file);
+}
+
+int trace_write(struct Trace *trace, int direction, const char *data, int length) {
+    uint64_t now = quarto_now_ns() / 1000;
+
+    putc_unlocked(direction, trace->file);
+    trace_put_varint(trace->file, now - trace->last_us);
+    trace_put_varint(trace->file, (uint64_t)length);
+    trace->last_us = now;
+
+    if (fwrite(data, 1, length, trace->file) != (size_t)length) {
+        perror("Error writing trace file");
+        return -1;
+    }
+    return 0;
+}
+
+int trace_read(struct Trace *trace, struct TraceRecord *record) {
+    int direction = getc_unlocked(trace->file);
+    if (direction == EOF) {
+        return 0;
+    }
+
+    uint64_t length;
+    if ((direction != TRACE_RECEIVED && direction != TRACE_SENT)
+            || trace_get_varint(trace->file, &record->delta_us) != 0
+            || trace_get_varint(trace->file, &length) != 0
+            || length > TRACE_MAX_RECORD_LENGTH
+            || fread(record->data, 1, length, trace->file) != length) {
+        printf("Malformed trace record\n");
+        return -1;
+    }
+
+    record->direction = direction;
+    record->length = (int)length;
+    return 1;
+}
+
+void trace_close(struct Trace *trace) {
+    fclose(trace->file);
+    free(trace);
+}
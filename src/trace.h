@@ -0,0 +1,57 @@
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Binary protocol trace: every chunk of bytes received from or sent to the server, with timestamps.
+//
+// File format: TRACE_MAGIC, then one record per chunk:
+//   1 byte direction (TRACE_RECEIVED or TRACE_SENT)
+//   varint microseconds since the previous record (since the start of the trace for the first one)
+//   varint length, followed by length data bytes
+// Varints are LEB128 encoded (7 bits per byte, least significant first, high bit set if more bytes follow).
+#define TRACE_MAGIC "QTRACE1\n"
+#define TRACE_MAGIC_LENGTH 8
+
+#define TRACE_RECEIVED 0
+#define TRACE_SENT 1
+
+#define TRACE_MAX_RECORD_LENGTH 65536
+
+struct Trace {
+    FILE *file;
+    uint64_t last_us;
+};
+
+struct TraceRecord {
+    int direction;
+    uint64_t delta_us;
+    int length;
+    char data[TRACE_MAX_RECORD_LENGTH];
+};
+
+// Create a trace file for recording. Must be closed with trace_close().
+//
+// Returns NULL on error.
+struct Trace *trace_create(char *path);
+
+// Open a trace file for reading (checks the magic). Must be closed with trace_close().
+//
+// Returns NULL on error.
+struct Trace *trace_open(char *path);
+
+// Append a record. Buffered, so it only costs a copy on the hot path.
+//
+// Returns 0 on success, -1 otherwise.
+int trace_write(struct Trace *trace, int direction, const char *data, int length);
+
+// Read the next record into record.
+//
+// Returns 1 if a record was read, 0 at the end of the trace and -1 on a malformed trace.
+int trace_read(struct Trace *trace, struct TraceRecord *record);
+
+// Flush and close the trace file and free trace.
+void trace_close(struct Trace *trace);
+
+#endif
@@ -0,0 +1,564 @@
+// Analyzes many positions on all cores: runs the search on each position to a fixed depth and/or time limit
+// and writes the best move (or all moves ranked, multi-PV) with its score.
+//
+// Input: one position per line, the cells as in the "+ FIELD" rows of the server (top row first, left to right,
+// '*' for empty) followed by the piece to place, e.g. "* * * * * 3 * * * * 12 * 0 * * 5 7" for 4x4.
+// Boards are square unless -s gives another size. Empty lines and lines starting with '#' are skipped.
+//
+// Output (in input order): "<line> <depth> <nodes> <move> <score> [<move> <score> ...]" with moves in PLAY
+// notation (e.g. "B3,7", or "B3" if no piece is handed over), best first; "<line> invalid" for unusable lines.
+// Throughput is reported on stderr.
+//
+// Usage: quarto-analyze [-d depth] [-T ms] [-m moves] [-s size] [-j threads] [-t table bits] [input file]
+//   -d  search depth in plies (default 5, or unlimited with -T)
+//   -T  time limit per position in milliseconds (the first iteration always completes)
+//   -m  number of ranked moves to print, 0 for all (default 1: only the best move)
+//   -s  field size of all positions as N or WxH, e.g. 5x4 (default: square, from the number of cells)
+//   -j  worker threads (default: number of online CPUs)
+//   -t  transposition table size per thread as power of two (default SEARCH_TT_BITS)
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "quarto.h"
+#include "search.h"
+
+#define ANALYZE_BATCH_SIZE 64 // positions per work item
+#define ANALYZE_BATCHES_PER_THREAD 4 // batches read ahead (or waiting to be written) per worker
+
+struct AnalyzeOptions {
+    int depth;
+    int time_ms;
+    int multipv;
+    int width; // 0 for square boards of any size
+    int height;
+};
+
+struct AnalyzePosition {
+    long line;
+    bool valid;
+    int width;
+    int height;
+    int hand_piece;
+    int16_t field[BOARD_MAX_SQUARES];
+};
+
+struct AnalyzeBatch {
+    long seq;
+    int count;
+    struct AnalyzePosition positions[ANALYZE_BATCH_SIZE];
+    char *output; // filled by the worker, written in seq order
+    size_t output_size;
+    struct AnalyzeBatch *next;
+};
+
+// Batches go from the reader through the pending list to a worker, then into the done list (sorted by seq)
+// until all earlier batches are written. in_flight bounds the memory no matter how large the input is.
+struct AnalyzeQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    struct AnalyzeBatch *pending_head;
+    struct AnalyzeBatch *pending_tail;
+    struct AnalyzeBatch *done;
+    long next_write_seq;
+    int in_flight;
+    int max_in_flight;
+    bool closed; // no more batches will be added
+    FILE *out;
+    struct AnalyzeOptions options;
+};
+
+// One root move with its score from the view of the side to move.
+struct AnalyzeMove {
+    int square;
+    int piece;
+    int score;
+    int order; // generation order, keeps the ranking stable for equal scores
+};
+
+struct AnalyzeWorker {
+    pthread_t thread;
+    struct AnalyzeQueue *queue;
+    struct Search *search;
+    struct AnalyzeMove *moves; // root moves for multi-PV
+    long nodes;
+    bool failed;
+};
+
+// Returns 0 on success, -1 if the line is not a position.
+static int analyze_parse(char *line, const struct AnalyzeOptions *options, struct AnalyzePosition *position) {
+    int values[BOARD_MAX_SQUARES + 1];
+    int count = 0;
+    char *save = NULL;
+    for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save)) {
+        if (count == BOARD_MAX_SQUARES + 1) {
+            return -1;
+        }
+        if (strcmp(token, "*") == 0) {
+            values[count++] = -1;
+            continue;
+        }
+        char *end;
+        long value = strtol(token, &end, 10);
+        if (*end != '\0' || value < 0 || value >= BOARD_MAX_PIECES) {
+            return -1;
+        }
+        values[count++] = (int)value;
+    }
+
+    int width = options->width;
+    int height = options->height;
+    if (width == 0) {
+        width = 1;
+        while (width * width < count - 1) {
+            width++;
+        }
+        height = width;
+    }
+    if (count < 2 || width * height != count - 1 || width > BOARD_MAX_SIZE || values[count - 1] < 0) {
+        return -1;
+    }
+
+    // rows come top row first, as in the FIELD message
+    position->width = width;
+    position->height = height;
+    position->hand_piece = values[count - 1];
+    for (int i = 0; i < width * height; i++) {
+        int y = height - 1 - i / width;
+        position->field[y * width + i % width] = values[i];
+    }
+    return 0;
+}
+
+static int analyze_compare_moves(const void *a, const void *b) {
+    const struct AnalyzeMove *move_a = a;
+    const struct AnalyzeMove *move_b = b;
+    if (move_a->score != move_b->score) {
+        return move_b->score - move_a->score;
+    }
+    return move_a->order - move_b->order;
+}
+
+// Score of placing hand_piece on square and handing over piece, searched to depth plies in total.
+//
+// Returns 0 on success, -1 if the search was stopped.
+static int analyze_move(struct AnalyzeWorker *worker, struct Board *board, int hand_piece, int depth,
+                        struct AnalyzeMove *move) {
+    if (board_wins_with(board, move->square, hand_piece)) {
+        move->score = SEARCH_WIN;
+        return 0;
+    }
+    if (move->piece == BOARD_NO_PIECE) {
+        move->score = 0; // last piece placed without a win: draw
+        return 0;
+    }
+
+    board_place(board, move->square, hand_piece);
+    board_take_piece(board, move->piece);
+    int ret = 0;
+    if (depth == 1) {
+        // the opponent only gets to check for an immediate win
+        move->score = 0;
+        for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+            if (board_wins_with(board, __builtin_ctzll(f), move->piece)) {
+                move->score = -(SEARCH_WIN - 1);
+                break;
+            }
+        }
+    } else {
+        struct SearchResult result;
+        ret = search_root(worker->search, board, move->piece, depth - 1, &result);
+        worker->nodes += result.nodes;
+        // one ply further from the root than from the child
+        move->score = -result.score;
+        if (move->score > SEARCH_WIN_THRESHOLD) {
+            move->score--;
+        } else if (move->score < -SEARCH_WIN_THRESHOLD) {
+            move->score++;
+        }
+    }
+    board_return_piece(board, move->piece);
+    board_remove(board, move->square);
+    return ret;
+}
+
+// All root moves; a winning square is listed once (without a piece to hand over).
+//
+// Returns the number of moves.
+static int analyze_generate(struct Board *board, int hand_piece, struct AnalyzeMove *moves) {
+    int count = 0;
+    for (uint64_t f = board_free_squares(board); f != 0; f &= f - 1) {
+        int square = __builtin_ctzll(f);
+        bool any_piece = false;
+        if (!board_wins_with(board, square, hand_piece)) {
+            for (int piece = 0; piece < board->piece_count; piece++) {
+                if (board_piece_left(board, piece)) {
+                    moves[count] = (struct AnalyzeMove){square, piece, 0, count};
+                    count++;
+                    any_piece = true;
+                }
+            }
+        }
+        if (!any_piece) {
+            moves[count] = (struct AnalyzeMove){square, BOARD_NO_PIECE, 0, count};
+            count++;
+        }
+    }
+    return count;
+}
+
+static void analyze_print_move(FILE *out, const struct Board *board, int square, int piece, int score) {
+    fprintf(out, " %c%d", 'A' + square % board->width, 1 + square / board->width);
+    if (piece != BOARD_NO_PIECE) {
+        fprintf(out, ",%d", piece);
+    }
+    fprintf(out, " %d", score);
+}
+
+// Iterative deepening up to the depth limit (and the free squares) or until the time is up;
+// the result of the last completed iteration is printed.
+static void analyze_position(struct AnalyzeWorker *worker, struct AnalyzePosition *position, FILE *out,
+                             struct AnalyzeMove *moves) {
+    const struct AnalyzeOptions *options = &worker->queue->options;
+    struct Search *search = worker->search;
+    int field[BOARD_MAX_SQUARES];
+    struct Board board;
+    for (int s = 0; s < position->width * position->height; s++) {
+        field[s] = position->field[s];
+    }
+    if (board_from_field(&board, field, position->width, position->height, position->hand_piece) != 0
+        || board_free_squares(&board) == 0) {
+        fprintf(out, "%ld invalid\n", position->line);
+        return;
+    }
+
+    long start_nodes = worker->nodes;
+    int free_squares = __builtin_popcountll(board_free_squares(&board));
+    int max_depth = options->depth > 0 && options->depth < free_squares ? options->depth : free_squares;
+    uint64_t deadline_ns = options->time_ms > 0 ? quarto_now_ns() + (uint64_t)options->time_ms * 1000000 : 0;
+    bool all_moves = options->multipv != 1;
+    int count = all_moves ? analyze_generate(&board, position->hand_piece, moves) : 0;
+
+    struct SearchResult best = {-1, BOARD_NO_PIECE, 0, 0, 0};
+    int completed_depth = 0;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        search->deadline_ns = depth == 1 ? 0 : deadline_ns;
+        if (all_moves) {
+            int ret = 0;
+            int scores[count];
+            for (int i = 0; i < count && ret == 0; i++) {
+                struct AnalyzeMove move = moves[i];
+                ret = analyze_move(worker, &board, position->hand_piece, depth, &move);
+                scores[i] = move.score;
+            }
+            if (ret != 0) {
+                break;
+            }
+            for (int i = 0; i < count; i++) {
+                moves[i].score = scores[i];
+            }
+            // the next iteration tries the best moves first, so the table is filled by them
+            qsort(moves, count, sizeof(struct AnalyzeMove), analyze_compare_moves);
+            for (int i = 0; i < count; i++) {
+                moves[i].order = i;
+            }
+            completed_depth = depth;
+            if (moves[0].score > SEARCH_WIN_THRESHOLD) {
+                break;
+            }
+        } else {
+            struct SearchResult result;
+            int ret = search_root(search, &board, position->hand_piece, depth, &result);
+            worker->nodes += result.nodes;
+            if (ret != 0 || result.square < 0) {
+                break;
+            }
+            best = result;
+            completed_depth = depth;
+            if (result.score > SEARCH_WIN_THRESHOLD || result.score < -SEARCH_WIN_THRESHOLD) {
+                break; // proven
+            }
+        }
+    }
+
+    fprintf(out, "%ld %d %ld", position->line, completed_depth, worker->nodes - start_nodes);
+    if (all_moves) {
+        int shown = options->multipv > 0 && options->multipv < count ? options->multipv : count;
+        for (int i = 0; i < shown; i++) {
+            analyze_print_move(out, &board, moves[i].square, moves[i].piece, moves[i].score);
+        }
+    } else {
+        analyze_print_move(out, &board, best.square, best.piece, best.score);
+    }
+    fprintf(out, "\n");
+}
+
+// Must be called with the queue mutex held.
+static void analyze_write_done(struct AnalyzeQueue *queue) {
+    while (queue->done != NULL && queue->done->seq == queue->next_write_seq) {
+        struct AnalyzeBatch *batch = queue->done;
+        queue->done = batch->next;
+        if (batch->output != NULL) {
+            fwrite(batch->output, 1, batch->output_size, queue->out);
+        }
+        free(batch->output);
+        free(batch);
+        queue->next_write_seq++;
+        queue->in_flight--;
+    }
+    pthread_cond_broadcast(&queue->changed);
+}
+
+static void *analyze_worker_main(void *arg) {
+    struct AnalyzeWorker *worker = arg;
+    struct AnalyzeQueue *queue = worker->queue;
+
+    while (true) {
+        pthread_mutex_lock(&queue->mutex);
+        while (queue->pending_head == NULL && !queue->closed) {
+            pthread_cond_wait(&queue->changed, &queue->mutex);
+        }
+        struct AnalyzeBatch *batch = queue->pending_head;
+        if (batch == NULL) {
+            pthread_mutex_unlock(&queue->mutex);
+            break;
+        }
+        queue->pending_head = batch->next;
+        if (queue->pending_head == NULL) {
+            queue->pending_tail = NULL;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+
+        // a batch that can't be analyzed is still passed on, so the batches after it get written
+        FILE *out = open_memstream(&batch->output, &batch->output_size);
+        if (out == NULL) {
+            perror("open_memstream failed");
+            worker->failed = true;
+        } else {
+            for (int i = 0; i < batch->count; i++) {
+                if (batch->positions[i].valid) {
+                    analyze_position(worker, &batch->positions[i], out, worker->moves);
+                } else {
+                    fprintf(out, "%ld invalid\n", batch->positions[i].line);
+                }
+            }
+            fclose(out);
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+        struct AnalyzeBatch **link = &queue->done;
+        while (*link != NULL && (*link)->seq < batch->seq) {
+            link = &(*link)->next;
+        }
+        batch->next = *link;
+        *link = batch;
+        analyze_write_done(queue);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    return NULL;
+}
+
+// Hand a filled batch to the workers.
+static void analyze_submit(struct AnalyzeQueue *queue, struct AnalyzeBatch *batch) {
+    pthread_mutex_lock(&queue->mutex);
+    batch->next = NULL;
+    if (queue->pending_tail == NULL) {
+        queue->pending_head = batch;
+    } else {
+        queue->pending_tail->next = batch;
+    }
+    queue->pending_tail = batch;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Wait until a batch may be read ahead and allocate it.
+//
+// Returns NULL on error.
+static struct AnalyzeBatch *analyze_new_batch(struct AnalyzeQueue *queue, long seq) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->in_flight >= queue->max_in_flight) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    queue->in_flight++;
+    pthread_mutex_unlock(&queue->mutex);
+
+    struct AnalyzeBatch *batch = calloc(1, sizeof(struct AnalyzeBatch));
+    if (batch == NULL) {
+        perror("calloc failed");
+        return NULL;
+    }
+    batch->seq = seq;
+    return batch;
+}
+
+static void analyze_usage(char *name) {
+    printf("Usage: %s [-d depth] [-T ms] [-m moves] [-s size] [-j threads] [-t table bits] [input file]\n", name);
+}
+
+int main(int argc, char **argv) {
+    struct AnalyzeOptions options = {0, 0, 1, 0, 0};
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int table_bits = SEARCH_TT_BITS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:T:m:s:j:t:")) != -1) {
+        switch (opt) {
+            case 'd':
+                options.depth = atoi(optarg);
+                break;
+            case 'T':
+                options.time_ms = atoi(optarg);
+                break;
+            case 'm':
+                options.multipv = atoi(optarg);
+                break;
+            case 's':
+                if (board_parse_size(optarg, &options.width, &options.height) != 0) {
+                    analyze_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 't':
+                table_bits = atoi(optarg);
+                break;
+            default:
+                analyze_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc - 1 || options.depth < 0 || options.time_ms < 0 || options.multipv < 0 || threads < 1
+        || table_bits < 10 || table_bits > 30) {
+        analyze_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (options.depth == 0 && options.time_ms == 0) {
+        options.depth = 5;
+    }
+
+    FILE *in = stdin;
+    if (optind == argc - 1 && strcmp(argv[optind], "-") != 0) {
+        in = fopen(argv[optind], "r");
+        if (in == NULL) {
+            perror("Failed opening input file");
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct AnalyzeQueue queue;
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+    queue.max_in_flight = threads * ANALYZE_BATCHES_PER_THREAD;
+    queue.out = stdout;
+    queue.options = options;
+
+    int ret_val = EXIT_FAILURE;
+    int started = 0;
+    long positions = 0;
+    long invalid = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    double start = quarto_now_ns() / 1e9;
+
+    struct AnalyzeWorker *workers = calloc(threads, sizeof(struct AnalyzeWorker));
+    if (workers == NULL) {
+        perror("calloc failed");
+        goto cleanup;
+    }
+    for (; started < threads; started++) {
+        workers[started].queue = &queue;
+        workers[started].moves = malloc(BOARD_MAX_SQUARES * BOARD_MAX_PIECES * sizeof(struct AnalyzeMove));
+        if (workers[started].moves == NULL) {
+            perror("malloc failed");
+            goto cleanup;
+        }
+        workers[started].search = search_create(table_bits);
+        if (workers[started].search == NULL) {
+            free(workers[started].moves);
+            goto cleanup;
+        }
+        int pthread_ret = pthread_create(&workers[started].thread, NULL, analyze_worker_main, &workers[started]);
+        if (pthread_ret != 0) {
+            printf("Error creating worker thread: %s\n", strerror(pthread_ret));
+            search_free(workers[started].search);
+            free(workers[started].moves);
+            goto cleanup;
+        }
+    }
+
+    struct AnalyzeBatch *batch = NULL;
+    long seq = 0;
+    long line_nr = 0;
+    while (getline(&line, &line_capacity, in) != -1) {
+        line_nr++;
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0') {
+            continue;
+        }
+
+        if (batch == NULL) {
+            batch = analyze_new_batch(&queue, seq++);
+            if (batch == NULL) {
+                goto cleanup;
+            }
+        }
+        struct AnalyzePosition *position = &batch->positions[batch->count++];
+        position->line = line_nr;
+        position->valid = analyze_parse(text, &options, position) == 0;
+        positions++;
+        if (!position->valid) {
+            invalid++;
+        }
+
+        if (batch->count == ANALYZE_BATCH_SIZE) {
+            analyze_submit(&queue, batch);
+            batch = NULL;
+        }
+    }
+    if (batch != NULL) {
+        analyze_submit(&queue, batch);
+    }
+    ret_val = EXIT_SUCCESS;
+
+    cleanup:
+    pthread_mutex_lock(&queue.mutex);
+    queue.closed = true;
+    pthread_cond_broadcast(&queue.changed);
+    pthread_mutex_unlock(&queue.mutex);
+
+    long nodes = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].failed) {
+            ret_val = EXIT_FAILURE;
+        }
+        nodes += workers[i].nodes;
+        search_free(workers[i].search);
+        free(workers[i].moves);
+    }
+    fflush(stdout);
+
+    double elapsed = quarto_now_ns() / 1e9 - start;
+    if (ret_val == EXIT_SUCCESS) {
+        fprintf(stderr, "Analyzed %ld positions (%ld invalid) with %d threads in %.1fs: %.0f positions/s, %.0f nodes/s\n",
+                positions, invalid, threads, elapsed, elapsed > 0 ? positions / elapsed : 0,
+                elapsed > 0 ? nodes / elapsed : 0);
+    }
+
+    free(line);
+    free(workers);
+    if (in != stdin) {
+        fclose(in);
+    }
+    pthread_cond_destroy(&queue.changed);
+    pthread_mutex_destroy(&queue.mutex);
+    return ret_val;
+}
@@ -0,0 +1,454 @@
+// Queries and scans the game archive the client writes (config "archive_file", format in src/archive.h).
+//
+// Without options, all games are scanned and summarized: results, and per move number (our first move, second, ...)
+// the mean think time, its share of the timeout, the mean depth and nodes, as input for time allocation.
+// Throughput is reported on stderr.
+//
+// Usage: quarto-archive [-l] [-g game-id] [-k key] [-i] <archive>
+//   -l  list all games: "<game-id> <start time> <field size> <result> <moves> <think ms>"
+//   -g  print the game with this ID: its players, then per move of ours the position in quarto-analyze input
+//       format, the move in PLAY notation, score, depth, nodes and think time, and finally the result
+//   -k  print all moves made in the position with this canonical key (hex, as in the opening book):
+//       "<game-id> <move nr> <move> <score> <depth> <result>"
+//   -i  sort both indexes, so that lookups binary search them instead of scanning
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "quarto.h"
+
+struct ArchiveMap {
+    unsigned char *data;
+    size_t size;
+};
+
+static const char *archive_result_names[] = {"lost", "won", "draw"};
+
+// Map the file at path read-only.
+//
+// Returns 0 on success, -1 otherwise.
+static int archive_map(const char *path, struct ArchiveMap *map) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error opening archive file");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading archive file size");
+        close(fd);
+        return -1;
+    }
+    map->size = st.st_size;
+    map->data = map->size == 0 ? NULL : mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->data == MAP_FAILED) {
+        perror("Error mapping archive file");
+        return -1;
+    }
+    return 0;
+}
+
+static void archive_unmap(struct ArchiveMap *map) {
+    if (map->data != NULL) {
+        munmap(map->data, map->size);
+    }
+}
+
+// Map the index at archive_path plus suffix and check its header.
+//
+// Returns the number of entries (sorted_count of them sorted), -1 on error.
+static long archive_map_index(const char *archive_path, const char *suffix, size_t entry_size, struct ArchiveMap *map,
+                              uint64_t *sorted_count) {
+    char *path = NULL;
+    if (asprintf(&path, "%s%s", archive_path, suffix) == -1) {
+        perror("asprintf failed");
+        return -1;
+    }
+    int ret = archive_map(path, map);
+    free(path);
+    if (ret != 0) {
+        return -1;
+    }
+
+    struct ArchiveIndexHeader header;
+    if (map->size < sizeof(header) || memcmp(map->data, ARCHIVE_INDEX_MAGIC, 8) != 0) {
+        printf("%s%s is no archive index\n", archive_path, suffix);
+        archive_unmap(map);
+        return -1;
+    }
+    memcpy(&header, map->data, sizeof(header));
+    long count = (map->size - sizeof(header)) / entry_size;
+    *sorted_count = header.sorted_count > (uint64_t)count ? (uint64_t)count : header.sorted_count;
+    return count;
+}
+
+// Decode the record at offset of the archive.
+//
+// Returns 0 on success, -1 if there is no valid record.
+static int archive_read_game(const struct ArchiveMap *archive, uint64_t offset, struct ArchiveGame *game) {
+    if (offset < 8 || offset >= archive->size) {
+        return -1;
+    }
+    return archive_decode(archive->data + offset, archive->size - offset, game) == 0 ? -1 : 0;
+}
+
+static void archive_print_move(int square, int next_piece, int width) {
+    if (next_piece == BOARD_NO_PIECE) {
+        printf("%c%d", 'A' + square % width, 1 + square / width);
+    } else {
+        printf("%c%d,%d", 'A' + square % width, 1 + square / width, next_piece);
+    }
+}
+
+// Print the position in quarto-analyze input format: the cells top row first, then the piece to place.
+static void archive_print_position(uint64_t occupied, const uint8_t *pieces, int width, int height, int hand_piece) {
+    int field[BOARD_MAX_SQUARES];
+    archive_unpack_position(occupied, pieces, width, height, field);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            if (field[y * width + x] < 0) {
+                printf("* ");
+            } else {
+                printf("%d ", field[y * width + x]);
+            }
+        }
+    }
+    if (hand_piece != BOARD_NO_PIECE) {
+        printf("%d", hand_piece);
+    }
+}
+
+static int archive_scan(const struct ArchiveMap *archive, bool list) {
+    static struct ArchiveGame game;
+    long games = 0;
+    long results[3] = {0};
+    long moves = 0;
+    double think_ms[BOARD_MAX_SQUARES] = {0};
+    double timeout_share[BOARD_MAX_SQUARES] = {0};
+    double depth[BOARD_MAX_SQUARES] = {0};
+    double nodes[BOARD_MAX_SQUARES] = {0};
+    long count[BOARD_MAX_SQUARES] = {0};
+
+    uint64_t start_us = quarto_now_ns() / 1000;
+    if (archive->data != NULL) {
+        madvise(archive->data, archive->size, MADV_SEQUENTIAL);
+    }
+    size_t offset = 8;
+    while (offset < archive->size) {
+        size_t length = archive_decode(archive->data + offset, archive->size - offset, &game);
+        if (length == 0) {
+            fprintf(stderr, "Malformed record at offset %zu, stopping there\n", offset);
+            break;
+        }
+        offset += length;
+
+        games++;
+        if (game.header.result <= ARCHIVE_RESULT_DRAW) {
+            results[game.header.result]++;
+        }
+        uint64_t game_think_us = 0;
+        for (int i = 0; i < game.header.move_count; i++) {
+            const struct ArchiveMove *move = &game.moves[i];
+            think_ms[i] += move->think_us / 1000.0;
+            if (move->timeout_ms > 0) {
+                timeout_share[i] += move->think_us / 1000.0 / move->timeout_ms;
+            }
+            depth[i] += move->depth;
+            nodes[i] += move->nodes;
+            count[i]++;
+            game_think_us += move->think_us;
+        }
+        moves += game.header.move_count;
+
+        if (list) {
+            char date[32];
+            time_t start_time = game.header.start_time;
+            strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&start_time));
+            printf("%.*s %s %dx%d %s %d %.1f\n", ARCHIVE_GAME_ID_LENGTH, game.header.game_id, date,
+                   game.header.field_width, game.header.field_height,
+                   game.header.result <= ARCHIVE_RESULT_DRAW ? archive_result_names[game.header.result] : "?",
+                   game.header.move_count, game_think_us / 1000.0);
+        }
+    }
+    uint64_t elapsed_us = quarto_now_ns() / 1000 - start_us;
+
+    if (!list) {
+        printf("%ld games: %ld won, %ld lost, %ld drawn; %ld moves\n", games, results[ARCHIVE_RESULT_WON],
+               results[ARCHIVE_RESULT_LOST], results[ARCHIVE_RESULT_DRAW], moves);
+        if (moves > 0) {
+            printf("move  games  think ms  of timeout  depth  nodes\n");
+        }
+        for (int i = 0; i < BOARD_MAX_SQUARES && count[i] > 0; i++) {
+            printf("%4d %6ld %9.1f %10.1f%% %6.1f %6.0f\n", i + 1, count[i], think_ms[i] / count[i],
+                   100 * timeout_share[i] / count[i], depth[i] / count[i], nodes[i] / count[i]);
+        }
+    }
+    fprintf(stderr, "Scanned %ld games (%zu bytes) in %.1f ms\n", games, offset, elapsed_us / 1000.0);
+    return 0;
+}
+
+static int archive_compare_game_entries(const void *a, const void *b) {
+    return memcmp(((const struct ArchiveGameIndexEntry *)a)->game_id, ((const struct ArchiveGameIndexEntry *)b)->game_id,
+                  ARCHIVE_GAME_ID_LENGTH);
+}
+
+static int archive_compare_position_entries(const void *a, const void *b) {
+    uint64_t key_a = ((const struct ArchivePositionIndexEntry *)a)->key;
+    uint64_t key_b = ((const struct ArchivePositionIndexEntry *)b)->key;
+    return key_a < key_b ? -1 : key_a > key_b;
+}
+
+// Find the first of the sorted entries not less than key (binary search).
+static long archive_lower_bound(const unsigned char *entries, long sorted_count, size_t entry_size, const void *key,
+                                int (*compare)(const void *, const void *)) {
+    long low = 0;
+    long high = sorted_count;
+    while (low < high) {
+        long middle = low + (high - low) / 2;
+        if (compare(entries + middle * entry_size, key) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int archive_print_game(const char *path, const struct ArchiveMap *archive, const char *game_id) {
+    static struct ArchiveGame game;
+    struct ArchiveMap index;
+    uint64_t sorted_count;
+    long count = archive_map_index(path, ARCHIVE_GAME_INDEX_SUFFIX, sizeof(struct ArchiveGameIndexEntry), &index, &sorted_count);
+    if (count < 0) {
+        return -1;
+    }
+
+    struct ArchiveGameIndexEntry key = {0};
+    strncpy(key.game_id, game_id, ARCHIVE_GAME_ID_LENGTH - 1);
+    const unsigned char *entries = index.data + sizeof(struct ArchiveIndexHeader);
+    long found = -1;
+    long first = archive_lower_bound(entries, sorted_count, sizeof(key), &key, archive_compare_game_entries);
+    if (first < (long)sorted_count && archive_compare_game_entries(entries + first * sizeof(key), &key) == 0) {
+        found = first;
+    }
+    for (long i = sorted_count; i < count && found < 0; i++) {
+        if (archive_compare_game_entries(entries + i * sizeof(key), &key) == 0) {
+            found = i;
+        }
+    }
+
+    struct ArchiveGameIndexEntry entry;
+    if (found >= 0) {
+        memcpy(&entry, entries + found * sizeof(entry), sizeof(entry));
+    }
+    archive_unmap(&index);
+    if (found < 0 || archive_read_game(archive, entry.offset, &game) != 0) {
+        printf("Game %s is not in the archive\n", game_id);
+        return -1;
+    }
+
+    int width = game.header.field_width;
+    int height = game.header.field_height;
+    printf("Game %.*s, %dx%d, we are player %d\n", ARCHIVE_GAME_ID_LENGTH, game.header.game_id, width, height, game.header.player_nr);
+    for (int i = 0; i < game.header.names_length; i += strlen(game.names + i) + 1) {
+        printf("Player %s\n", game.names + i);
+    }
+    for (int i = 0; i < game.header.move_count; i++) {
+        const struct ArchiveMove *move = &game.moves[i];
+        archive_print_position(move->occupied, game.pieces[i], width, height, move->hand_piece);
+        printf(" -> ");
+        archive_print_move(move->square, move->next_piece, width);
+        printf(" score %d depth %d nodes %lld think %.1f/%u ms key %016llx\n", move->score, move->depth,
+               (long long)move->nodes, move->think_us / 1000.0, move->timeout_ms, (unsigned long long)move->key);
+    }
+    archive_print_position(game.header.final_occupied, game.final_pieces, width, height, BOARD_NO_PIECE);
+    printf("-> %s\n", game.header.result <= ARCHIVE_RESULT_DRAW ? archive_result_names[game.header.result] : "?");
+    return 0;
+}
+
+static void archive_print_position_entry(const struct ArchiveMap *archive, const struct ArchivePositionIndexEntry *entry) {
+    static struct ArchiveGame game;
+    if (archive_read_game(archive, entry->offset, &game) != 0 || entry->move >= game.header.move_count) {
+        return;
+    }
+    const struct ArchiveMove *move = &game.moves[entry->move];
+    printf("%.*s %u ", ARCHIVE_GAME_ID_LENGTH, game.header.game_id, entry->move + 1);
+    archive_print_move(move->square, move->next_piece, game.header.field_width);
+    printf(" %d %d %s\n", move->score, move->depth,
+           game.header.result <= ARCHIVE_RESULT_DRAW ? archive_result_names[game.header.result] : "?");
+}
+
+static int archive_print_position_moves(const char *path, const struct ArchiveMap *archive, uint64_t key) {
+    struct ArchiveMap index;
+    uint64_t sorted_count;
+    long count = archive_map_index(path, ARCHIVE_POSITION_INDEX_SUFFIX, sizeof(struct ArchivePositionIndexEntry), &index, &sorted_count);
+    if (count < 0) {
+        return -1;
+    }
+
+    struct ArchivePositionIndexEntry search = {key, 0, 0, 0};
+    struct ArchivePositionIndexEntry entry;
+    const unsigned char *entries = index.data + sizeof(struct ArchiveIndexHeader);
+    long i = archive_lower_bound(entries, sorted_count, sizeof(entry), &search, archive_compare_position_entries);
+    for (; i < (long)sorted_count; i++) {
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if (entry.key != key) {
+            break;
+        }
+        archive_print_position_entry(archive, &entry);
+    }
+    for (i = sorted_count; i < count; i++) {
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if (entry.key == key) {
+            archive_print_position_entry(archive, &entry);
+        }
+    }
+
+    archive_unmap(&index);
+    return 0;
+}
+
+// Sort the entries of the index at archive_path plus suffix in place and mark them all as sorted.
+//
+// Returns 0 on success, -1 otherwise.
+static int archive_sort_index(const char *archive_path, const char *suffix, size_t entry_size,
+                              int (*compare)(const void *, const void *)) {
+    char *path = NULL;
+    if (asprintf(&path, "%s%s", archive_path, suffix) == -1) {
+        perror("asprintf failed");
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    free(path);
+    if (fd < 0) {
+        perror("Error opening archive index");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct ArchiveIndexHeader)) {
+        printf("%s%s is no archive index\n", archive_path, suffix);
+        close(fd);
+        return -1;
+    }
+    unsigned char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping archive index");
+        return -1;
+    }
+
+    struct ArchiveIndexHeader header;
+    memcpy(&header, map, sizeof(header));
+    uint64_t count = (st.st_size - sizeof(header)) / entry_size;
+    qsort(map + sizeof(header), count, entry_size, compare);
+    header.sorted_count = count;
+    memcpy(map, &header, sizeof(header));
+
+    int ret = msync(map, st.st_size, MS_SYNC);
+    if (ret != 0) {
+        perror("Error syncing archive index");
+    }
+    munmap(map, st.st_size);
+    printf("Sorted %llu entries of %s%s\n", (unsigned long long)count, archive_path, suffix);
+    return ret;
+}
+
+static int archive_sort_indexes(const char *path) {
+    // the archive's lock guards the indexes too, so no client appends meanwhile
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error opening archive file");
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            perror("Error locking archive file");
+            close(fd);
+            return -1;
+        }
+    }
+
+    int ret = 0;
+    if (archive_sort_index(path, ARCHIVE_GAME_INDEX_SUFFIX, sizeof(struct ArchiveGameIndexEntry), archive_compare_game_entries) != 0
+        || archive_sort_index(path, ARCHIVE_POSITION_INDEX_SUFFIX, sizeof(struct ArchivePositionIndexEntry), archive_compare_position_entries) != 0) {
+        ret = -1;
+    }
+
+    close(fd); // releases the lock
+    return ret;
+}
+
+static void archive_usage(char *name) {
+    printf("Usage: %s [-l] [-g game-id] [-k key] [-i] <archive>\n", name);
+}
+
+int main(int argc, char **argv) {
+    bool list = false;
+    bool sort = false;
+    char *game_id = NULL;
+    char *key_text = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "lg:k:i")) != -1) {
+        switch (opt) {
+            case 'l':
+                list = true;
+                break;
+            case 'g':
+                game_id = optarg;
+                break;
+            case 'k':
+                key_text = optarg;
+                break;
+            case 'i':
+                sort = true;
+                break;
+            default:
+                archive_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        archive_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *path = argv[optind];
+
+    if (sort) {
+        return archive_sort_indexes(path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    struct ArchiveMap archive;
+    if (archive_map(path, &archive) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (archive.size < 8 || memcmp(archive.data, ARCHIVE_MAGIC, 8) != 0) {
+        printf("%s is no archive file\n", path);
+        archive_unmap(&archive);
+        return EXIT_FAILURE;
+    }
+
+    int ret;
+    if (game_id != NULL) {
+        ret = archive_print_game(path, &archive, game_id);
+    } else if (key_text != NULL) {
+        ret = archive_print_position_moves(path, &archive, strtoull(key_text, NULL, 16));
+    } else {
+        ret = archive_scan(&archive, list);
+    }
+
+    archive_unmap(&archive);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
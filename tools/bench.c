@@ -0,0 +1,325 @@
+// Searches a fixed corpus of 4x4 positions to a fixed depth, once without and once with move ordering
+// (killers and history), and reports nodes, time and how often the first move caused the cutoff.
+// Both runs prune unsafe pieces the same way, so only the ordering differs.
+//
+// Usage: quarto-bench [-d depth] [-o] [-p] [-n network]
+//   -d  search depth in plies (default 5)
+//   -o  only run the search with move ordering
+//   -p  search without safe-piece pruning in both runs
+//   -n  evaluate the horizon with this network (for 4x4) in both runs
+//
+// Usage: quarto-bench -c count
+//   -c  instead, check the proof-number search against a full-depth search on count random positions of a
+//       5x4 field (more pieces than squares) with 3 and with 5 free squares each
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "nnue.h"
+#include "pns.h"
+#include "quarto.h"
+#include "search.h"
+
+#define BENCH_FIELD_SIZE 4
+#define BENCH_CHECK_WIDTH 5
+#define BENCH_CHECK_HEIGHT 4
+#define BENCH_CHECK_SEED 1
+
+// One hex digit per square from A1 to D4 ('.' for empty), then the piece in hand.
+// Random positions 3 to 10 plies into the game in which the piece in hand can't win right away.
+static const char *bench_corpus[] = {
+    ".05......a...... 1",
+    ".....5..b..4..3. c",
+    "...f.d...9b..e.. 2",
+    ".7....2d5...8..3 f",
+    "5..4a....0...ecd 1",
+    "1..c..6b..d9.8a. 5",
+    "1.2f9e5...a....0 7",
+    "..86d...b5.2ae.c 3",
+    ".a..c.2..4b.8759 d",
+    "9.781bea.40...3. d",
+};
+
+struct BenchTotals {
+    long nodes;
+    long cutoffs;
+    long first_move_cutoffs;
+    double seconds;
+};
+
+// Returns 0 on success, -1 if the corpus line is malformed.
+static int bench_parse(const char *line, struct Board *board, int *hand_piece) {
+    int squares = BENCH_FIELD_SIZE * BENCH_FIELD_SIZE;
+    int field[BENCH_FIELD_SIZE * BENCH_FIELD_SIZE];
+    for (int s = 0; s < squares; s++) {
+        char c = line[s];
+        if (c == '.') {
+            field[s] = -1;
+        } else if (c >= '0' && c <= '9') {
+            field[s] = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            field[s] = c - 'a' + 10;
+        } else {
+            return -1;
+        }
+    }
+    *hand_piece = (int)strtol(&line[squares + 1], NULL, 16);
+    return board_from_field(board, field, BENCH_FIELD_SIZE, BENCH_FIELD_SIZE, *hand_piece);
+}
+
+// Returns 0 on success, -1 if a position could not be searched.
+static int bench_run(struct Search *search, int depth, int *scores, struct BenchTotals *totals) {
+    memset(totals, 0, sizeof(struct BenchTotals));
+    int count = sizeof(bench_corpus) / sizeof(bench_corpus[0]);
+
+    printf("%-20s %5s %12s %9s %12s\n", "position", "score", "nodes", "ms", "first cutoff");
+    for (int i = 0; i < count; i++) {
+        struct Board board;
+        int hand_piece;
+        if (bench_parse(bench_corpus[i], &board, &hand_piece) != 0) {
+            printf("Invalid corpus position '%s'\n", bench_corpus[i]);
+            return -1;
+        }
+
+        search_clear(search);
+        struct SearchResult result;
+        double start = quarto_now_ns() / 1e9;
+        if (search_root(search, &board, hand_piece, depth, &result) != 0) {
+            return -1;
+        }
+        double seconds = quarto_now_ns() / 1e9 - start;
+
+        scores[i] = result.score;
+        totals->nodes += result.nodes;
+        totals->cutoffs += search->cutoffs;
+        totals->first_move_cutoffs += search->first_move_cutoffs;
+        totals->seconds += seconds;
+        printf("%-20s %5d %12ld %9.1f %11.1f%%\n", bench_corpus[i], result.score, result.nodes, seconds * 1000,
+               search->cutoffs > 0 ? 100.0 * search->first_move_cutoffs / search->cutoffs : 0);
+    }
+
+    printf("%-20s %5s %12ld %9.1f %11.1f%%  (%.0f nodes/s)\n\n", "total", "", totals->nodes, totals->seconds * 1000,
+           totals->cutoffs > 0 ? 100.0 * totals->first_move_cutoffs / totals->cutoffs : 0,
+           totals->seconds > 0 ? totals->nodes / totals->seconds : 0);
+    return 0;
+}
+
+// Print how the ordered run compares to the plain one, e.g. "1.25x more" if it needed more.
+static void bench_print_ratio(double plain, double ordered, char *smaller, char *larger) {
+    if (plain <= 0 || ordered <= 0) {
+        printf("n/a");
+    } else if (ordered <= plain) {
+        printf("%.2fx %s", plain / ordered, smaller);
+    } else {
+        printf("%.2fx %s", ordered / plain, larger);
+    }
+}
+
+// splitmix64, so the checked positions are the same on every run
+static uint64_t bench_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Returns a random piece that is left, BOARD_NO_PIECE if there is none.
+static int bench_random_piece(const struct Board *board, uint64_t *state) {
+    int count = 0;
+    for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+        count += __builtin_popcountll(board->pieces_left[w]);
+    }
+    if (count == 0) {
+        return BOARD_NO_PIECE;
+    }
+    int n = bench_random(state) % count;
+    for (int piece = 0; piece < board->piece_count; piece++) {
+        if (board_piece_left(board, piece) && n-- == 0) {
+            return piece;
+        }
+    }
+    return BOARD_NO_PIECE;
+}
+
+// Play random moves without a win until free_count squares are free.
+//
+// Returns the piece in hand.
+static int bench_random_position(struct Board *board, int free_count, uint64_t *state) {
+    while (true) {
+        board_init(board, BENCH_CHECK_WIDTH, BENCH_CHECK_HEIGHT);
+        int hand_piece = bench_random_piece(board, state);
+        board_take_piece(board, hand_piece);
+        while (__builtin_popcountll(board_free_squares(board)) > free_count) {
+            uint64_t free_squares = board_free_squares(board);
+            for (int n = bench_random(state) % __builtin_popcountll(free_squares); n > 0; n--) {
+                free_squares &= free_squares - 1;
+            }
+            int square = __builtin_ctzll(free_squares);
+            if (board_wins_with(board, square, hand_piece)) {
+                break;
+            }
+            board_place(board, square, hand_piece);
+            hand_piece = bench_random_piece(board, state);
+            board_take_piece(board, hand_piece);
+        }
+        if (__builtin_popcountll(board_free_squares(board)) == free_count) {
+            return hand_piece;
+        }
+    }
+}
+
+// Returns the number of positions on which the proof-number search and the full-depth search disagree
+// whether the side to move wins (positions the proof-number search doesn't solve don't count), or -1 on errors.
+static int bench_check_pns(int count) {
+    struct Search *search = search_create(SEARCH_TT_BITS);
+    struct Pns *pns = pns_create(PNS_TABLE_BITS);
+    if (search == NULL || pns == NULL) {
+        if (search != NULL) {
+            search_free(search);
+        }
+        if (pns != NULL) {
+            pns_free(pns);
+        }
+        return -1;
+    }
+
+    uint64_t state = BENCH_CHECK_SEED;
+    int mismatches = 0;
+    int free_counts[] = {3, 5};
+    for (int f = 0; f < 2; f++) {
+        int free_mismatches = 0;
+        int unsolved = 0;
+        for (int i = 0; i < count; i++) {
+            struct Board board;
+            int hand_piece = bench_random_position(&board, free_counts[f], &state);
+
+            struct SearchResult search_result;
+            struct SearchResult pns_result;
+            search_clear(search);
+            search_iterate(search, &board, hand_piece, 0, NULL, NULL, &search_result);
+            int status = pns_solve(pns, &board, hand_piece, &pns_result);
+            bool search_win = search_result.score > SEARCH_WIN_THRESHOLD;
+            if (status == PNS_UNKNOWN) {
+                unsolved++; // out of nodes, which the thinker handles like any unfinished search
+            } else if ((status == PNS_WIN) != search_win) {
+                free_mismatches++;
+            }
+        }
+        printf("%dx%d, %d free squares: %d of %d positions disagree, %d not solved within the node budget\n",
+               BENCH_CHECK_WIDTH, BENCH_CHECK_HEIGHT, free_counts[f], free_mismatches, count, unsolved);
+        mismatches += free_mismatches;
+    }
+
+    search_free(search);
+    pns_free(pns);
+    return mismatches;
+}
+
+int main(int argc, char **argv) {
+    int depth = 5;
+    bool only_ordered = false;
+    bool pruning = true;
+    char *nnue_path = NULL;
+    int check_count = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:opn:c:")) != -1) {
+        switch (opt) {
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'o':
+                only_ordered = true;
+                break;
+            case 'p':
+                pruning = false;
+                break;
+            case 'n':
+                nnue_path = optarg;
+                break;
+            case 'c':
+                check_count = atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-d depth] [-o] [-p] [-n network] | -c count\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (depth < 1) {
+        printf("Usage: %s [-d depth] [-o] [-p] [-n network] | -c count\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (check_count > 0) {
+        return bench_check_pns(check_count) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    struct Nnue *nnue = NULL;
+    if (nnue_path != NULL) {
+        nnue = nnue_load(nnue_path);
+        if (nnue == NULL) {
+            return EXIT_FAILURE;
+        }
+        if (nnue->field_width != BENCH_FIELD_SIZE || nnue->field_height != BENCH_FIELD_SIZE) {
+            printf("Network %s is for field size %dx%d, the corpus is %dx%d\n", nnue_path, nnue->field_width,
+                   nnue->field_height, BENCH_FIELD_SIZE, BENCH_FIELD_SIZE);
+            nnue_free(nnue);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct Search *search = search_create(SEARCH_TT_BITS);
+    if (search == NULL) {
+        if (nnue != NULL) {
+            nnue_free(nnue);
+        }
+        return EXIT_FAILURE;
+    }
+    search->nnue = nnue;
+    search->pruning = pruning;
+
+    int count = sizeof(bench_corpus) / sizeof(bench_corpus[0]);
+    int plain_scores[count];
+    int ordered_scores[count];
+    struct BenchTotals plain;
+    struct BenchTotals ordered;
+    int ret_val = EXIT_FAILURE;
+
+    if (!only_ordered) {
+        printf("Depth %d, without move ordering:\n", depth);
+        search->ordering = false;
+        if (bench_run(search, depth, plain_scores, &plain) != 0) {
+            goto cleanup;
+        }
+    }
+
+    printf("Depth %d, with move ordering:\n", depth);
+    search->ordering = true;
+    if (bench_run(search, depth, ordered_scores, &ordered) != 0) {
+        goto cleanup;
+    }
+
+    ret_val = EXIT_SUCCESS;
+    if (!only_ordered) {
+        for (int i = 0; i < count; i++) {
+            if (plain_scores[i] != ordered_scores[i]) {
+                printf("Score mismatch for '%s': %d without, %d with ordering\n", bench_corpus[i], plain_scores[i], ordered_scores[i]);
+                ret_val = EXIT_FAILURE;
+            }
+        }
+        printf("Move ordering searched ");
+        bench_print_ratio(plain.nodes, ordered.nodes, "fewer", "more");
+        printf(" nodes in ");
+        bench_print_ratio(plain.seconds, ordered.seconds, "less", "more");
+        printf(" time (%.2fx the nodes/s).\n",
+               plain.nodes > 0 && ordered.seconds > 0 ? (ordered.nodes / ordered.seconds) / (plain.nodes / plain.seconds) : 0);
+    }
+
+    cleanup:
+    search_free(search);
+    if (nnue != NULL) {
+        nnue_free(nnue);
+    }
+    return ret_val;
+}
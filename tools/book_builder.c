@@ -0,0 +1,291 @@
+// Builds an opening book (see src/book.h) by searching every position of the first plies.
+// Positions that are rotations or reflections of each other are searched only once.
+//
+// The book move is played without searching, so it has to be searched deeper than the thinker gets within a
+// move timeout in the opening (depth 3 to 5 for 4x4 at one second).
+//
+// Usage: quarto-book-builder [-s field size] [-p plies] [-d depth] [-j threads] [-t table bits] <book file>
+//   -s  field size as N or WxH, e.g. 5x4 (default 4)
+//   -p  book positions have up to this many pieces on the board (default 1)
+//   -d  search depth per position in plies (default 6)
+//   -j  worker threads (default: number of online CPUs)
+//   -t  transposition table size per thread as power of two (default SEARCH_TT_BITS)
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "book.h"
+#include "quarto.h"
+#include "search.h"
+
+struct BuilderPosition {
+    uint64_t key;
+    int16_t hand_piece;
+    int16_t field[BOARD_MAX_SQUARES];
+};
+
+// The positions of one ply, handed out to the workers by index.
+struct BuilderLevel {
+    struct BuilderPosition *positions;
+    struct SearchResult *results; // per position, square -1 if there is no move
+    long count;
+    atomic_long next;
+    int width;
+    int height;
+    int depth;
+};
+
+struct BuilderWorker {
+    pthread_t thread;
+    struct Search *search; // own transposition table, kept from ply to ply
+    struct BuilderLevel *level;
+    long nodes;
+};
+
+static int builder_compare_positions(const void *a, const void *b) {
+    uint64_t key_a = ((const struct BuilderPosition *)a)->key;
+    uint64_t key_b = ((const struct BuilderPosition *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+// Sort positions by canonical key and drop the duplicates.
+//
+// Returns the number of remaining positions.
+static long builder_unique_positions(struct BuilderPosition *positions, long count) {
+    qsort(positions, count, sizeof(struct BuilderPosition), builder_compare_positions);
+
+    long unique_count = 0;
+    for (long i = 0; i < count; i++) {
+        if (unique_count == 0 || positions[unique_count - 1].key != positions[i].key) {
+            positions[unique_count++] = positions[i];
+        }
+    }
+    return unique_count;
+}
+
+static int builder_board(struct BuilderPosition *position, int width, int height, struct Board *board) {
+    int field[BOARD_MAX_SQUARES];
+    for (int s = 0; s < width * height; s++) {
+        field[s] = position->field[s];
+    }
+    return board_from_field(board, field, width, height, position->hand_piece);
+}
+
+static void *builder_worker_main(void *arg) {
+    struct BuilderWorker *worker = arg;
+    struct BuilderLevel *level = worker->level;
+
+    for (long i = atomic_fetch_add(&level->next, 1); i < level->count; i = atomic_fetch_add(&level->next, 1)) {
+        struct Board board;
+        struct SearchResult *result = &level->results[i];
+        result->square = -1;
+        if (builder_board(&level->positions[i], level->width, level->height, &board) != 0) {
+            continue;
+        }
+        search_root(worker->search, &board, level->positions[i].hand_piece, level->depth, result);
+        worker->nodes += result->nodes;
+    }
+    return NULL;
+}
+
+// Search all positions of level with the workers.
+//
+// Returns 0 on success, -1 if no worker thread could be started.
+static int builder_search_level(struct BuilderWorker *workers, int threads, struct BuilderLevel *level) {
+    atomic_store(&level->next, 0);
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].level = level;
+        int pthread_ret = pthread_create(&workers[t].thread, NULL, builder_worker_main, &workers[t]);
+        if (pthread_ret != 0) {
+            printf("Error creating worker thread: %s\n", strerror(pthread_ret));
+            break;
+        }
+        started++;
+    }
+    // the started workers take over the positions of the others
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    return started > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    int width = 4;
+    int height = 4;
+    int plies = 1;
+    int depth = 6;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int table_bits = SEARCH_TT_BITS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:d:j:t:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (board_parse_size(optarg, &width, &height) != 0) {
+                    width = 0;
+                }
+                break;
+            case 'p':
+                plies = atoi(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 't':
+                table_bits = atoi(optarg);
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || width == 0 || plies < 0 || depth < 1 || threads < 1
+        || table_bits < 10 || table_bits > 30) {
+        printf("Usage: %s [-s field size] [-p plies] [-d depth] [-j threads] [-t table bits] <book file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *book_path = argv[optind];
+
+    struct Board board;
+    board_init(&board, width, height);
+    int squares = board.squares;
+
+    // ply 0: empty board, any piece in hand
+    long level_count = board.piece_count;
+    struct BuilderPosition *level = calloc(level_count, sizeof(struct BuilderPosition));
+    struct SearchResult *results = NULL;
+    struct BookEntry *entries = NULL;
+    long entry_count = 0;
+    int ret_val = EXIT_FAILURE;
+    int worker_count = 0;
+    struct BuilderWorker *workers = calloc(threads, sizeof(struct BuilderWorker));
+    if (level == NULL || workers == NULL) {
+        perror("calloc failed");
+        goto cleanup;
+    }
+    for (; worker_count < threads; worker_count++) {
+        workers[worker_count].search = search_create(table_bits);
+        if (workers[worker_count].search == NULL) {
+            goto cleanup;
+        }
+    }
+    for (int p = 0; p < board.piece_count; p++) {
+        memset(level[p].field, -1, sizeof(level[p].field));
+        level[p].hand_piece = p;
+        int symmetry;
+        level[p].key = board_canonical_key(&board, p, &symmetry);
+    }
+    level_count = builder_unique_positions(level, level_count);
+
+    for (int ply = 0; ply <= plies; ply++) {
+        double start = quarto_now_ns() / 1e9;
+        long nodes = 0;
+
+        struct BookEntry *grown = realloc(entries, (entry_count + level_count) * sizeof(struct BookEntry));
+        if (grown == NULL) {
+            perror("realloc failed");
+            goto cleanup;
+        }
+        entries = grown;
+        free(results);
+        results = malloc(level_count * sizeof(struct SearchResult));
+        if (results == NULL) {
+            perror("malloc failed");
+            goto cleanup;
+        }
+
+        struct BuilderLevel search_level = {level, results, level_count, 0, width, height, depth};
+        for (int t = 0; t < threads; t++) {
+            workers[t].nodes = 0;
+        }
+        if (builder_search_level(workers, threads, &search_level) != 0) {
+            goto cleanup;
+        }
+        for (int t = 0; t < threads; t++) {
+            nodes += workers[t].nodes;
+        }
+
+        // in the order of the positions, so the book doesn't depend on which worker searched what
+        for (long i = 0; i < level_count; i++) {
+            if (results[i].square < 0 || builder_board(&level[i], width, height, &board) != 0) {
+                continue;
+            }
+
+            int symmetry;
+            struct BookEntry *entry = &entries[entry_count++];
+            memset(entry, 0, sizeof(struct BookEntry));
+            entry->key = board_canonical_key(&board, level[i].hand_piece, &symmetry);
+            entry->square = board_map_square(&board, symmetry, results[i].square);
+            entry->piece = results[i].piece;
+            entry->score = results[i].score;
+            entry->depth = depth;
+        }
+
+        double elapsed = quarto_now_ns() / 1e9 - start;
+        printf("ply %d: %ld positions, %ld nodes in %.1fs (%.0f nodes/s, %d threads)\n",
+               ply, level_count, nodes, elapsed, elapsed > 0 ? nodes / elapsed : 0, threads);
+
+        if (ply == plies) {
+            break;
+        }
+
+        // next ply: every placement of the hand piece (that doesn't end the game) and every piece to hand over
+        long next_count = 0;
+        long next_capacity = level_count * squares * board.piece_count;
+        struct BuilderPosition *next = malloc(next_capacity * sizeof(struct BuilderPosition));
+        if (next == NULL) {
+            perror("malloc failed");
+            goto cleanup;
+        }
+        for (long i = 0; i < level_count; i++) {
+            builder_board(&level[i], width, height, &board);
+            int hand_piece = level[i].hand_piece;
+
+            for (int square = 0; square < squares; square++) {
+                if (level[i].field[square] != -1 || board_wins_with(&board, square, hand_piece)) {
+                    continue;
+                }
+                board_place(&board, square, hand_piece);
+                for (int piece = 0; piece < board.piece_count; piece++) {
+                    if (!board_piece_left(&board, piece)) {
+                        continue;
+                    }
+                    struct BuilderPosition *child = &next[next_count++];
+                    memcpy(child->field, level[i].field, sizeof(child->field));
+                    child->field[square] = hand_piece;
+                    child->hand_piece = piece;
+                    int symmetry;
+                    child->key = board_canonical_key(&board, piece, &symmetry);
+                }
+                board_remove(&board, square);
+            }
+        }
+
+        free(level);
+        level = next;
+        level_count = builder_unique_positions(level, next_count);
+    }
+
+    if (book_write(book_path, width, height, entries, entry_count) != 0) {
+        goto cleanup;
+    }
+    printf("Wrote %ld entries to %s\n", entry_count, book_path);
+    ret_val = EXIT_SUCCESS;
+
+    cleanup:
+    for (int t = 0; t < worker_count; t++) {
+        search_free(workers[t].search);
+    }
+    free(workers);
+    free(results);
+    free(level);
+    free(entries);
+    return ret_val;
+}
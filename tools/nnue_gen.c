@@ -0,0 +1,111 @@
+// Writes a network file (format in src/nnue.h) with small random weights. The network plays no better than
+// a coin, but it has the exact size and layout of a trained one, so it is enough to measure the speed of the
+// evaluation (bin/quarto-bench -n) and to test loading, or as starting point for a trainer.
+//
+// Usage: quarto-nnue-gen [-s field size] [-S seed] <file>
+//   -s  field size as N or WxH, e.g. 5x4 (default 4)
+//   -S  random seed (default 1)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "nnue.h"
+
+#define NNUE_GEN_FEATURE_RANGE 64 // feature weights and biases in -64..64
+#define NNUE_GEN_OUTPUT_RANGE 32 // output weights in -32..32
+#define NNUE_GEN_OUTPUT_SHIFT 6
+
+static uint64_t nnue_gen_state;
+
+// xorshift64*, so the same seed gives the same network everywhere
+static uint64_t nnue_gen_next() {
+    nnue_gen_state ^= nnue_gen_state >> 12;
+    nnue_gen_state ^= nnue_gen_state << 25;
+    nnue_gen_state ^= nnue_gen_state >> 27;
+    return nnue_gen_state * 2685821657736338717ULL;
+}
+
+// Returns a uniform value in -range..range.
+static int nnue_gen_weight(int range) {
+    return (int)(nnue_gen_next() % (uint64_t)(2 * range + 1)) - range;
+}
+
+static void nnue_gen_usage(char *name) {
+    printf("Usage: %s [-s field size] [-S seed] <file>\n", name);
+}
+
+int main(int argc, char **argv) {
+    int field_width = 4;
+    int field_height = 4;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:S:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (board_parse_size(optarg, &field_width, &field_height) != 0) {
+                    nnue_gen_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                nnue_gen_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        nnue_gen_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    nnue_gen_state = seed != 0 ? seed : 1; // xorshift never leaves 0
+
+    static int16_t feature_weights[NNUE_INPUTS][NNUE_HIDDEN];
+    int16_t hidden_bias[NNUE_HIDDEN];
+    int8_t output_weights[NNUE_HIDDEN];
+    for (int i = 0; i < NNUE_INPUTS; i++) {
+        for (int h = 0; h < NNUE_HIDDEN; h++) {
+            feature_weights[i][h] = (int16_t)nnue_gen_weight(NNUE_GEN_FEATURE_RANGE);
+        }
+    }
+    for (int h = 0; h < NNUE_HIDDEN; h++) {
+        hidden_bias[h] = (int16_t)nnue_gen_weight(NNUE_GEN_FEATURE_RANGE);
+        output_weights[h] = (int8_t)nnue_gen_weight(NNUE_GEN_OUTPUT_RANGE);
+    }
+
+    struct NnueHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NNUE_MAGIC, sizeof(header.magic));
+    header.field_width = field_width;
+    header.field_height = field_height;
+    header.hidden = NNUE_HIDDEN;
+    header.output_bias = 0;
+    header.output_shift = NNUE_GEN_OUTPUT_SHIFT;
+
+    // the file is little endian, like the machines the client runs on
+    FILE *file = fopen(argv[optind], "wb");
+    if (file == NULL) {
+        perror("Error creating network file");
+        return EXIT_FAILURE;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(feature_weights, sizeof(feature_weights), 1, file) != 1
+        || fwrite(hidden_bias, sizeof(hidden_bias), 1, file) != 1
+        || fwrite(output_weights, sizeof(output_weights), 1, file) != 1) {
+        perror("Error writing network file");
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    if (fclose(file) != 0) {
+        perror("Error writing network file");
+        return EXIT_FAILURE;
+    }
+
+    printf("Wrote random %dx%d network to %s (seed %llu)\n", field_width, field_height, argv[optind],
+           (unsigned long long)seed);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+// Replays a protocol trace (recorded with "trace_file" in the client config) through the real client_play().
+// A socketpair stands in for the game server and the thinker runs as thread, so no network is needed.
+//
+// Usage: quarto-replay [-t] [-q] <trace file>
+//   -t  keep the original timing of the server messages and the move timeout of the trace (default: full speed,
+//       and the thinker only searches for REPLAY_MOVE_MS per move)
+//   -q  only log warnings and errors
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "latency.h"
+#include "log.h"
+#include "main.h"
+#include "net.h"
+#include "placement.h"
+#include "quarto.h"
+#include "shm.h"
+#include "thinker.h"
+#include "trace.h"
+
+#define REPLAY_MOVE_MS 50 // time to the deadline of each move at full speed
+#define REPLAY_WARMUP_WAIT_MS 5000 // at most, for the thinker's warm-up before the first message at full speed
+
+struct ReplayServer {
+    char *trace_path;
+    int sockfd;
+    bool original_timing;
+
+    // results
+    int records;
+    int divergent_lines;
+    long bytes;
+};
+
+// Reads one line (including the newline) from sockfd into line.
+//
+// Returns the line length, 0 on EOF and -1 on error.
+static int replay_read_line(int sockfd, char *line, int size) {
+    int length = 0;
+    while (length < size) {
+        int n = read(sockfd, &line[length], 1);
+        if (n <= 0) {
+            return n;
+        }
+        length++;
+        if (line[length - 1] == '\n') {
+            return length;
+        }
+    }
+    return -1;
+}
+
+// Plays the server side: sends what the client received in the trace, and reads and compares what it sent.
+static void *replay_server_main(void *arg) {
+    struct ReplayServer *server = arg;
+    struct TraceRecord *record = malloc(sizeof(struct TraceRecord));
+    char *line = malloc(TRACE_MAX_RECORD_LENGTH);
+    struct Trace *trace = trace_open(server->trace_path);
+    if (record == NULL || line == NULL || trace == NULL) {
+        goto cleanup;
+    }
+
+    while (trace_read(trace, record) == 1) {
+        server->records++;
+        server->bytes += record->length;
+
+        if (record->direction == TRACE_RECEIVED) {
+            if (server->original_timing) {
+                usleep(record->delta_us);
+            }
+            if (write(server->sockfd, record->data, record->length) != record->length) {
+                perror("replay: write to client failed");
+                break;
+            }
+            continue;
+        }
+
+        // the client sends one line per record; compare line by line, since our moves may differ from the recorded ones
+        int offset = 0;
+        while (offset < record->length) {
+            int expected_length = record->length - offset;
+            char *newline = memchr(&record->data[offset], '\n', expected_length);
+            if (newline != NULL) {
+                expected_length = newline - &record->data[offset] + 1;
+            }
+
+            int length = replay_read_line(server->sockfd, line, TRACE_MAX_RECORD_LENGTH);
+            if (length <= 0) {
+                printf("replay: client closed the connection\n");
+                goto cleanup;
+            }
+
+            if (length != expected_length || memcmp(line, &record->data[offset], length) != 0) {
+                server->divergent_lines++;
+                printf("replay: client sent '%.*s', trace has '%.*s'\n", length - 1, line, expected_length - 1, &record->data[offset]);
+            }
+            offset += expected_length;
+        }
+    }
+
+    cleanup:
+    shutdown(server->sockfd, SHUT_WR);
+    if (trace != NULL) {
+        trace_close(trace);
+    }
+    free(line);
+    free(record);
+    return NULL;
+}
+
+// Finds the game ID and player number the client sent in the trace, and the move timeout of the first
+// "+ MOVE" it received (-1 if there is none).
+//
+// Returns 0 on success, -1 if the trace can't be read or contains no game ID.
+static int replay_scan_trace(char *path, char *game_id, int *player_nr, int *move_timeout) {
+    struct Trace *trace = trace_open(path);
+    struct TraceRecord *record = malloc(sizeof(struct TraceRecord));
+    int ret = -1;
+    if (trace == NULL || record == NULL) {
+        goto cleanup;
+    }
+
+    *player_nr = -1;
+    *move_timeout = -1;
+    while (trace_read(trace, record) == 1) {
+        if (record->length >= TRACE_MAX_RECORD_LENGTH) {
+            continue;
+        }
+        record->data[record->length] = '\0';
+
+        if (record->direction == TRACE_RECEIVED) {
+            char *move = strstr(record->data, "+ MOVE ");
+            if (move != NULL && *move_timeout < 0) {
+                *move_timeout = atoi(&move[7]);
+            }
+        } else if (strncmp(record->data, "ID ", 3) == 0 && record->length >= 3 + GAME_ID_LENGTH) {
+            memcpy(game_id, &record->data[3], GAME_ID_LENGTH);
+            game_id[GAME_ID_LENGTH] = '\0';
+            ret = 0;
+        } else if (strncmp(record->data, "PLAYER ", 7) == 0) {
+            *player_nr = atoi(&record->data[7]);
+        }
+    }
+
+    if (ret != 0) {
+        printf("No game ID found in trace %s\n", path);
+    }
+
+    cleanup:
+    if (trace != NULL) {
+        trace_close(trace);
+    }
+    free(record);
+    return ret;
+}
+
+static void *replay_thinker_main(void *arg) {
+    struct Thinker *thinker = thinker_create(arg);
+    if (thinker == NULL || thinker_loop(thinker) != 0) {
+        printf("replay: thinker failed\n");
+    }
+    if (thinker != NULL) {
+        thinker_free(thinker);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    struct ReplayServer server;
+    memset(&server, 0, sizeof(server));
+    int log_level = LOG_LEVEL_INFO;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "tq")) != -1) {
+        switch (opt) {
+            case 't':
+                server.original_timing = true;
+                break;
+            case 'q':
+                log_level = LOG_LEVEL_WARN;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        printf("Usage: %s [-t] [-q] <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    server.trace_path = argv[optind];
+    log_set_level(log_level);
+
+    char game_id[GAME_ID_LENGTH + 1];
+    int player_nr;
+    int move_timeout;
+    if (replay_scan_trace(server.trace_path, game_id, &player_nr, &move_timeout) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair failed");
+        return EXIT_FAILURE;
+    }
+    server.sockfd = fds[1];
+
+    struct SharedMemory *shared_memory = shm_create_local();
+    struct Net *net = net_create();
+    if (shared_memory == NULL || net == NULL) {
+        return EXIT_FAILURE;
+    }
+    shm_init(shared_memory, false);
+    net->sockfd = fds[0];
+
+    // at full speed, a margin that leaves REPLAY_MOVE_MS of the move timeout; the deadline of the search
+    // and of the watchdog follows from it, as in a game
+    if (!server.original_timing && move_timeout > REPLAY_MOVE_MS) {
+        struct EngineSettings settings;
+        memset(&settings, 0, sizeof(settings));
+        settings.generation = 1;
+        settings.log_level = log_level;
+        settings.move_margin = move_timeout - REPLAY_MOVE_MS;
+        placement_init(&settings.connector_placement);
+        placement_init(&settings.thinker_placement);
+        shm_set_settings(shared_memory, &settings);
+    }
+
+    log_init();
+    uint64_t start_ns = quarto_now_ns();
+
+    pthread_t thinker_thread;
+    pthread_t server_thread;
+    pthread_create(&thinker_thread, NULL, replay_thinker_main, shared_memory);
+    // in a game, the warm-up runs while the server is still in the lobby; it would take the first moves otherwise
+    for (int waited = 0; !server.original_timing && !atomic_load(&shared_memory->thinker_ready)
+                         && waited < REPLAY_WARMUP_WAIT_MS; waited++) {
+        usleep(1000);
+    }
+    pthread_create(&server_thread, NULL, replay_server_main, &server);
+
+    int ret_val = EXIT_SUCCESS;
+    struct Client *client = client_create(net, shared_memory);
+    if (client == NULL || client_play(client, game_id, player_nr) != 0) {
+        printf("replay: client failed\n");
+        ret_val = EXIT_FAILURE;
+    }
+
+    atomic_store(&shared_memory->connector_stopped, true);
+    doorbell_ring(&shared_memory->thinker_request);
+    pthread_join(thinker_thread, NULL);
+
+    // unblock the server if the client stopped early
+    shutdown(fds[0], SHUT_RDWR);
+    pthread_join(server_thread, NULL);
+
+    double elapsed_ms = (quarto_now_ns() - start_ns) / 1e6;
+    log_shutdown();
+
+    printf("Replayed %d records (%ld bytes) in %.3fms, %d divergent client lines\n",
+           server.records, server.bytes, elapsed_ms, server.divergent_lines);
+
+    if (client != NULL) {
+        client_free(client);
+    }
+    net_free(net);
+    close(fds[1]);
+    free(shared_memory);
+    return ret_val;
+}
@@ -0,0 +1,430 @@
+// Generates training data by self-play: worker processes play games with a few random opening plies and
+// a fixed-depth search for every other move, and write one record per searched position.
+//
+// Every worker writes its own shard <prefix>.<worker>.bin: a SelfplayHeader followed by SelfplayRecords.
+// Records hold the position before the move (bit planes as in struct Board), the search score and the
+// final result, both from the view of the side to move.
+//
+// Usage: quarto-selfplay [-n games] [-w workers] [-d depth] [-r random plies] [-s field size] [-S seed] [-D] <prefix>
+//   -n  games in total (default 1000)
+//   -w  worker processes (default: number of online CPUs)
+//   -d  search depth per move in plies (default 4)
+//   -r  random plies at the start of each game (default 4)
+//   -s  field size as N or WxH, e.g. 5x4 (default 4)
+//   -S  random seed (default: time)
+//   -D  write with O_DIRECT, bypassing the page cache (falls back to buffered writes if unsupported)
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "quarto.h"
+#include "search.h"
+
+#define SELFPLAY_MAGIC "QSELF2\n"
+#define SELFPLAY_BUFFER_SIZE (1 << 20) // bytes per write, a multiple of the O_DIRECT alignment
+#define SELFPLAY_ALIGNMENT 4096
+#define SELFPLAY_PROGRESS_SECONDS 5
+
+struct SelfplayHeader {
+    char magic[8];
+    uint16_t field_width;
+    uint16_t field_height;
+    uint32_t record_size;
+};
+
+struct SelfplayRecord {
+    uint64_t occupied;
+    uint64_t planes[BOARD_MAX_ATTRIBUTES];
+    uint64_t pieces_left[BOARD_MAX_PIECES / 64]; // neither on the board nor in hand
+    int16_t score;
+    int16_t hand_piece;
+    int8_t result; // 1 won, 0 draw, -1 lost
+    uint8_t ply; // pieces on the board
+    uint16_t reserved;
+};
+
+// Output shard; all writes go through an aligned buffer, so it can be opened with O_DIRECT.
+struct SelfplayWriter {
+    int fd;
+    bool direct;
+    char *buffer;
+    size_t used;
+    uint64_t written;
+};
+
+// Progress of all workers, in memory shared with the parent.
+struct SelfplayProgress {
+    atomic_long games;
+    atomic_long positions;
+};
+
+struct SelfplayOptions {
+    long games;
+    int workers;
+    int depth;
+    int random_plies;
+    int field_width;
+    int field_height;
+    uint64_t seed;
+    bool direct;
+    char *prefix;
+};
+
+static uint64_t selfplay_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Returns 0 on success, -1 otherwise.
+static int selfplay_flush(struct SelfplayWriter *writer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t ret = write(writer->fd, writer->buffer + done, length - done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write failed");
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+// Returns 0 on success, -1 otherwise.
+static int selfplay_write(struct SelfplayWriter *writer, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        size_t chunk = SELFPLAY_BUFFER_SIZE - writer->used;
+        chunk = chunk < length ? chunk : length;
+        memcpy(writer->buffer + writer->used, bytes, chunk);
+        writer->used += chunk;
+        writer->written += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        if (writer->used == SELFPLAY_BUFFER_SIZE) {
+            if (selfplay_flush(writer, SELFPLAY_BUFFER_SIZE) != 0) {
+                return -1;
+            }
+            writer->used = 0;
+        }
+    }
+    return 0;
+}
+
+// Returns 0 on success, -1 otherwise.
+static int selfplay_open(struct SelfplayWriter *writer, const char *path, int field_width, int field_height,
+                         bool direct) {
+    writer->used = 0;
+    writer->written = 0;
+    writer->direct = direct;
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+    if (writer->fd < 0 && direct && errno == EINVAL) {
+        // e.g. tmpfs doesn't support O_DIRECT
+        writer->direct = false;
+        writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (writer->fd < 0) {
+        perror("Failed opening shard");
+        return -1;
+    }
+    if (posix_memalign((void **)&writer->buffer, SELFPLAY_ALIGNMENT, SELFPLAY_BUFFER_SIZE) != 0) {
+        printf("Failed allocating write buffer\n");
+        close(writer->fd);
+        return -1;
+    }
+
+    struct SelfplayHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SELFPLAY_MAGIC, sizeof(header.magic));
+    header.field_width = field_width;
+    header.field_height = field_height;
+    header.record_size = sizeof(struct SelfplayRecord);
+    return selfplay_write(writer, &header, sizeof(header));
+}
+
+// Returns 0 on success, -1 otherwise.
+static int selfplay_close(struct SelfplayWriter *writer) {
+    int ret = 0;
+    if (writer->used > 0) {
+        // O_DIRECT only writes whole blocks, the padding is cut off again afterwards
+        size_t length = writer->used;
+        if (writer->direct) {
+            length = (length + SELFPLAY_ALIGNMENT - 1) / SELFPLAY_ALIGNMENT * SELFPLAY_ALIGNMENT;
+            memset(writer->buffer + writer->used, 0, length - writer->used);
+        }
+        ret = selfplay_flush(writer, length);
+        if (ret == 0 && writer->direct && ftruncate(writer->fd, writer->written) != 0) {
+            perror("ftruncate failed");
+            ret = -1;
+        }
+    }
+    if (close(writer->fd) != 0) {
+        perror("close failed");
+        ret = -1;
+    }
+    free(writer->buffer);
+    return ret;
+}
+
+static int selfplay_random_free_square(const struct Board *board, uint64_t *state) {
+    uint64_t free_squares = board_free_squares(board);
+    int n = selfplay_random(state) % __builtin_popcountll(free_squares);
+    while (n-- > 0) {
+        free_squares &= free_squares - 1;
+    }
+    return __builtin_ctzll(free_squares);
+}
+
+static int selfplay_random_piece(const struct Board *board, uint64_t *state) {
+    int count = 0;
+    for (int w = 0; w < (board->piece_count + 63) / 64; w++) {
+        count += __builtin_popcountll(board->pieces_left[w]);
+    }
+    if (count == 0) {
+        return BOARD_NO_PIECE;
+    }
+    int n = selfplay_random(state) % count;
+    for (int piece = 0; piece < board->piece_count; piece++) {
+        if (board_piece_left(board, piece) && n-- == 0) {
+            return piece;
+        }
+    }
+    return BOARD_NO_PIECE;
+}
+
+// Play one game and write its searched positions.
+//
+// Returns the number of records written, -1 on error.
+static int selfplay_game(const struct SelfplayOptions *options, struct Search *search, struct SelfplayWriter *writer,
+                         uint64_t *state) {
+    struct Board board;
+    board_init(&board, options->field_width, options->field_height);
+    struct SelfplayRecord records[BOARD_MAX_SQUARES];
+    int movers[BOARD_MAX_SQUARES];
+    int count = 0;
+
+    int hand_piece = selfplay_random_piece(&board, state);
+    board_take_piece(&board, hand_piece);
+    int side = 0;
+    int winner = -1;
+
+    for (int ply = 0; board_free_squares(&board) != 0; ply++) {
+        int square;
+        int piece;
+        if (ply < options->random_plies) {
+            square = selfplay_random_free_square(&board, state);
+            piece = BOARD_NO_PIECE; // chosen after the placement
+        } else {
+            struct SearchResult result;
+            if (search_root(search, &board, hand_piece, options->depth, &result) != 0) {
+                return -1;
+            }
+            square = result.square;
+            piece = result.piece;
+
+            struct SelfplayRecord *record = &records[count];
+            memset(record, 0, sizeof(struct SelfplayRecord));
+            record->occupied = board.occupied;
+            memcpy(record->planes, board.planes, sizeof(record->planes));
+            memcpy(record->pieces_left, board.pieces_left, sizeof(record->pieces_left));
+            record->score = result.score;
+            record->hand_piece = hand_piece;
+            record->ply = ply;
+            movers[count++] = side;
+        }
+
+        if (board_wins_with(&board, square, hand_piece)) {
+            winner = side;
+            break;
+        }
+        board_place(&board, square, hand_piece);
+        if (ply < options->random_plies) {
+            piece = selfplay_random_piece(&board, state);
+        }
+        if (piece == BOARD_NO_PIECE) {
+            break; // no piece left: draw
+        }
+        board_take_piece(&board, piece);
+        hand_piece = piece;
+        side = 1 - side;
+    }
+
+    for (int i = 0; i < count; i++) {
+        records[i].result = winner == -1 ? 0 : (winner == movers[i] ? 1 : -1);
+    }
+    if (selfplay_write(writer, records, count * sizeof(struct SelfplayRecord)) != 0) {
+        return -1;
+    }
+    return count;
+}
+
+// Returns EXIT_SUCCESS or EXIT_FAILURE, used as exit status of the worker process.
+static int selfplay_worker(const struct SelfplayOptions *options, int worker, struct SelfplayProgress *progress) {
+    char *path = NULL;
+    if (asprintf(&path, "%s.%d.bin", options->prefix, worker) == -1) {
+        perror("asprintf failed");
+        return EXIT_FAILURE;
+    }
+    struct Search *search = search_create(SEARCH_TT_BITS);
+    if (search == NULL) {
+        free(path);
+        return EXIT_FAILURE;
+    }
+
+    int ret_val = EXIT_FAILURE;
+    struct SelfplayWriter writer;
+    if (selfplay_open(&writer, path, options->field_width, options->field_height, options->direct) != 0) {
+        goto cleanup;
+    }
+
+    uint64_t state = options->seed ^ ((uint64_t)worker << 32);
+    // game g is played by worker g % workers
+    for (long game = worker; game < options->games; game += options->workers) {
+        int records = selfplay_game(options, search, &writer, &state);
+        if (records < 0) {
+            selfplay_close(&writer);
+            goto cleanup;
+        }
+        atomic_fetch_add(&progress->games, 1);
+        atomic_fetch_add(&progress->positions, records);
+    }
+    if (selfplay_close(&writer) == 0) {
+        ret_val = EXIT_SUCCESS;
+    }
+
+    cleanup:
+    search_free(search);
+    free(path);
+    return ret_val;
+}
+
+static void selfplay_usage(char *name) {
+    printf("Usage: %s [-n games] [-w workers] [-d depth] [-r random plies] [-s field size] [-S seed] [-D] <prefix>\n",
+           name);
+}
+
+int main(int argc, char **argv) {
+    struct SelfplayOptions options;
+    options.games = 1000;
+    options.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    options.depth = 4;
+    options.random_plies = 4;
+    options.field_width = 4;
+    options.field_height = 4;
+    options.seed = time(NULL);
+    options.direct = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:d:r:s:S:D")) != -1) {
+        switch (opt) {
+            case 'n':
+                options.games = atol(optarg);
+                break;
+            case 'w':
+                options.workers = atoi(optarg);
+                break;
+            case 'd':
+                options.depth = atoi(optarg);
+                break;
+            case 'r':
+                options.random_plies = atoi(optarg);
+                break;
+            case 's':
+                if (board_parse_size(optarg, &options.field_width, &options.field_height) != 0) {
+                    selfplay_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                options.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'D':
+                options.direct = true;
+                break;
+            default:
+                selfplay_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || options.games < 0 || options.workers < 1 || options.depth < 1
+        || options.random_plies < 0) {
+        selfplay_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    options.prefix = argv[optind];
+
+    struct SelfplayProgress *progress = mmap(NULL, sizeof(struct SelfplayProgress), PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (progress == MAP_FAILED) {
+        perror("mmap failed");
+        return EXIT_FAILURE;
+    }
+    atomic_init(&progress->games, 0);
+    atomic_init(&progress->positions, 0);
+
+    double start = quarto_now_ns() / 1e9;
+    int running = 0;
+    int ret_val = EXIT_SUCCESS;
+    for (int w = 0; w < options.workers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            ret_val = EXIT_FAILURE;
+            break;
+        }
+        if (pid == 0) {
+            _exit(selfplay_worker(&options, w, progress));
+        }
+        running++;
+    }
+
+    double last_report = start;
+    while (running > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid < 0) {
+            perror("waitpid failed");
+            ret_val = EXIT_FAILURE;
+            break;
+        }
+        if (pid > 0) {
+            running--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                printf("Worker %d failed\n", pid);
+                ret_val = EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        usleep(100000);
+        double now = quarto_now_ns() / 1e9;
+        if (now - last_report >= SELFPLAY_PROGRESS_SECONDS) {
+            last_report = now;
+            long positions = atomic_load(&progress->positions);
+            printf("%ld/%ld games, %ld positions (%.0f positions/hour)\n", atomic_load(&progress->games),
+                   options.games, positions, positions / (now - start) * 3600);
+        }
+    }
+
+    double elapsed = quarto_now_ns() / 1e9 - start;
+    long positions = atomic_load(&progress->positions);
+    printf("Played %ld games with %d workers in %.1fs: %ld positions (%.0f positions/hour) in %s.*.bin\n",
+           atomic_load(&progress->games), options.workers, elapsed, positions,
+           elapsed > 0 ? positions / elapsed * 3600 : 0, options.prefix);
+    munmap(progress, sizeof(struct SelfplayProgress));
+    return ret_val;
+}